@@ -0,0 +1,177 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "animation.h"
+#include "clock.h"
+
+
+/** default lag from which a frame counts as late */
+#define ANIMATION_TOLERANCE_US (2000)
+/**
+ * requests per bulb: while a throttled update is still waiting for its slot,
+ * the next one can be submitted and replaces it
+ */
+#define OPS_PER_BULB (2)
+
+
+static void sleepUntil(int64_t deadline_us) {
+    struct timespec ts = {
+        .tv_sec = deadline_us / 1000000,
+        .tv_nsec = (deadline_us % 1000000) * 1000,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+int lifx_animation_init(lifx_animation_t *p_animation, lifx_ctx_t *p_ctx, const bulb_service_t *p_bulbs, size_t bulb_count, const lifx_frame_t *p_frames, size_t frame_count) {
+    memset(p_animation, 0, sizeof(*p_animation));
+    p_animation->p_bulbs = malloc((bulb_count > 0 ? bulb_count : 1) * sizeof(bulb_service_t));
+    p_animation->p_ops = calloc((bulb_count > 0 ? bulb_count : 1) * OPS_PER_BULB, sizeof(lifx_op_t));
+    if (p_animation->p_bulbs == NULL || p_animation->p_ops == NULL) {
+        printf("allocating animation failed\n");
+        free(p_animation->p_bulbs);
+        free(p_animation->p_ops);
+        return -1;
+    }
+    if (bulb_count > 0) {
+        memcpy(p_animation->p_bulbs, p_bulbs, bulb_count * sizeof(bulb_service_t));
+    }
+    p_animation->p_ctx = p_ctx;
+    p_animation->bulb_count = bulb_count;
+    p_animation->p_frames = p_frames;
+    p_animation->frame_count = frame_count;
+    p_animation->reliability = LIFX_RELIABILITY_NONE;
+    p_animation->tolerance_us = ANIMATION_TOLERANCE_US;
+    return 0;
+}
+
+/** waits for the outstanding updates, their ops have to stay valid until they are completed */
+static void finishOps(lifx_animation_t *p_animation) {
+    for (size_t i = 0; i < p_animation->bulb_count * OPS_PER_BULB; i++) {
+        // an op the context could not complete is given up, the ops are freed afterwards
+        if (p_animation->p_ops[i].status == LIFX_OP_PENDING && lifx_wait(p_animation->p_ctx, &p_animation->p_ops[i]) &&
+                p_animation->p_ops[i].status == LIFX_OP_PENDING) {
+            lifx_cancel(p_animation->p_ctx, &p_animation->p_ops[i]);
+        }
+    }
+}
+
+int lifx_animation_free(lifx_animation_t *p_animation) {
+    if (p_animation->p_ops != NULL) {
+        finishOps(p_animation);
+    }
+    free(p_animation->p_bulbs);
+    free(p_animation->p_ops);
+    p_animation->p_bulbs = NULL;
+    p_animation->p_ops = NULL;
+    p_animation->bulb_count = 0;
+    return 0;
+}
+
+int lifx_animation_start(lifx_animation_t *p_animation) {
+    p_animation->start_us = lx_clock_now_us();
+    p_animation->next_frame = 0;
+    p_animation->frames_sent = 0;
+    p_animation->frames_late = 0;
+    p_animation->frames_skipped = 0;
+    p_animation->updates_dropped = 0;
+    p_animation->max_lag_us = 0;
+    return 0;
+}
+
+static int64_t frameStartUs(const lifx_animation_t *p_animation, size_t frame) {
+    return p_animation->start_us + (int64_t)p_animation->p_frames[frame].at_ms * 1000;
+}
+
+/** submits the colors of a frame to all bulbs, the packets leave in one batch */
+static int sendFrame(lifx_animation_t *p_animation, size_t frame) {
+    const lifx_frame_t *p_frame = &p_animation->p_frames[frame];
+    // an update is useless once the next frame is due, so it is not retransmitted beyond that
+    uint32_t timeout_ms = 0;
+    if (frame + 1 < p_animation->frame_count) {
+        uint32_t gap_ms = p_animation->p_frames[frame + 1].at_ms - p_frame->at_ms;
+        timeout_ms = gap_ms > 0 ? gap_ms : 1;
+    }
+
+    for (size_t i = 0; i < p_animation->bulb_count; i++) {
+        lifx_op_t *p_op = NULL;
+        for (size_t j = 0; j < OPS_PER_BULB && p_op == NULL; j++) {
+            if (p_animation->p_ops[i * OPS_PER_BULB + j].status != LIFX_OP_PENDING) {
+                p_op = &p_animation->p_ops[i * OPS_PER_BULB + j];
+            }
+        }
+        if (p_op == NULL) {
+            p_animation->updates_dropped++;
+            continue;
+        }
+        p_op->reliability = p_animation->reliability;
+        p_op->timeout_ms = timeout_ms;
+        lifx_submit_set_color(p_animation->p_ctx, p_op, &p_animation->p_bulbs[i], p_frame->p_colors[i], p_frame->duration);
+    }
+    // flush the batch & process whatever arrived in the meantime
+    return lifx_run_once(p_animation->p_ctx);
+}
+
+int64_t lifx_animation_step(lifx_animation_t *p_animation) {
+    if (p_animation->next_frame >= p_animation->frame_count) {
+        return 0;
+    }
+    int64_t now = lx_clock_now_us();
+    if (frameStartUs(p_animation, p_animation->next_frame) <= now) {
+        // only the latest due frame is worth sending
+        while (p_animation->next_frame + 1 < p_animation->frame_count && frameStartUs(p_animation, p_animation->next_frame + 1) <= now) {
+            p_animation->frames_skipped++;
+            if (p_animation->p_overrun != NULL) {
+                p_animation->p_overrun(p_animation->p_user, p_animation->next_frame, -1);
+            }
+            p_animation->next_frame++;
+        }
+        size_t frame = p_animation->next_frame;
+        int64_t lag_us = now - frameStartUs(p_animation, frame);
+        p_animation->next_frame++;
+        if (sendFrame(p_animation, frame)) {
+            return -1;
+        }
+        p_animation->frames_sent++;
+        if (lag_us > p_animation->max_lag_us) {
+            p_animation->max_lag_us = lag_us;
+        }
+        if (lag_us > p_animation->tolerance_us) {
+            p_animation->frames_late++;
+            if (p_animation->p_overrun != NULL) {
+                p_animation->p_overrun(p_animation->p_user, frame, lag_us);
+            }
+        }
+        if (p_animation->next_frame >= p_animation->frame_count) {
+            return 0;
+        }
+        now = lx_clock_now_us();
+    }
+    int64_t remaining_us = frameStartUs(p_animation, p_animation->next_frame) - now;
+    return remaining_us > 0 ? remaining_us : 1;
+}
+
+int lifx_animation_run(lifx_animation_t *p_animation) {
+    lifx_animation_start(p_animation);
+    int64_t remaining_us;
+    while ((remaining_us = lifx_animation_step(p_animation)) > 0) {
+        if (remaining_us >= 1000) {
+            // process responses while waiting, epoll only has millisecond resolution
+            if (lifx_poll(p_animation->p_ctx, (int)(remaining_us / 1000))) {
+                return -1;
+            }
+        } else {
+            sleepUntil(frameStartUs(p_animation, p_animation->next_frame));
+        }
+    }
+    finishOps(p_animation);
+    return remaining_us < 0 ? -1 : 0;
+}
@@ -0,0 +1,81 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "bulb.h"
+#include "color.h"
+#include "lifx.h"
+
+
+/** one step of an animation: a color for each bulb, which the bulbs fade into */
+typedef struct {
+    /** start of the frame relative to the start of the animation in milliseconds, non-decreasing */
+    uint32_t at_ms;
+    /** transition duration in milliseconds sent to the bulbs */
+    uint32_t duration;
+    /** one color per bulb of the animation */
+    const color_t *p_colors;
+} lifx_frame_t;
+
+/**
+ * Plays a timeline of frames on a set of bulbs. Frames are scheduled off the monotonic clock,
+ * so timing errors do not accumulate. The packets of a frame are sent to all bulbs in one batch.
+ * A frame that is due while a later one is due as well is skipped, only the latest due frame is sent.
+ */
+typedef struct {
+    lifx_ctx_t *p_ctx;
+    bulb_service_t *p_bulbs;
+    size_t bulb_count;
+    const lifx_frame_t *p_frames;
+    size_t frame_count;
+    /** reliability of the sent colors, fire and forget by default */
+    lifx_reliability_t reliability;
+    /**
+     * called for every frame that is sent later than `tolerance_us` or skipped
+     * @param lag_us time between the frame's start and the moment it was sent, -1 if it was skipped
+     */
+    void (*p_overrun)(void *p_user, size_t frame, int64_t lag_us);
+    void *p_user;
+    /** lag from which a frame counts as late, 2ms by default */
+    int64_t tolerance_us;
+
+    /* state & results */
+    lifx_op_t *p_ops;
+    int64_t start_us;
+    size_t next_frame;
+    size_t frames_sent;
+    size_t frames_late;
+    size_t frames_skipped;
+    /** bulb updates left out because the previous update of the bulb was still pending */
+    size_t updates_dropped;
+    int64_t max_lag_us;
+} lifx_animation_t;
+
+/**
+ * @param p_bulbs bulbs the animation controls, they are copied
+ * @param p_frames timeline, which has to stay valid while the animation is played
+ */
+int lifx_animation_init(lifx_animation_t *p_animation, lifx_ctx_t *p_ctx, const bulb_service_t *p_bulbs, size_t bulb_count, const lifx_frame_t *p_frames, size_t frame_count);
+
+int lifx_animation_free(lifx_animation_t *p_animation);
+
+/** (re)starts the animation at its first frame now */
+int lifx_animation_start(lifx_animation_t *p_animation);
+
+/**
+ * Sends the latest frame that is due, to be called from a custom event loop
+ * @returns microseconds until the next frame is due, 0 once the animation is finished and -1 on error
+ */
+int64_t lifx_animation_step(lifx_animation_t *p_animation);
+
+/** starts the animation and plays it to the end, responses are processed in between frames */
+int lifx_animation_run(lifx_animation_t *p_animation);
+
+#endif
@@ -4,33 +4,38 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
 #include <unistd.h>
 
 #include "lifx.h"
 #include "bulb.h"
 #include "color.h"
+#include "registry.h"
+#include "animation.h"
+#include "scene.h"
 
+/** bulbs of the last run, so that they can be used without waiting for a discovery */
+#define BULB_CACHE "lifx_bulbs.cache"
 
 static void printBulb(bulb_service_t *bulb) {
 	printf("bulb\n");
-	printf("    target: %llu\n", bulb->target);
+	printf("    target: %" PRIu64 "\n", bulb->target);
 	printf("    service: %d\n", bulb->service);
 	printf("    port: %d\n", bulb->port);
 	printf("----\n");
 }
 
-static void printBulbs(bulb_service_t **bulbs) {
-	int bulb_counter = 0;
-	while (bulbs[bulb_counter] != NULL) {
-		printBulb(bulbs[bulb_counter]);
-		bulb_counter++;
+static void printBulbs(lifx_registry_t *registry) {
+	for (size_t i = 0; i < registry->count; i++) {
+		printBulb(&registry->p_bulbs[i]);
 	}
 }
 
-static int printCurrentPowerLevel(bulb_service_t *bulb) {
+static int printCurrentPowerLevel(lifx_ctx_t *ctx, bulb_service_t *bulb) {
 	bool on;
 	int res;
-	if ((res = getPower(bulb, &on))) {
+	if ((res = getPower(ctx, bulb, &on))) {
 		printf("getPower error: %d\n", res);
 		return -1;
 	}
@@ -38,34 +43,34 @@ static int printCurrentPowerLevel(bulb_service_t *bulb) {
 	return 0;
 }
 
-static int testPower(bulb_service_t *bulb) {
+static int testPower(lifx_ctx_t *ctx, bulb_service_t *bulb) {
 	int res;
-	if ((res = setPower(bulb, true, 500))) {
+	if ((res = setPower(ctx, bulb, true, 500))) {
 		printf("setPower error: %d\n", res);
 		return -1;
 	}
 	sleep(2);
-	if (printCurrentPowerLevel(bulb)) {
+	if (printCurrentPowerLevel(ctx, bulb)) {
 		return -1;
 	}
-	if ((res = setPower(bulb, false, 500))) {
+	if ((res = setPower(ctx, bulb, false, 500))) {
 		printf("setPower error: %d\n", res);
 		return -1;
 	}
 	sleep(1);
-	if (printCurrentPowerLevel(bulb)) {
+	if (printCurrentPowerLevel(ctx, bulb)) {
 		return -1;
 	}
 	return 0;
 }
 
-static int testColor(bulb_service_t *bulb) {
+static int testColor(lifx_ctx_t *ctx, bulb_service_t *bulb) {
 	// get color to set the same color afterwards
 	bool on;
 	color_t orig_color;
 	char label[33];
 	int res;
-	if ((res = getColor(bulb, &on, &orig_color, label))) {
+	if ((res = getColor(ctx, bulb, &on, &orig_color, label))) {
 		printf("getColor error: %d\n", res);
 		return -1;
 	}
@@ -100,14 +105,14 @@ static int testColor(bulb_service_t *bulb) {
 		.kelvin = 0x0DAC,
 	};
 
-	if ((res = setColor(bulb, blue, 1000))) {
+	if ((res = setColor(ctx, bulb, blue, 1000))) {
 		printf("setColor (blue) error: %d\n", res);
 		return -1;
 	}
 
 	sleep (3); 
 
-	if ((res = setColor(bulb, green, 0))) {
+	if ((res = setColor(ctx, bulb, green, 0))) {
 		printf("setColor (green) error: %d\n", res);
 		return -1;
 	}
@@ -115,7 +120,7 @@ static int testColor(bulb_service_t *bulb) {
 	sleep (2); 
 
 	// revert color:
-	if ((res = setColor(bulb, white, 500))) { // duration: 2 sec
+	if ((res = setColor(ctx, bulb, white, 500))) { // duration: 2 sec
 		printf("setColor (white) error: %d\n", res);
 		return -1;
 	}
@@ -125,33 +130,109 @@ static int testColor(bulb_service_t *bulb) {
 	return 0;
 }	
 
+static int testAnimation(lifx_ctx_t *ctx, lifx_registry_t *registry) {
+	// rotate the hue of all bulbs once within 2 seconds at 20 fps, neighbouring bulbs are a bit out of phase
+	const size_t frame_count = 40;
+	const uint32_t frame_ms = 50;
+	lifx_frame_t *frames = malloc(frame_count * sizeof(lifx_frame_t));
+	color_t *colors = malloc(frame_count * registry->count * sizeof(color_t));
+	if (frames == NULL || colors == NULL) {
+		free(frames);
+		free(colors);
+		return -1;
+	}
+	for (size_t i = 0; i < frame_count; i++) {
+		for (size_t j = 0; j < registry->count; j++) {
+			colors[i * registry->count + j] = (color_t) {
+				.hue = (uint16_t)((i * 65536 / frame_count + j * 4096) & 0xFFFF),
+				.saturation = 0xFFFF,
+				.brightness = 0xFFFF,
+				.kelvin = 3500,
+			};
+		}
+		frames[i] = (lifx_frame_t) {
+			.at_ms = (uint32_t)i * frame_ms,
+			.duration = frame_ms,
+			.p_colors = &colors[i * registry->count],
+		};
+	}
+
+	lifx_animation_t animation;
+	int res = lifx_animation_init(&animation, ctx, registry->p_bulbs, registry->count, frames, frame_count);
+	if (res == 0) {
+		res = lifx_animation_run(&animation);
+		printf("animation: %zu frames sent, %zu late, %zu skipped, max lag %" PRId64 " us\n", 
+			animation.frames_sent, animation.frames_late, animation.frames_skipped, animation.max_lag_us);
+		lifx_animation_free(&animation);
+	}
+	free(frames);
+	free(colors);
+	return res;
+}
+
 int main(void) {
 	int res;
-	if ((res = init_lifx_lib())) {
+	lifx_ctx_t *ctx;
+	if ((res = init_lifx_lib(&ctx))) {
 		printf("init error: %d\n", res);
 		return -1;
 	}
-	bulb_service_t **bulbs;
-	if ((res = discoverBulbs(&bulbs))) {
+	lifx_registry_t registry;
+	if ((res = lifx_registry_init(&registry))) {
+		printf("registry init error: %d\n", res);
+		return -1;
+	}
+	// cached bulbs are used right away while a discovery in the background picks up changes
+	lifx_op_t discovery = { .status = LIFX_OP_IDLE };
+	if (lifx_registry_load(&registry, BULB_CACHE) > 0) {
+		if ((res = lifx_submit_discover(ctx, &discovery, &registry))) {
+			printf("lifx_submit_discover error: %d\n", res);
+			return -1;
+		}
+	} else if ((res = discoverBulbs(ctx, &registry))) {
 		printf("discoverBulb error: %d\n", res);
 		return -1;
 	}
-	printBulbs(bulbs);
-	if (bulbs[0] != NULL) {
-		if ((res = testPower(bulbs[0]))) {
+	printBulbs(&registry);
+	if (registry.count > 0) {
+		// copied, the background discovery may move the bulbs of the registry
+		bulb_service_t bulb = registry.p_bulbs[0];
+		if ((res = testPower(ctx, &bulb))) {
 			printf("testPower error: %d\n", res);
 			return -1;
 		}
-		if ((res = testColor(bulbs[0]))) {
+		if ((res = testColor(ctx, &bulb))) {
 			printf("testColor error: %d\n", res);
 			return -1;
 		}
+		// the animation leaves all bulbs in new colors, the scene brings back the ones they had before
+		lifx_scene_t scene;
+		lifx_scene_init(&scene);
+		if ((res = lifx_scene_capture(ctx, &scene, &registry, 0)) < 0) {
+			printf("lifx_scene_capture error: %d\n", res);
+			return -1;
+		}
+		if ((res = testAnimation(ctx, &registry))) {
+			printf("testAnimation error: %d\n", res);
+			return -1;
+		}
+		if ((res = lifx_scene_restore(ctx, &scene, &registry, 1000)) != 0) {
+			printf("lifx_scene_restore: %d bulbs not restored\n", res);
+		}
+		lifx_scene_free(&scene);
+	}
+	if (discovery.status == LIFX_OP_PENDING && (res = lifx_wait(ctx, &discovery))) {
+		printf("discovery error: %d\n", res);
+		return -1;
+	}
+	if ((res = lifx_registry_save(&registry, BULB_CACHE))) {
+		printf("lifx_registry_save error: %d\n", res);
 	}
-	if ((res = freeBulbs(bulbs))) {
-		printf("freeBulbs error: %d\n", res);
+	if ((res = lifx_registry_free(&registry))) {
+		printf("registry free error: %d\n", res);
 		return -1;
 	}
-	if ((res = close_lifx_lib())) {
+	if ((res = close_lifx_lib(ctx))) {
 		printf("close error: %d\n", res);
 		return -1;
 	}
@@ -0,0 +1,57 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+#include "fleet.h"
+#include "lifx.h"
+
+
+typedef enum {
+    LX_BATCH_SET_COLOR = 0,
+    LX_BATCH_SET_POWER,
+    LX_BATCH_GET_COLOR,
+} lx_batch_type_t;
+
+/**
+ * Requests of one type to the bulbs [first, first + count) of a fleet, tracked by a single op: the packets are
+ * encoded straight from the arrays of the fleet into the send queue, all bulbs share the sequence number of the op
+ * and the progress of each bulb is one byte of `p_fleet->p_status`. Bulbs that did not confirm are sent the request
+ * again with every retransmission of the op, the op is done once all bulbs confirmed.
+ */
+typedef struct {
+    lifx_fleet_t *p_fleet;
+    size_t first;
+    size_t count;
+    lx_batch_type_t type;
+    /** SetColor: color of each bulb of the range, `count` entries */
+    const color_t *p_colors;
+    /** SetPower */
+    bool on;
+    uint32_t duration;
+    /** GetColor: cached states confirmed at most this many milliseconds ago are used without asking the bulb */
+    uint32_t max_age_ms;
+
+    /* bookkeeping of the library */
+    /** bulbs that did not confirm yet */
+    size_t pending_count;
+    /** next time the bulbs that did not confirm are sent the request again */
+    int64_t retransmit_us;
+    /** some packets were held back by the rate limit, so the send time of the op does not apply to all bulbs */
+    bool throttled;
+} lx_batch_t;
+
+/**
+ * Submits the batch, the confirmed color & power of each bulb are written to `p_colors` & `p_on` of the fleet.
+ * The fleet must not be modified until the op is completed.
+ */
+int lx_batch_submit(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lx_batch_t *p_batch);
+
+#endif
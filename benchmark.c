@@ -0,0 +1,636 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Measures throughput and latency of the library against the simulator on the loopback interface.
+ * For every fleet size a simulator gets spawned, the bulbs are discovered and each operation is run
+ *  - sync: one blocking call at a time, round robin over all bulbs
+ *  - async: one request per bulb kept in flight, a completed request is immediately resubmitted
+ *  - sharded (with -t): the async mode with the bulbs split over a group of shards, each one driven by its own thread
+ * With -k the RGB <-> HSBK conversion kernels are measured as well, one op being the conversion of a frame of pixels.
+ * Every measurement is written as one JSON object per line.
+ */
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "clock.h"
+#include "convert.h"
+#include "lifx.h"
+#include "registry.h"
+#include "shard.h"
+
+
+#define DEFAULT_BASE_PORT (46701)
+#define DEFAULT_DISCOVERY_PORT (46700)
+#define DEFAULT_OPS (20000)
+#define DEFAULT_DISCOVERY_ROUNDS (3)
+#define MAX_FLEET_SIZES (16)
+#define OUTPUT_LINE_LENGTH (128)
+#define POLL_TIMEOUT_MS (100)
+#define CONVERT_ROUNDS (1000)
+
+
+typedef enum {
+    BENCH_GET_COLOR,
+    BENCH_SET_COLOR,
+    BENCH_SET_POWER,
+} bench_op_t;
+
+typedef struct {
+    const char *p_simulator;
+    uint32_t base_port;
+    uint32_t discovery_port;
+    size_t ops;
+    size_t discovery_rounds;
+    size_t p_sizes[MAX_FLEET_SIZES];
+    size_t size_count;
+    /** network conditions the simulator emulates, passed on as is */
+    const char *p_latency_ms;
+    const char *p_jitter_ms;
+    const char *p_loss_percent;
+    /** reliability of the set requests */
+    lifx_reliability_t reliability;
+    /** pixels per converted frame, 0 to skip the conversion kernels */
+    size_t convert_pixels;
+    /** number of shards of the sharded mode, 0 to skip it */
+    size_t shards;
+    FILE *p_output;
+} bench_config_t;
+
+typedef struct {
+    size_t ops;
+    size_t failed;
+    int64_t elapsed_us;
+    /** latency of every successful operation */
+    int64_t *p_latencies;
+    size_t latency_count;
+} bench_result_t;
+
+/** bulbs & results of each shard of the sharded mode */
+typedef struct {
+    bench_op_t op;
+    lifx_registry_t p_registries[LIFX_MAX_SHARDS];
+    bench_result_t p_results[LIFX_MAX_SHARDS];
+} bench_shards_t;
+
+
+static const char *p_op_names[] = {
+    [BENCH_GET_COLOR] = "getColor",
+    [BENCH_SET_COLOR] = "setColor",
+    [BENCH_SET_POWER] = "setPower",
+};
+
+static const char *p_reliability_names[] = {
+    [LIFX_RELIABILITY_DEFAULT] = "default",
+    [LIFX_RELIABILITY_RESPONSE] = "response",
+    [LIFX_RELIABILITY_ACK] = "ack",
+    [LIFX_RELIABILITY_NONE] = "none",
+};
+
+static bench_config_t config = {
+    .p_simulator = "./simulator",
+    .base_port = DEFAULT_BASE_PORT,
+    .discovery_port = DEFAULT_DISCOVERY_PORT,
+    .ops = DEFAULT_OPS,
+    .discovery_rounds = DEFAULT_DISCOVERY_ROUNDS,
+    .p_sizes = { 1, 10, 100, 1000 },
+    .size_count = 4,
+    .p_latency_ms = "0",
+    .p_jitter_ms = "0",
+    .p_loss_percent = "0",
+    .reliability = LIFX_RELIABILITY_RESPONSE,
+    .p_output = NULL,
+};
+
+
+static int compareLatency(const void *p_a, const void *p_b) {
+    int64_t a = *(const int64_t *)p_a;
+    int64_t b = *(const int64_t *)p_b;
+    return (a > b) - (a < b);
+}
+
+/** nearest-rank percentile of sorted latencies */
+static int64_t percentile(const int64_t *p_sorted, size_t count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)(p * (double)count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    }
+    return p_sorted[(rank > count ? count : rank) - 1];
+}
+
+static void report(const char *p_op, const char *p_mode, size_t bulbs, bench_result_t *p_result) {
+    qsort(p_result->p_latencies, p_result->latency_count, sizeof(int64_t), compareLatency);
+    double seconds = (double)p_result->elapsed_us / 1000000;
+    fprintf(config.p_output, "{\"op\":\"%s\",\"mode\":\"%s\",\"reliability\":\"%s\",\"bulbs\":%zu,\"ops\":%zu,\"failed\":%zu,"
+        "\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"p50_us\":%lld,\"p99_us\":%lld,\"p999_us\":%lld}\n",
+        p_op, p_mode, p_reliability_names[config.reliability], bulbs, p_result->ops, p_result->failed, seconds,
+        seconds > 0 ? (double)p_result->ops / seconds : 0.0,
+        (long long)percentile(p_result->p_latencies, p_result->latency_count, 0.5),
+        (long long)percentile(p_result->p_latencies, p_result->latency_count, 0.99),
+        (long long)percentile(p_result->p_latencies, p_result->latency_count, 0.999));
+    fflush(config.p_output);
+}
+
+static color_t colorFor(size_t i) {
+    color_t color = {
+        .hue = (uint16_t)(i * 257),
+        .saturation = 0xFFFF,
+        .brightness = (uint16_t)(0x8000 + (i & 0x7FFF)),
+        .kelvin = 3500,
+    };
+    return color;
+}
+
+static int runSync(lifx_ctx_t *p_ctx, bench_op_t op, lifx_registry_t *p_registry, bench_result_t *p_result) {
+    bool on;
+    color_t color;
+    char label[LIFX_LABEL_LENGTH + 1];
+    int64_t start_us = lx_clock_now_us();
+    for (size_t i = 0; i < p_result->ops; i++) {
+        bulb_service_t *p_bulb = &p_registry->p_bulbs[i % p_registry->count];
+        int64_t sent_us = lx_clock_now_us();
+        int res;
+        switch (op) {
+            case BENCH_GET_COLOR:
+                res = getColor(p_ctx, p_bulb, &on, &color, label);
+                break;
+            case BENCH_SET_COLOR:
+                res = setColor(p_ctx, p_bulb, colorFor(i), 0);
+                break;
+            default:
+                res = setPower(p_ctx, p_bulb, i & 1, 0);
+                break;
+        }
+        if (res) {
+            p_result->failed++;
+        } else {
+            p_result->p_latencies[p_result->latency_count++] = lx_clock_now_us() - sent_us;
+        }
+    }
+    p_result->elapsed_us = lx_clock_now_us() - start_us;
+    return 0;
+}
+
+static int submit(lifx_ctx_t *p_ctx, bench_op_t op, lifx_op_t *p_op, bulb_service_t *p_bulb, size_t i) {
+    switch (op) {
+        case BENCH_GET_COLOR:
+            return lifx_submit_get_color(p_ctx, p_op, p_bulb);
+        case BENCH_SET_COLOR:
+            return lifx_submit_set_color(p_ctx, p_op, p_bulb, colorFor(i), 0);
+        default:
+            return lifx_submit_set_power(p_ctx, p_op, p_bulb, i & 1, 0);
+    }
+}
+
+static int runAsync(lifx_ctx_t *p_ctx, bench_op_t op, lifx_registry_t *p_registry, bench_result_t *p_result) {
+    size_t window = p_registry->count;
+    lifx_op_t *p_ops = calloc(window, sizeof(lifx_op_t));
+    int64_t *p_sent_us = calloc(window, sizeof(int64_t));
+    if (p_ops == NULL || p_sent_us == NULL) {
+        printf("allocating requests failed\n");
+        free(p_ops);
+        free(p_sent_us);
+        return -1;
+    }
+
+    int64_t start_us = lx_clock_now_us();
+    size_t submitted = 0;
+    size_t completed = 0;
+    for (size_t i = 0; i < window && submitted < p_result->ops; i++, submitted++) {
+        p_sent_us[i] = lx_clock_now_us();
+        if (submit(p_ctx, op, &p_ops[i], &p_registry->p_bulbs[i], submitted)) {
+            p_ops[i].status = LIFX_OP_FAILED;
+        }
+    }
+    while (completed < submitted) {
+        // only block when nothing is done yet, fire and forget requests complete right at submission.
+        // The wait is bounded: requests which failed to submit never wake up the poll
+        size_t done = 0;
+        for (size_t i = 0; i < window; i++) {
+            done += p_ops[i].status != LIFX_OP_PENDING && p_ops[i].status != LIFX_OP_IDLE;
+        }
+        if (done > 0 ? lifx_run_once(p_ctx) : lifx_poll(p_ctx, POLL_TIMEOUT_MS)) {
+            break;
+        }
+        int64_t now_us = lx_clock_now_us();
+        for (size_t i = 0; i < window; i++) {
+            lifx_op_t *p_op = &p_ops[i];
+            if (p_op->status == LIFX_OP_PENDING || p_op->status == LIFX_OP_IDLE) {
+                continue;
+            }
+            if (p_op->status == LIFX_OP_DONE) {
+                p_result->p_latencies[p_result->latency_count++] = now_us - p_sent_us[i];
+            } else {
+                p_result->failed++;
+            }
+            p_op->status = LIFX_OP_IDLE;
+            completed++;
+            if (submitted < p_result->ops) {
+                p_sent_us[i] = lx_clock_now_us();
+                if (submit(p_ctx, op, p_op, &p_registry->p_bulbs[i], submitted)) {
+                    p_op->status = LIFX_OP_FAILED;
+                }
+                submitted++;
+            }
+        }
+    }
+    p_result->elapsed_us = lx_clock_now_us() - start_us;
+    p_result->failed += submitted - completed;
+    lifx_wait_all(p_ctx);
+    free(p_ops);
+    free(p_sent_us);
+    return completed < submitted ? -1 : 0;
+}
+
+static int runShardWorker(lifx_ctx_t *p_ctx, size_t shard, void *p_user) {
+    bench_shards_t *p_bench = p_user;
+    if (p_bench->p_registries[shard].count == 0) {
+        return 0;
+    }
+    lifx_set_reliability(p_ctx, config.reliability);
+    return runAsync(p_ctx, p_bench->op, &p_bench->p_registries[shard], &p_bench->p_results[shard]);
+}
+
+/** runs every operation in the async mode on all shards at once, the operations are split evenly over the shards */
+static int runSharded(lifx_registry_t *p_registry) {
+    lifx_shards_t shards;
+    if (lifx_shards_init(&shards, config.shards, 0)) {
+        return -1;
+    }
+    bench_shards_t *p_bench = calloc(1, sizeof(bench_shards_t));
+    int64_t *p_latencies = calloc(config.ops, sizeof(int64_t));
+    int res = p_bench != NULL && p_latencies != NULL ? 0 : -1;
+    size_t initialized = 0;
+    for (; initialized < shards.count && res == 0; initialized++) {
+        res = lifx_registry_init(&p_bench->p_registries[initialized]);
+    }
+    for (size_t i = 0; i < p_registry->count && res == 0; i++) {
+        size_t shard = lifx_shard_of(&shards, p_registry->p_bulbs[i].target);
+        res = lifx_registry_upsert(&p_bench->p_registries[shard], &p_registry->p_bulbs[i]) < 0 ? -1 : 0;
+    }
+
+    for (bench_op_t op = BENCH_GET_COLOR; op <= BENCH_SET_POWER && res == 0; op++) {
+        // every shard gets a share of the operations proportional to its bulbs & its part of the latency buffer
+        p_bench->op = op;
+        size_t offset = 0;
+        for (size_t i = 0; i < shards.count; i++) {
+            size_t ops = config.ops * p_bench->p_registries[i].count / p_registry->count;
+            if (i == shards.count - 1) {
+                ops = config.ops - offset;
+            }
+            p_bench->p_results[i] = (bench_result_t) {
+                .ops = ops,
+                .p_latencies = p_latencies + offset,
+            };
+            offset += ops;
+        }
+        res = lifx_shards_run(&shards, runShardWorker, p_bench);
+        bench_result_t result = {
+            .ops = config.ops,
+            .p_latencies = p_latencies,
+        };
+        for (size_t i = 0; i < shards.count; i++) {
+            // the latencies of each shard are moved next to each other
+            memmove(p_latencies + result.latency_count, p_bench->p_results[i].p_latencies,
+                p_bench->p_results[i].latency_count * sizeof(int64_t));
+            result.latency_count += p_bench->p_results[i].latency_count;
+            result.failed += p_bench->p_results[i].failed;
+            if (p_bench->p_results[i].elapsed_us > result.elapsed_us) {
+                result.elapsed_us = p_bench->p_results[i].elapsed_us;
+            }
+        }
+        if (res == 0) {
+            report(p_op_names[op], "sharded", p_registry->count, &result);
+        }
+    }
+
+    for (size_t i = 0; i < initialized; i++) {
+        lifx_registry_free(&p_bench->p_registries[i]);
+    }
+    free(p_bench);
+    free(p_latencies);
+    lifx_shards_free(&shards);
+    return res;
+}
+
+static int runDiscovery(lifx_ctx_t *p_ctx, size_t bulbs) {
+    bench_result_t result = {
+        .ops = config.discovery_rounds,
+        .p_latencies = calloc(config.discovery_rounds, sizeof(int64_t)),
+    };
+    if (result.p_latencies == NULL) {
+        printf("allocating latencies failed\n");
+        return -1;
+    }
+    int64_t start_us = lx_clock_now_us();
+    for (size_t i = 0; i < config.discovery_rounds; i++) {
+        lifx_registry_t registry;
+        if (lifx_registry_init(&registry)) {
+            free(result.p_latencies);
+            return -1;
+        }
+        int64_t sent_us = lx_clock_now_us();
+        if (discoverBulbs(p_ctx, &registry) || registry.count != bulbs) {
+            result.failed++;
+        } else {
+            result.p_latencies[result.latency_count++] = lx_clock_now_us() - sent_us;
+        }
+        lifx_registry_free(&registry);
+    }
+    result.elapsed_us = lx_clock_now_us() - start_us;
+    report("discoverBulbs", "sync", bulbs, &result);
+    free(result.p_latencies);
+    return 0;
+}
+
+/** converts frames of pixels with every kernel the CPU supports */
+static int runConvert(void) {
+    const char *p_kernels[] = { "avx2", "sse4.1", "scalar" };
+    const char *p_default = lifx_convert_kernel();
+    lifx_rgb8_t *p_rgb = malloc(config.convert_pixels * sizeof(lifx_rgb8_t));
+    color_t *p_colors = malloc(config.convert_pixels * sizeof(color_t));
+    int64_t *p_latencies = calloc(2 * CONVERT_ROUNDS, sizeof(int64_t));
+    if (p_rgb == NULL || p_colors == NULL || p_latencies == NULL) {
+        printf("allocating frames failed\n");
+        free(p_rgb);
+        free(p_colors);
+        free(p_latencies);
+        return -1;
+    }
+    for (size_t i = 0; i < config.convert_pixels; i++) {
+        p_rgb[i] = (lifx_rgb8_t) { .r = (uint8_t)i, .g = (uint8_t)(i * 7), .b = (uint8_t)(i * 13) };
+    }
+    lifx_convert_t convert;
+    lifx_convert_init(&convert, 3500);
+
+    for (size_t k = 0; k < sizeof(p_kernels) / sizeof(p_kernels[0]); k++) {
+        if (lifx_convert_select(p_kernels[k])) {
+            continue;
+        }
+        for (int to_rgb = 0; to_rgb <= 1; to_rgb++) {
+            bench_result_t result = {
+                .ops = CONVERT_ROUNDS,
+                .p_latencies = p_latencies + to_rgb * CONVERT_ROUNDS,
+            };
+            int64_t start_us = lx_clock_now_us();
+            for (size_t i = 0; i < CONVERT_ROUNDS; i++) {
+                struct timespec before, after;
+                clock_gettime(CLOCK_MONOTONIC, &before);
+                if (to_rgb) {
+                    lifx_hsbk_to_rgb8(&convert, p_colors, p_rgb, config.convert_pixels);
+                } else {
+                    lifx_rgb8_to_hsbk(&convert, p_rgb, p_colors, config.convert_pixels);
+                }
+                clock_gettime(CLOCK_MONOTONIC, &after);
+                // conversions of small frames take less than a microsecond, the latencies are rounded up
+                int64_t elapsed_ns = (int64_t)(after.tv_sec - before.tv_sec) * 1000000000 + (after.tv_nsec - before.tv_nsec);
+                result.p_latencies[result.latency_count++] = (elapsed_ns + 999) / 1000;
+            }
+            result.elapsed_us = lx_clock_now_us() - start_us;
+            report(to_rgb ? "hsbkToRgb8" : "rgb8ToHsbk", p_kernels[k], config.convert_pixels, &result);
+        }
+    }
+    lifx_convert_select(p_default);
+    free(p_rgb);
+    free(p_colors);
+    free(p_latencies);
+    return 0;
+}
+
+static int runOperations(lifx_ctx_t *p_ctx, lifx_registry_t *p_registry) {
+    for (bench_op_t op = BENCH_GET_COLOR; op <= BENCH_SET_POWER; op++) {
+        for (int async = 0; async <= 1; async++) {
+            bench_result_t result = {
+                .ops = config.ops,
+                .p_latencies = calloc(config.ops, sizeof(int64_t)),
+            };
+            if (result.p_latencies == NULL) {
+                printf("allocating latencies failed\n");
+                return -1;
+            }
+            int res = async ? runAsync(p_ctx, op, p_registry, &result) : runSync(p_ctx, op, p_registry, &result);
+            if (res == 0) {
+                report(p_op_names[op], async ? "async" : "sync", p_registry->count, &result);
+            }
+            free(result.p_latencies);
+            if (res) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/** starts the simulator and waits until its sockets are bound */
+static pid_t spawnSimulator(size_t bulbs) {
+    int p_pipe[2];
+    if (pipe(p_pipe)) {
+        printf("creating pipe failed (err %d (%s))\n", errno, strerror(errno));
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("forking simulator failed (err %d (%s))\n", errno, strerror(errno));
+        close(p_pipe[0]);
+        close(p_pipe[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        char p_bulbs[24], p_base_port[12], p_discovery_port[12];
+        snprintf(p_bulbs, sizeof(p_bulbs), "%zu", bulbs);
+        snprintf(p_base_port, sizeof(p_base_port), "%u", config.base_port);
+        snprintf(p_discovery_port, sizeof(p_discovery_port), "%u", config.discovery_port);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        dup2(p_pipe[1], STDOUT_FILENO);
+        close(p_pipe[0]);
+        close(p_pipe[1]);
+        execl(config.p_simulator, config.p_simulator, "-n", p_bulbs, "-p", p_base_port,
+            "-d", p_discovery_port, "-l", config.p_latency_ms, "-j", config.p_jitter_ms,
+            "-x", config.p_loss_percent, (char *)NULL);
+        printf("starting %s failed (err %d (%s))\n", config.p_simulator, errno, strerror(errno));
+        _exit(127);
+    }
+
+    close(p_pipe[1]);
+    FILE *p_stream = fdopen(p_pipe[0], "r");
+    char p_line[OUTPUT_LINE_LENGTH];
+    bool ready = p_stream != NULL && fgets(p_line, sizeof(p_line), p_stream) != NULL
+        && strncmp(p_line, "simulating", strlen("simulating")) == 0;
+    if (p_stream != NULL) {
+        fclose(p_stream);
+    } else {
+        close(p_pipe[0]);
+    }
+    if (!ready) {
+        printf("simulator did not start\n");
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+static void stopSimulator(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+static int runFleet(size_t bulbs) {
+    pid_t pid = spawnSimulator(bulbs);
+    if (pid < 0) {
+        return -1;
+    }
+
+    int res = -1;
+    lifx_ctx_t *p_ctx;
+    lifx_registry_t registry;
+    if (init_lifx_lib(&p_ctx)) {
+        stopSimulator(pid);
+        return -1;
+    }
+    lifx_set_reliability(p_ctx, config.reliability);
+    if (lifx_registry_init(&registry)) {
+        close_lifx_lib(p_ctx);
+        stopSimulator(pid);
+        return -1;
+    }
+    lifx_set_broadcast_addr(p_ctx, INADDR_LOOPBACK, config.discovery_port);
+
+    if (discoverBulbs(p_ctx, &registry) == 0 && registry.count == bulbs) {
+        res = runOperations(p_ctx, &registry);
+        if (res == 0 && config.shards > 0) {
+            res = runSharded(&registry);
+        }
+        if (res == 0) {
+            res = runDiscovery(p_ctx, bulbs);
+        }
+    } else {
+        printf("discovered %zu of %zu simulated bulbs\n", registry.count, bulbs);
+    }
+
+    lifx_registry_free(&registry);
+    close_lifx_lib(p_ctx);
+    stopSimulator(pid);
+    return res;
+}
+
+static void printUsage(const char *p_name) {
+    printf("usage: %s [-s simulator] [-n bulbs[,bulbs...]] [-c ops] [-r discovery_rounds] [-p base_port] [-d discovery_port] [-l latency_ms] [-j jitter_ms] [-x loss_percent] [-m response|ack|none] [-k pixels] [-t shards] [-o output]\n", p_name);
+}
+
+static int parseSizes(char *p_list) {
+    config.size_count = 0;
+    for (char *p_token = strtok(p_list, ","); p_token != NULL; p_token = strtok(NULL, ",")) {
+        if (config.size_count == MAX_FLEET_SIZES) {
+            return -1;
+        }
+        size_t bulbs = strtoul(p_token, NULL, 10);
+        if (bulbs == 0) {
+            return -1;
+        }
+        config.p_sizes[config.size_count++] = bulbs;
+    }
+    return config.size_count > 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    const char *p_output = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "s:n:c:r:p:d:l:j:x:m:k:t:o:h")) != -1) {
+        switch (option) {
+            case 's':
+                config.p_simulator = optarg;
+                break;
+            case 'n':
+                if (parseSizes(optarg)) {
+                    printf("invalid list of bulb counts\n");
+                    return -1;
+                }
+                break;
+            case 'c':
+                config.ops = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                config.discovery_rounds = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                config.base_port = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                config.discovery_port = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                config.p_latency_ms = optarg;
+                break;
+            case 'j':
+                config.p_jitter_ms = optarg;
+                break;
+            case 'x':
+                config.p_loss_percent = optarg;
+                break;
+            case 'm':
+                config.reliability = LIFX_RELIABILITY_DEFAULT;
+                for (size_t i = LIFX_RELIABILITY_RESPONSE; i <= LIFX_RELIABILITY_NONE; i++) {
+                    if (strcmp(optarg, p_reliability_names[i]) == 0) {
+                        config.reliability = (lifx_reliability_t)i;
+                    }
+                }
+                if (config.reliability == LIFX_RELIABILITY_DEFAULT) {
+                    printf("unknown reliability %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'k':
+                config.convert_pixels = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                config.shards = strtoul(optarg, NULL, 10);
+                if (config.shards > LIFX_MAX_SHARDS) {
+                    printf("at most %d shards\n", LIFX_MAX_SHARDS);
+                    return -1;
+                }
+                break;
+            case 'o':
+                p_output = optarg;
+                break;
+            default:
+                printUsage(argv[0]);
+                return option == 'h' ? 0 : -1;
+        }
+    }
+    if (config.ops == 0) {
+        printf("invalid number of operations\n");
+        return -1;
+    }
+    config.p_output = p_output != NULL ? fopen(p_output, "w") : stdout;
+    if (config.p_output == NULL) {
+        printf("opening %s failed (err %d (%s))\n", p_output, errno, strerror(errno));
+        return -1;
+    }
+
+    int res = config.convert_pixels > 0 ? runConvert() : 0;
+    for (size_t i = 0; i < config.size_count && res == 0; i++) {
+        res = runFleet(config.p_sizes[i]);
+    }
+    if (config.p_output != stdout) {
+        fclose(config.p_output);
+    }
+    return res;
+}
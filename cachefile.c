@@ -0,0 +1,108 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cachefile.h"
+
+
+/** magic, version & record count */
+#define CACHEFILE_HEADER_SIZE (12)
+
+
+void lx_cachefile_put_le(uint8_t *p_dst, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        p_dst[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+uint64_t lx_cachefile_get_le(const uint8_t *p_src, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t)p_src[i] << (8 * i);
+    }
+    return value;
+}
+
+int lx_cachefile_write(const char *p_path, uint32_t magic, uint32_t version, const uint8_t *p_records, size_t count, size_t record_size) {
+    if (count > UINT32_MAX) {
+        printf("%zu records do not fit into file %s\n", count, p_path);
+        return -1;
+    }
+    // written next to the destination, so that the rename does not cross file systems
+    char *p_tmp_path = malloc(strlen(p_path) + sizeof(".tmp"));
+    if (p_tmp_path == NULL) {
+        printf("allocating path failed\n");
+        return -1;
+    }
+    strcpy(p_tmp_path, p_path);
+    strcat(p_tmp_path, ".tmp");
+    uint8_t header[CACHEFILE_HEADER_SIZE];
+    lx_cachefile_put_le(header, magic, 4);
+    lx_cachefile_put_le(header + 4, version, 4);
+    lx_cachefile_put_le(header + 8, count, 4);
+
+    int res = -1;
+    FILE *p_file = fopen(p_tmp_path, "wb");
+    if (p_file == NULL) {
+        printf("opening file %s failed\n", p_tmp_path);
+    } else {
+        bool written = fwrite(header, 1, sizeof(header), p_file) == sizeof(header) &&
+            fwrite(p_records, 1, count * record_size, p_file) == count * record_size;
+        if (fclose(p_file) || !written) {
+            printf("writing file %s failed\n", p_tmp_path);
+            remove(p_tmp_path);
+        } else if (rename(p_tmp_path, p_path)) {
+            printf("replacing file %s failed\n", p_path);
+            remove(p_tmp_path);
+        } else {
+            res = 0;
+        }
+    }
+    free(p_tmp_path);
+    return res;
+}
+
+uint8_t *lx_cachefile_read(const char *p_path, uint32_t magic, uint32_t version, size_t record_size, size_t *p_count) {
+    FILE *p_file = fopen(p_path, "rb");
+    if (p_file == NULL) {
+        return NULL;
+    }
+    uint8_t header[CACHEFILE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), p_file) != sizeof(header)
+        || lx_cachefile_get_le(header, 4) != magic || lx_cachefile_get_le(header + 4, 4) != version) {
+        printf("file %s is invalid\n", p_path);
+        fclose(p_file);
+        return NULL;
+    }
+    size_t count = (size_t)lx_cachefile_get_le(header + 8, 4);
+    // a truncated or appended file is rejected as a whole
+    struct stat file_stat;
+    if (fstat(fileno(p_file), &file_stat) ||
+        (uint64_t)file_stat.st_size != CACHEFILE_HEADER_SIZE + (uint64_t)count * record_size) {
+        printf("size of file %s does not match its record count\n", p_path);
+        fclose(p_file);
+        return NULL;
+    }
+    uint8_t *p_records = malloc(count > 0 ? count * record_size : 1);
+    if (p_records == NULL) {
+        printf("allocating records of file %s failed\n", p_path);
+        fclose(p_file);
+        return NULL;
+    }
+    bool valid = fread(p_records, 1, count * record_size, p_file) == count * record_size;
+    fclose(p_file);
+    if (!valid) {
+        printf("reading file %s failed\n", p_path);
+        free(p_records);
+        return NULL;
+    }
+    *p_count = count;
+    return p_records;
+}
@@ -0,0 +1,32 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef CACHEFILE_H
+#define CACHEFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * Binary files of fixed size records behind a header of magic, version & record count, all little endian.
+ * Used by the registry cache & by scene files.
+ */
+
+void lx_cachefile_put_le(uint8_t *p_dst, uint64_t value, size_t size);
+
+uint64_t lx_cachefile_get_le(const uint8_t *p_src, size_t size);
+
+/** Writes header & `count` records of `record_size` bytes to a temporary file, which then replaces `p_path` atomically */
+int lx_cachefile_write(const char *p_path, uint32_t magic, uint32_t version, const uint8_t *p_records, size_t count, size_t record_size);
+
+/**
+ * Reads the records of a file written by `lx_cachefile_write`. The record count of the header has to match the
+ * file size, which is checked before anything is allocated, so a corrupt header cannot cause a huge allocation.
+ * @returns the records, which have to be freed, or NULL if the file is missing or invalid
+ */
+uint8_t *lx_cachefile_read(const char *p_path, uint32_t magic, uint32_t version, size_t record_size, size_t *p_count);
+
+#endif
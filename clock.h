@@ -0,0 +1,15 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+
+/** CLOCK_MONOTONIC time in microseconds, the time base of all deadlines & timestamps of the library */
+int64_t lx_clock_now_us(void);
+
+#endif
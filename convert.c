@@ -0,0 +1,618 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_X86
+#include <immintrin.h>
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+
+/** white point channels are clamped to this minimum to keep the gains finite */
+#define MIN_WHITE (1e-6f)
+#define MIN_KELVIN (2500)
+#define MAX_KELVIN (9000)
+#define KELVIN_STEP (500)
+
+_Static_assert(sizeof(lifx_rgb8_t) == 3, "lifx_rgb8_t has to be packed");
+_Static_assert(sizeof(lifx_rgbf_t) == 3 * sizeof(float), "lifx_rgbf_t has to be packed");
+_Static_assert(sizeof(color_t) == 4 * sizeof(uint16_t), "color_t has to be packed");
+
+
+/** per conversion constants derived from a `lifx_convert_t` */
+typedef struct {
+    /** turn source channels into white balanced values, which are clamped to 0 - 1 */
+    float gain_r;
+    float gain_g;
+    float gain_b;
+    /** turn 0 - 1 values into destination channels */
+    float scale_r;
+    float scale_g;
+    float scale_b;
+    uint16_t kelvin;
+} convert_params_t;
+
+typedef struct {
+    const char *p_name;
+    void (*p_rgb8_to_hsbk)(const convert_params_t *p_params, const lifx_rgb8_t *p_src, color_t *p_dst, size_t count);
+    void (*p_rgbf_to_hsbk)(const convert_params_t *p_params, const lifx_rgbf_t *p_src, color_t *p_dst, size_t count);
+    void (*p_hsbk_to_rgb8)(const convert_params_t *p_params, const color_t *p_src, lifx_rgb8_t *p_dst, size_t count);
+    void (*p_hsbk_to_rgbf)(const convert_params_t *p_params, const color_t *p_src, lifx_rgbf_t *p_dst, size_t count);
+} convert_kernels_t;
+
+
+/** black body colors (CIE 1964 10° observer, sRGB) from MIN_KELVIN to MAX_KELVIN in steps of KELVIN_STEP */
+static const uint8_t p_black_body[][3] = {
+    { 255, 161, 72 },   // 2500
+    { 255, 180, 107 },  // 3000
+    { 255, 196, 137 },  // 3500
+    { 255, 209, 163 },  // 4000
+    { 255, 219, 186 },  // 4500
+    { 255, 228, 206 },  // 5000
+    { 255, 236, 224 },  // 5500
+    { 255, 243, 239 },  // 6000
+    { 255, 249, 253 },  // 6500
+    { 245, 243, 255 },  // 7000
+    { 235, 238, 255 },  // 7500
+    { 227, 233, 255 },  // 8000
+    { 220, 229, 255 },  // 8500
+    { 214, 225, 255 },  // 9000
+};
+
+void lifx_convert_init(lifx_convert_t *p_convert, uint16_t kelvin) {
+    p_convert->kelvin = kelvin;
+    p_convert->white = (lifx_rgbf_t) { .r = 1, .g = 1, .b = 1 };
+}
+
+lifx_rgbf_t lifx_white_point(uint16_t kelvin) {
+    uint16_t clamped = kelvin < MIN_KELVIN ? MIN_KELVIN : (kelvin > MAX_KELVIN ? MAX_KELVIN : kelvin);
+    size_t index = (clamped - MIN_KELVIN) / KELVIN_STEP;
+    size_t next = index + 1 < sizeof(p_black_body) / sizeof(p_black_body[0]) ? index + 1 : index;
+    float t = (float)((clamped - MIN_KELVIN) % KELVIN_STEP) / KELVIN_STEP;
+    lifx_rgbf_t white = {
+        .r = ((1 - t) * p_black_body[index][0] + t * p_black_body[next][0]) / 255,
+        .g = ((1 - t) * p_black_body[index][1] + t * p_black_body[next][1]) / 255,
+        .b = ((1 - t) * p_black_body[index][2] + t * p_black_body[next][2]) / 255,
+    };
+    float max = white.r > white.g ? white.r : white.g;
+    max = max > white.b ? max : white.b;
+    white.r /= max;
+    white.g /= max;
+    white.b /= max;
+    return white;
+}
+
+static float clampWhite(float channel) {
+    return channel > MIN_WHITE ? channel : MIN_WHITE;
+}
+
+/** @param range maximal value of a channel of the RGB format */
+static convert_params_t paramsFor(const lifx_convert_t *p_convert, float range) {
+    float white_r = clampWhite(p_convert->white.r);
+    float white_g = clampWhite(p_convert->white.g);
+    float white_b = clampWhite(p_convert->white.b);
+    return (convert_params_t) {
+        .gain_r = 1 / (range * white_r),
+        .gain_g = 1 / (range * white_g),
+        .gain_b = 1 / (range * white_b),
+        .scale_r = range * white_r,
+        .scale_g = range * white_g,
+        .scale_b = range * white_b,
+        .kelvin = p_convert->kelvin,
+    };
+}
+
+
+/*
+ * Scalar kernel. The vector kernels perform exactly the same float operations in the same order,
+ * so all kernels produce identical results. Integer values are rounded by adding 0.5 and truncating.
+ */
+
+static float minf(float a, float b) {
+    return a < b ? a : b;
+}
+
+/** NaN becomes `b` like with maxps */
+static float maxf(float a, float b) {
+    return a > b ? a : b;
+}
+
+static float clampUnit(float channel) {
+    return minf(maxf(channel, 0), 1);
+}
+
+/** @param r, g, b white balanced channels */
+static void rgbToHsbk(float r, float g, float b, uint16_t kelvin, color_t *p_color) {
+    r = clampUnit(r);
+    g = clampUnit(g);
+    b = clampUnit(b);
+    float max = maxf(r, maxf(g, b));
+    float min = minf(r, minf(g, b));
+    float delta = max - min;
+    // hue in sixths of the color wheel: 0 red, 2 green, 4 blue
+    float hue = 0;
+    if (delta != 0) {
+        if (max == r) {
+            hue = (g - b) / delta;
+            if (hue < 0) {
+                hue += 6;
+            }
+        } else if (max == g) {
+            hue = (b - r) / delta + 2;
+        } else {
+            hue = (r - g) / delta + 4;
+        }
+    }
+    float saturation = max != 0 ? delta / max : 0;
+    // a hue rounded up to a full turn wraps around to 0
+    p_color->hue = (uint16_t)((uint32_t)(hue * (65536.0f / 6) + 0.5f) & 0xFFFF);
+    p_color->saturation = (uint16_t)(saturation * 65535 + 0.5f);
+    p_color->brightness = (uint16_t)(max * 65535 + 0.5f);
+    p_color->kelvin = kelvin;
+}
+
+/** one channel of HSV to RGB, n is 5 for red, 3 for green and 1 for blue */
+static float hsbkChannel(float hue, float saturation, float brightness, float n, float scale) {
+    float k = hue + n;
+    if (k >= 6) {
+        k -= 6;
+    }
+    float f = maxf(minf(minf(k, 4 - k), 1), 0);
+    return brightness * (1 - saturation * f) * scale;
+}
+
+static void hsbkToRgb(const convert_params_t *p_params, const color_t *p_color, float *p_r, float *p_g, float *p_b) {
+    float hue = (float)p_color->hue * (6.0f / 65536);
+    float saturation = (float)p_color->saturation * (1.0f / 65535);
+    float brightness = (float)p_color->brightness * (1.0f / 65535);
+    *p_r = hsbkChannel(hue, saturation, brightness, 5, p_params->scale_r);
+    *p_g = hsbkChannel(hue, saturation, brightness, 3, p_params->scale_g);
+    *p_b = hsbkChannel(hue, saturation, brightness, 1, p_params->scale_b);
+}
+
+static void scalarRgb8ToHsbk(const convert_params_t *p_params, const lifx_rgb8_t *p_src, color_t *p_dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        rgbToHsbk((float)p_src[i].r * p_params->gain_r, (float)p_src[i].g * p_params->gain_g,
+            (float)p_src[i].b * p_params->gain_b, p_params->kelvin, &p_dst[i]);
+    }
+}
+
+static void scalarRgbfToHsbk(const convert_params_t *p_params, const lifx_rgbf_t *p_src, color_t *p_dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        rgbToHsbk(p_src[i].r * p_params->gain_r, p_src[i].g * p_params->gain_g,
+            p_src[i].b * p_params->gain_b, p_params->kelvin, &p_dst[i]);
+    }
+}
+
+static void scalarHsbkToRgb8(const convert_params_t *p_params, const color_t *p_src, lifx_rgb8_t *p_dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        float r, g, b;
+        hsbkToRgb(p_params, &p_src[i], &r, &g, &b);
+        p_dst[i].r = (uint8_t)(int32_t)(r + 0.5f);
+        p_dst[i].g = (uint8_t)(int32_t)(g + 0.5f);
+        p_dst[i].b = (uint8_t)(int32_t)(b + 0.5f);
+    }
+}
+
+static void scalarHsbkToRgbf(const convert_params_t *p_params, const color_t *p_src, lifx_rgbf_t *p_dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        hsbkToRgb(p_params, &p_src[i], &p_dst[i].r, &p_dst[i].g, &p_dst[i].b);
+    }
+}
+
+static const convert_kernels_t scalar_kernels = {
+    .p_name = "scalar",
+    .p_rgb8_to_hsbk = scalarRgb8ToHsbk,
+    .p_rgbf_to_hsbk = scalarRgbfToHsbk,
+    .p_hsbk_to_rgb8 = scalarHsbkToRgb8,
+    .p_hsbk_to_rgbf = scalarHsbkToRgbf,
+};
+
+
+#ifdef CONVERT_X86
+
+/*
+ * Pixel layout helpers shared by the SSE4.1 & AVX2 kernels, each handles 4 pixels.
+ * Byte shuffles move RGB8 pixels into 32 bit lanes & back, float shuffles transpose RGBf pixels.
+ */
+
+/** gathers one channel of 4 RGB8 pixels (the first 12 bytes) into 32 bit lanes */
+#define RGB8_CHANNEL_MASK(c) _mm_setr_epi8(c, -1, -1, -1, c + 3, -1, -1, -1, c + 6, -1, -1, -1, c + 9, -1, -1, -1)
+/** compacts 4 pixels of 0x00BBGGRR lanes into 12 bytes */
+#define RGB8_PACK_MASK _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1)
+
+/** writes the first 12 bytes without touching the memory behind them */
+static inline TARGET_SSE41 void store12(uint8_t *p_dst, __m128i pixels) {
+    _mm_storel_epi64((__m128i *)p_dst, pixels);
+    uint32_t last = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(pixels, 8));
+    memcpy(p_dst + 8, &last, sizeof(last));
+}
+
+/** splits 4 RGBf pixels into one register per channel */
+static inline TARGET_SSE41 void loadRgbf4(const lifx_rgbf_t *p_src, __m128 *p_r, __m128 *p_g, __m128 *p_b) {
+    const float *p_floats = &p_src->r;
+    __m128 in0 = _mm_loadu_ps(p_floats);     // r0 g0 b0 r1
+    __m128 in1 = _mm_loadu_ps(p_floats + 4); // g1 b1 r2 g2
+    __m128 in2 = _mm_loadu_ps(p_floats + 8); // b2 r3 g3 b3
+    __m128 r23 = _mm_shuffle_ps(in1, in2, _MM_SHUFFLE(1, 1, 2, 2));
+    *p_r = _mm_shuffle_ps(in0, r23, _MM_SHUFFLE(2, 0, 3, 0));
+    __m128 g01 = _mm_shuffle_ps(in0, in1, _MM_SHUFFLE(0, 0, 1, 1));
+    __m128 g23 = _mm_shuffle_ps(in1, in2, _MM_SHUFFLE(2, 2, 3, 3));
+    *p_g = _mm_shuffle_ps(g01, g23, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 b01 = _mm_shuffle_ps(in0, in1, _MM_SHUFFLE(1, 1, 2, 2));
+    __m128 b23 = _mm_shuffle_ps(in2, in2, _MM_SHUFFLE(3, 3, 0, 0));
+    *p_b = _mm_shuffle_ps(b01, b23, _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+/** interleaves one register per channel into 4 RGBf pixels */
+static inline TARGET_SSE41 void storeRgbf4(lifx_rgbf_t *p_dst, __m128 r, __m128 g, __m128 b) {
+    float *p_floats = &p_dst->r;
+    __m128 rg01 = _mm_unpacklo_ps(r, g); // r0 g0 r1 g1
+    __m128 rg23 = _mm_unpackhi_ps(r, g); // r2 g2 r3 g3
+    __m128 b0r1 = _mm_shuffle_ps(b, rg01, _MM_SHUFFLE(3, 2, 0, 0));
+    _mm_storeu_ps(p_floats, _mm_shuffle_ps(rg01, b0r1, _MM_SHUFFLE(2, 0, 1, 0)));
+    __m128 g1b1 = _mm_shuffle_ps(rg01, b, _MM_SHUFFLE(1, 1, 3, 3));
+    _mm_storeu_ps(p_floats + 4, _mm_shuffle_ps(g1b1, rg23, _MM_SHUFFLE(1, 0, 2, 0)));
+    __m128 b2b3 = _mm_shuffle_ps(b, rg23, _MM_SHUFFLE(3, 2, 3, 2)); // b2 b3 r3 g3
+    _mm_storeu_ps(p_floats + 8, _mm_shuffle_ps(b2b3, b2b3, _MM_SHUFFLE(1, 3, 2, 0)));
+}
+
+
+/* SSE4.1 kernel: 4 pixels per iteration */
+
+static inline TARGET_SSE41 __m128 sseClampUnit(__m128 channel) {
+    return _mm_min_ps(_mm_max_ps(channel, _mm_setzero_ps()), _mm_set1_ps(1));
+}
+
+/** converts 4 white balanced pixels & stores them as HSBK */
+static inline TARGET_SSE41 void sseRgbToHsbk(__m128 r, __m128 g, __m128 b, __m128i kelvin, color_t *p_dst) {
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1);
+    r = sseClampUnit(r);
+    g = sseClampUnit(g);
+    b = sseClampUnit(b);
+    __m128 max = _mm_max_ps(r, _mm_max_ps(g, b));
+    __m128 min = _mm_min_ps(r, _mm_min_ps(g, b));
+    __m128 delta = _mm_sub_ps(max, min);
+    __m128 gray = _mm_cmpeq_ps(delta, zero);
+    __m128 divisor = _mm_blendv_ps(delta, one, gray);
+
+    __m128 hue_r = _mm_div_ps(_mm_sub_ps(g, b), divisor);
+    hue_r = _mm_add_ps(hue_r, _mm_and_ps(_mm_cmplt_ps(hue_r, zero), _mm_set1_ps(6)));
+    __m128 hue_g = _mm_add_ps(_mm_div_ps(_mm_sub_ps(b, r), divisor), _mm_set1_ps(2));
+    __m128 hue_b = _mm_add_ps(_mm_div_ps(_mm_sub_ps(r, g), divisor), _mm_set1_ps(4));
+    __m128 hue = _mm_blendv_ps(hue_b, hue_g, _mm_cmpeq_ps(max, g));
+    hue = _mm_blendv_ps(hue, hue_r, _mm_cmpeq_ps(max, r));
+    hue = _mm_andnot_ps(gray, hue);
+
+    __m128 black = _mm_cmpeq_ps(max, zero);
+    __m128 saturation = _mm_andnot_ps(black, _mm_div_ps(delta, _mm_blendv_ps(max, one, black)));
+
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128i hue16 = _mm_and_si128(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(hue, _mm_set1_ps(65536.0f / 6)), half)), _mm_set1_epi32(0xFFFF));
+    __m128i saturation16 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(saturation, _mm_set1_ps(65535)), half));
+    __m128i brightness16 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(max, _mm_set1_ps(65535)), half));
+
+    // h0-3 s0-3 & b0-3 k0-3 -> h0 s0 b0 k0 h1 ...
+    __m128i hs = _mm_packus_epi32(hue16, saturation16);
+    __m128i bk = _mm_packus_epi32(brightness16, kelvin);
+    __m128i hb = _mm_unpacklo_epi16(hs, bk);
+    __m128i sk = _mm_unpackhi_epi16(hs, bk);
+    _mm_storeu_si128((__m128i *)p_dst, _mm_unpacklo_epi16(hb, sk));
+    _mm_storeu_si128((__m128i *)(p_dst + 2), _mm_unpackhi_epi16(hb, sk));
+}
+
+static inline TARGET_SSE41 __m128 sseHsbkChannel(__m128 hue, __m128 saturation, __m128 brightness, float n, float scale) {
+    __m128 six = _mm_set1_ps(6);
+    __m128 k = _mm_add_ps(hue, _mm_set1_ps(n));
+    k = _mm_sub_ps(k, _mm_and_ps(_mm_cmpge_ps(k, six), six));
+    __m128 f = _mm_max_ps(_mm_min_ps(_mm_min_ps(k, _mm_sub_ps(_mm_set1_ps(4), k)), _mm_set1_ps(1)), _mm_setzero_ps());
+    return _mm_mul_ps(_mm_mul_ps(brightness, _mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(saturation, f))), _mm_set1_ps(scale));
+}
+
+/** loads 4 HSBK colors & converts them to scaled RGB channels */
+static inline TARGET_SSE41 void sseHsbkToRgb(const convert_params_t *p_params, const color_t *p_src, __m128 *p_r, __m128 *p_g, __m128 *p_b) {
+    __m128i in0 = _mm_loadu_si128((const __m128i *)p_src);
+    __m128i in1 = _mm_loadu_si128((const __m128i *)(p_src + 2));
+    // h0 s0 b0 k0 h1 ... -> h0-3 s0-3 & b0-3 k0-3
+    __m128i lo = _mm_unpacklo_epi16(in0, in1);
+    __m128i hi = _mm_unpackhi_epi16(in0, in1);
+    __m128i hs = _mm_unpacklo_epi16(lo, hi);
+    __m128i bk = _mm_unpackhi_epi16(lo, hi);
+    __m128i zero = _mm_setzero_si128();
+    __m128 hue = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hs, zero)), _mm_set1_ps(6.0f / 65536));
+    __m128 saturation = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hs, zero)), _mm_set1_ps(1.0f / 65535));
+    __m128 brightness = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(bk, zero)), _mm_set1_ps(1.0f / 65535));
+    *p_r = sseHsbkChannel(hue, saturation, brightness, 5, p_params->scale_r);
+    *p_g = sseHsbkChannel(hue, saturation, brightness, 3, p_params->scale_g);
+    *p_b = sseHsbkChannel(hue, saturation, brightness, 1, p_params->scale_b);
+}
+
+static TARGET_SSE41 void sseRgb8ToHsbk(const convert_params_t *p_params, const lifx_rgb8_t *p_src, color_t *p_dst, size_t count) {
+    __m128i kelvin = _mm_set1_epi32(p_params->kelvin);
+    size_t i = 0;
+    // each 16 byte load covers 4 pixels & 4 bytes of the next ones, which have to exist
+    for (; i + 6 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)&p_src[i]);
+        __m128 r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_shuffle_epi8(pixels, RGB8_CHANNEL_MASK(0))), _mm_set1_ps(p_params->gain_r));
+        __m128 g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_shuffle_epi8(pixels, RGB8_CHANNEL_MASK(1))), _mm_set1_ps(p_params->gain_g));
+        __m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_shuffle_epi8(pixels, RGB8_CHANNEL_MASK(2))), _mm_set1_ps(p_params->gain_b));
+        sseRgbToHsbk(r, g, b, kelvin, &p_dst[i]);
+    }
+    scalarRgb8ToHsbk(p_params, p_src + i, p_dst + i, count - i);
+}
+
+static TARGET_SSE41 void sseRgbfToHsbk(const convert_params_t *p_params, const lifx_rgbf_t *p_src, color_t *p_dst, size_t count) {
+    __m128i kelvin = _mm_set1_epi32(p_params->kelvin);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 r, g, b;
+        loadRgbf4(&p_src[i], &r, &g, &b);
+        sseRgbToHsbk(_mm_mul_ps(r, _mm_set1_ps(p_params->gain_r)), _mm_mul_ps(g, _mm_set1_ps(p_params->gain_g)),
+            _mm_mul_ps(b, _mm_set1_ps(p_params->gain_b)), kelvin, &p_dst[i]);
+    }
+    scalarRgbfToHsbk(p_params, p_src + i, p_dst + i, count - i);
+}
+
+static TARGET_SSE41 void sseHsbkToRgb8(const convert_params_t *p_params, const color_t *p_src, lifx_rgb8_t *p_dst, size_t count) {
+    __m128 half = _mm_set1_ps(0.5f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 r, g, b;
+        sseHsbkToRgb(p_params, &p_src[i], &r, &g, &b);
+        __m128i pixels = _mm_or_si128(_mm_cvttps_epi32(_mm_add_ps(r, half)),
+            _mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(g, half)), 8), _mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(b, half)), 16)));
+        store12((uint8_t *)&p_dst[i], _mm_shuffle_epi8(pixels, RGB8_PACK_MASK));
+    }
+    scalarHsbkToRgb8(p_params, p_src + i, p_dst + i, count - i);
+}
+
+static TARGET_SSE41 void sseHsbkToRgbf(const convert_params_t *p_params, const color_t *p_src, lifx_rgbf_t *p_dst, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 r, g, b;
+        sseHsbkToRgb(p_params, &p_src[i], &r, &g, &b);
+        storeRgbf4(&p_dst[i], r, g, b);
+    }
+    scalarHsbkToRgbf(p_params, p_src + i, p_dst + i, count - i);
+}
+
+static const convert_kernels_t sse41_kernels = {
+    .p_name = "sse4.1",
+    .p_rgb8_to_hsbk = sseRgb8ToHsbk,
+    .p_rgbf_to_hsbk = sseRgbfToHsbk,
+    .p_hsbk_to_rgb8 = sseHsbkToRgb8,
+    .p_hsbk_to_rgbf = sseHsbkToRgbf,
+};
+
+
+/* AVX2 kernel: 8 pixels per iteration, the low 128 bit lane holds pixels 0-3 & the high one pixels 4-7 */
+
+static inline TARGET_AVX2 __m256 avxCombine(__m128 lo, __m128 hi) {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+
+static inline TARGET_AVX2 __m256 avxClampUnit(__m256 channel) {
+    return _mm256_min_ps(_mm256_max_ps(channel, _mm256_setzero_ps()), _mm256_set1_ps(1));
+}
+
+static inline TARGET_AVX2 void avxRgbToHsbk(__m256 r, __m256 g, __m256 b, __m256i kelvin, color_t *p_dst) {
+    __m256 zero = _mm256_setzero_ps();
+    __m256 one = _mm256_set1_ps(1);
+    r = avxClampUnit(r);
+    g = avxClampUnit(g);
+    b = avxClampUnit(b);
+    __m256 max = _mm256_max_ps(r, _mm256_max_ps(g, b));
+    __m256 min = _mm256_min_ps(r, _mm256_min_ps(g, b));
+    __m256 delta = _mm256_sub_ps(max, min);
+    __m256 gray = _mm256_cmp_ps(delta, zero, _CMP_EQ_OQ);
+    __m256 divisor = _mm256_blendv_ps(delta, one, gray);
+
+    __m256 hue_r = _mm256_div_ps(_mm256_sub_ps(g, b), divisor);
+    hue_r = _mm256_add_ps(hue_r, _mm256_and_ps(_mm256_cmp_ps(hue_r, zero, _CMP_LT_OQ), _mm256_set1_ps(6)));
+    __m256 hue_g = _mm256_add_ps(_mm256_div_ps(_mm256_sub_ps(b, r), divisor), _mm256_set1_ps(2));
+    __m256 hue_b = _mm256_add_ps(_mm256_div_ps(_mm256_sub_ps(r, g), divisor), _mm256_set1_ps(4));
+    __m256 hue = _mm256_blendv_ps(hue_b, hue_g, _mm256_cmp_ps(max, g, _CMP_EQ_OQ));
+    hue = _mm256_blendv_ps(hue, hue_r, _mm256_cmp_ps(max, r, _CMP_EQ_OQ));
+    hue = _mm256_andnot_ps(gray, hue);
+
+    __m256 black = _mm256_cmp_ps(max, zero, _CMP_EQ_OQ);
+    __m256 saturation = _mm256_andnot_ps(black, _mm256_div_ps(delta, _mm256_blendv_ps(max, one, black)));
+
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256i hue16 = _mm256_and_si256(_mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(hue, _mm256_set1_ps(65536.0f / 6)), half)), _mm256_set1_epi32(0xFFFF));
+    __m256i saturation16 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(saturation, _mm256_set1_ps(65535)), half));
+    __m256i brightness16 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(max, _mm256_set1_ps(65535)), half));
+
+    // per lane like the SSE kernel, the low lanes end up with pixels 0, 1 & 2, 3 and the high ones with 4, 5 & 6, 7
+    __m256i hs = _mm256_packus_epi32(hue16, saturation16);
+    __m256i bk = _mm256_packus_epi32(brightness16, kelvin);
+    __m256i hb = _mm256_unpacklo_epi16(hs, bk);
+    __m256i sk = _mm256_unpackhi_epi16(hs, bk);
+    __m256i out01_45 = _mm256_unpacklo_epi16(hb, sk);
+    __m256i out23_67 = _mm256_unpackhi_epi16(hb, sk);
+    _mm256_storeu_si256((__m256i *)p_dst, _mm256_permute2x128_si256(out01_45, out23_67, 0x20));
+    _mm256_storeu_si256((__m256i *)(p_dst + 4), _mm256_permute2x128_si256(out01_45, out23_67, 0x31));
+}
+
+static inline TARGET_AVX2 __m256 avxHsbkChannel(__m256 hue, __m256 saturation, __m256 brightness, float n, float scale) {
+    __m256 six = _mm256_set1_ps(6);
+    __m256 k = _mm256_add_ps(hue, _mm256_set1_ps(n));
+    k = _mm256_sub_ps(k, _mm256_and_ps(_mm256_cmp_ps(k, six, _CMP_GE_OQ), six));
+    __m256 f = _mm256_max_ps(_mm256_min_ps(_mm256_min_ps(k, _mm256_sub_ps(_mm256_set1_ps(4), k)), _mm256_set1_ps(1)), _mm256_setzero_ps());
+    return _mm256_mul_ps(_mm256_mul_ps(brightness, _mm256_sub_ps(_mm256_set1_ps(1), _mm256_mul_ps(saturation, f))), _mm256_set1_ps(scale));
+}
+
+static inline TARGET_AVX2 void avxHsbkToRgb(const convert_params_t *p_params, const color_t *p_src, __m256 *p_r, __m256 *p_g, __m256 *p_b) {
+    __m256i in0 = _mm256_loadu_si256((const __m256i *)p_src);
+    __m256i in1 = _mm256_loadu_si256((const __m256i *)(p_src + 4));
+    // pixels 0, 1, 4, 5 & 2, 3, 6, 7, so that the per lane unpacking yields pixels 0-3 & 4-7
+    __m256i x = _mm256_permute2x128_si256(in0, in1, 0x20);
+    __m256i y = _mm256_permute2x128_si256(in0, in1, 0x31);
+    __m256i lo = _mm256_unpacklo_epi16(x, y);
+    __m256i hi = _mm256_unpackhi_epi16(x, y);
+    __m256i hs = _mm256_unpacklo_epi16(lo, hi);
+    __m256i bk = _mm256_unpackhi_epi16(lo, hi);
+    __m256i zero = _mm256_setzero_si256();
+    __m256 hue = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_unpacklo_epi16(hs, zero)), _mm256_set1_ps(6.0f / 65536));
+    __m256 saturation = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_unpackhi_epi16(hs, zero)), _mm256_set1_ps(1.0f / 65535));
+    __m256 brightness = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_unpacklo_epi16(bk, zero)), _mm256_set1_ps(1.0f / 65535));
+    *p_r = avxHsbkChannel(hue, saturation, brightness, 5, p_params->scale_r);
+    *p_g = avxHsbkChannel(hue, saturation, brightness, 3, p_params->scale_g);
+    *p_b = avxHsbkChannel(hue, saturation, brightness, 1, p_params->scale_b);
+}
+
+static inline TARGET_AVX2 __m256 avxRgb8Channel(__m256i pixels, __m128i mask, float gain) {
+    __m256i channel = _mm256_shuffle_epi8(pixels, _mm256_broadcastsi128_si256(mask));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(channel), _mm256_set1_ps(gain));
+}
+
+static TARGET_AVX2 void avxRgb8ToHsbk(const convert_params_t *p_params, const lifx_rgb8_t *p_src, color_t *p_dst, size_t count) {
+    __m256i kelvin = _mm256_set1_epi32(p_params->kelvin);
+    size_t i = 0;
+    // the 16 byte load of pixels 4-7 reads 4 bytes of the next pixels, which have to exist
+    for (; i + 10 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)&p_src[i]);
+        __m128i hi = _mm_loadu_si128((const __m128i *)&p_src[i + 4]);
+        __m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        avxRgbToHsbk(avxRgb8Channel(pixels, RGB8_CHANNEL_MASK(0), p_params->gain_r),
+            avxRgb8Channel(pixels, RGB8_CHANNEL_MASK(1), p_params->gain_g),
+            avxRgb8Channel(pixels, RGB8_CHANNEL_MASK(2), p_params->gain_b), kelvin, &p_dst[i]);
+    }
+    sseRgb8ToHsbk(p_params, p_src + i, p_dst + i, count - i);
+}
+
+static TARGET_AVX2 void avxRgbfToHsbk(const convert_params_t *p_params, const lifx_rgbf_t *p_src, color_t *p_dst, size_t count) {
+    __m256i kelvin = _mm256_set1_epi32(p_params->kelvin);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        loadRgbf4(&p_src[i], &r_lo, &g_lo, &b_lo);
+        loadRgbf4(&p_src[i + 4], &r_hi, &g_hi, &b_hi);
+        avxRgbToHsbk(_mm256_mul_ps(avxCombine(r_lo, r_hi), _mm256_set1_ps(p_params->gain_r)),
+            _mm256_mul_ps(avxCombine(g_lo, g_hi), _mm256_set1_ps(p_params->gain_g)),
+            _mm256_mul_ps(avxCombine(b_lo, b_hi), _mm256_set1_ps(p_params->gain_b)), kelvin, &p_dst[i]);
+    }
+    sseRgbfToHsbk(p_params, p_src + i, p_dst + i, count - i);
+}
+
+static TARGET_AVX2 void avxHsbkToRgb8(const convert_params_t *p_params, const color_t *p_src, lifx_rgb8_t *p_dst, size_t count) {
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256i pack_mask = _mm256_broadcastsi128_si256(RGB8_PACK_MASK);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 r, g, b;
+        avxHsbkToRgb(p_params, &p_src[i], &r, &g, &b);
+        __m256i pixels = _mm256_or_si256(_mm256_cvttps_epi32(_mm256_add_ps(r, half)),
+            _mm256_or_si256(_mm256_slli_epi32(_mm256_cvttps_epi32(_mm256_add_ps(g, half)), 8), _mm256_slli_epi32(_mm256_cvttps_epi32(_mm256_add_ps(b, half)), 16)));
+        pixels = _mm256_shuffle_epi8(pixels, pack_mask);
+        store12((uint8_t *)&p_dst[i], _mm256_castsi256_si128(pixels));
+        store12((uint8_t *)&p_dst[i + 4], _mm256_extracti128_si256(pixels, 1));
+    }
+    sseHsbkToRgb8(p_params, p_src + i, p_dst + i, count - i);
+}
+
+static TARGET_AVX2 void avxHsbkToRgbf(const convert_params_t *p_params, const color_t *p_src, lifx_rgbf_t *p_dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 r, g, b;
+        avxHsbkToRgb(p_params, &p_src[i], &r, &g, &b);
+        storeRgbf4(&p_dst[i], _mm256_castps256_ps128(r), _mm256_castps256_ps128(g), _mm256_castps256_ps128(b));
+        storeRgbf4(&p_dst[i + 4], _mm256_extractf128_ps(r, 1), _mm256_extractf128_ps(g, 1), _mm256_extractf128_ps(b, 1));
+    }
+    sseHsbkToRgbf(p_params, p_src + i, p_dst + i, count - i);
+}
+
+static const convert_kernels_t avx2_kernels = {
+    .p_name = "avx2",
+    .p_rgb8_to_hsbk = avxRgb8ToHsbk,
+    .p_rgbf_to_hsbk = avxRgbfToHsbk,
+    .p_hsbk_to_rgb8 = avxHsbkToRgb8,
+    .p_hsbk_to_rgbf = avxHsbkToRgbf,
+};
+
+#endif
+
+
+/** kernel in use, picked on first use */
+static const convert_kernels_t *p_kernels = NULL;
+
+static bool supports(const convert_kernels_t *p_candidate) {
+    #ifdef CONVERT_X86
+    __builtin_cpu_init();
+    if (p_candidate == &avx2_kernels) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (p_candidate == &sse41_kernels) {
+        return __builtin_cpu_supports("sse4.1");
+    }
+    #endif
+    return p_candidate == &scalar_kernels;
+}
+
+static const convert_kernels_t *kernels(void) {
+    // several threads may race to pick the kernel, they all pick the same one
+    const convert_kernels_t *p_current = __atomic_load_n(&p_kernels, __ATOMIC_RELAXED);
+    if (p_current != NULL) {
+        return p_current;
+    }
+    p_current = &scalar_kernels;
+    #ifdef CONVERT_X86
+    if (supports(&avx2_kernels)) {
+        p_current = &avx2_kernels;
+    } else if (supports(&sse41_kernels)) {
+        p_current = &sse41_kernels;
+    }
+    #endif
+    __atomic_store_n(&p_kernels, p_current, __ATOMIC_RELAXED);
+    return p_current;
+}
+
+const char *lifx_convert_kernel(void) {
+    return kernels()->p_name;
+}
+
+int lifx_convert_select(const char *p_name) {
+    const convert_kernels_t *p_candidates[] = {
+        #ifdef CONVERT_X86
+        &avx2_kernels,
+        &sse41_kernels,
+        #endif
+        &scalar_kernels,
+    };
+    for (size_t i = 0; i < sizeof(p_candidates) / sizeof(p_candidates[0]); i++) {
+        if (strcmp(p_candidates[i]->p_name, p_name) == 0 && supports(p_candidates[i])) {
+            __atomic_store_n(&p_kernels, p_candidates[i], __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void lifx_rgb8_to_hsbk(const lifx_convert_t *p_convert, const lifx_rgb8_t *p_src, color_t *p_dst, size_t count) {
+    convert_params_t params = paramsFor(p_convert, 255);
+    kernels()->p_rgb8_to_hsbk(&params, p_src, p_dst, count);
+}
+
+void lifx_rgbf_to_hsbk(const lifx_convert_t *p_convert, const lifx_rgbf_t *p_src, color_t *p_dst, size_t count) {
+    convert_params_t params = paramsFor(p_convert, 1);
+    kernels()->p_rgbf_to_hsbk(&params, p_src, p_dst, count);
+}
+
+void lifx_hsbk_to_rgb8(const lifx_convert_t *p_convert, const color_t *p_src, lifx_rgb8_t *p_dst, size_t count) {
+    convert_params_t params = paramsFor(p_convert, 255);
+    kernels()->p_hsbk_to_rgb8(&params, p_src, p_dst, count);
+}
+
+void lifx_hsbk_to_rgbf(const lifx_convert_t *p_convert, const color_t *p_src, lifx_rgbf_t *p_dst, size_t count) {
+    convert_params_t params = paramsFor(p_convert, 1);
+    kernels()->p_hsbk_to_rgbf(&params, p_src, p_dst, count);
+}
@@ -0,0 +1,67 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+
+/** 8 bit RGB pixel, laid out like packed RGB frames */
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} lifx_rgb8_t;
+
+/** floating point RGB pixel, 0 - 1 */
+typedef struct {
+    float r;
+    float g;
+    float b;
+} lifx_rgbf_t;
+
+/** settings of a batch conversion */
+typedef struct {
+    /** color temperature assigned to colors converted from RGB, 2500° - 9000° */
+    uint16_t kelvin;
+    /**
+     * RGB value (0 - 1] of white: RGB pixels are divided by it before they are converted to HSBK,
+     * so that it becomes unsaturated, and multiplied by it after they are converted from HSBK
+     */
+    lifx_rgbf_t white;
+} lifx_convert_t;
+
+/** sets the kelvin and a neutral white point */
+void lifx_convert_init(lifx_convert_t *p_convert, uint16_t kelvin);
+
+/** @returns RGB value of a black body at the given color temperature, normalized to a maximal channel of 1 */
+lifx_rgbf_t lifx_white_point(uint16_t kelvin);
+
+/*
+ * Batch conversions between RGB & HSBK, source and destination must not overlap.
+ * The kernel is picked at runtime from AVX2, SSE4.1 & scalar according to the CPU, all produce the same results.
+ */
+void lifx_rgb8_to_hsbk(const lifx_convert_t *p_convert, const lifx_rgb8_t *p_src, color_t *p_dst, size_t count);
+
+void lifx_rgbf_to_hsbk(const lifx_convert_t *p_convert, const lifx_rgbf_t *p_src, color_t *p_dst, size_t count);
+
+/** the kelvin of the colors is ignored, the white point of `p_convert` is applied instead */
+void lifx_hsbk_to_rgb8(const lifx_convert_t *p_convert, const color_t *p_src, lifx_rgb8_t *p_dst, size_t count);
+
+void lifx_hsbk_to_rgbf(const lifx_convert_t *p_convert, const color_t *p_src, lifx_rgbf_t *p_dst, size_t count);
+
+/** @returns name of the kernel used for conversions: "avx2", "sse4.1" or "scalar" */
+const char *lifx_convert_kernel(void);
+
+/**
+ * Overrides the kernel picked according to the CPU, e.g. to compare kernels
+ * @returns -1 if the kernel is unknown or not supported by the CPU
+ */
+int lifx_convert_select(const char *p_name);
+
+#endif
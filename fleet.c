@@ -0,0 +1,196 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "batch.h"
+#include "fleet.h"
+
+
+/** initial number of bulbs the arrays have room for */
+#define FLEET_CAPACITY (64)
+
+
+static int reserve(lifx_fleet_t *p_fleet, size_t capacity) {
+    if (capacity <= p_fleet->capacity) {
+        return 0;
+    }
+    // arrays that were grown before one failed are merely larger than needed
+    uint64_t *p_targets = realloc(p_fleet->p_targets, capacity * sizeof(uint64_t));
+    if (p_targets != NULL) {
+        p_fleet->p_targets = p_targets;
+    }
+    uint32_t *p_addrs = realloc(p_fleet->p_addrs, capacity * sizeof(uint32_t));
+    if (p_addrs != NULL) {
+        p_fleet->p_addrs = p_addrs;
+    }
+    uint16_t *p_ports = realloc(p_fleet->p_ports, capacity * sizeof(uint16_t));
+    if (p_ports != NULL) {
+        p_fleet->p_ports = p_ports;
+    }
+    color_t *p_colors = realloc(p_fleet->p_colors, capacity * sizeof(color_t));
+    if (p_colors != NULL) {
+        p_fleet->p_colors = p_colors;
+    }
+    bool *p_on = realloc(p_fleet->p_on, capacity * sizeof(bool));
+    if (p_on != NULL) {
+        p_fleet->p_on = p_on;
+    }
+    uint8_t *p_status = realloc(p_fleet->p_status, capacity * sizeof(uint8_t));
+    if (p_status != NULL) {
+        p_fleet->p_status = p_status;
+    }
+    uint32_t *p_peers = realloc(p_fleet->p_peers, capacity * sizeof(uint32_t));
+    if (p_peers != NULL) {
+        p_fleet->p_peers = p_peers;
+    }
+    if (p_targets == NULL || p_addrs == NULL || p_ports == NULL || p_colors == NULL || p_on == NULL || 
+            p_status == NULL || p_peers == NULL) {
+        printf("growing fleet failed\n");
+        return -1;
+    }
+    p_fleet->capacity = capacity;
+    return 0;
+}
+
+static int checkRange(const lifx_fleet_t *p_fleet, size_t first, size_t count) {
+    if (first > p_fleet->count || count > p_fleet->count - first) {
+        printf("bulbs %zu - %zu are out of range, the fleet has %zu bulbs\n", first, first + count, p_fleet->count);
+        return -1;
+    }
+    return 0;
+}
+
+/** 
+ * submits the batch to the bulbs [first, first + count) and waits until it is completed
+ * @returns the number of bulbs that did not confirm it, -1 on error
+ */
+static int runBatch(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, size_t first, size_t count, lx_batch_t *p_batch) {
+    if (checkRange(p_fleet, first, count)) {
+        return -1;
+    }
+    p_batch->p_fleet = p_fleet;
+    p_batch->first = first;
+    p_batch->count = count;
+    lifx_op_t op;
+    memset(&op, 0, sizeof(op));
+    int res = lx_batch_submit(p_ctx, &op, p_batch);
+    if (res == 0 && lifx_wait(p_ctx, &op) && op.status == LIFX_OP_PENDING) {
+        // the context must not keep a reference to the op on the stack
+        printf("waiting for the batch failed\n");
+        lifx_cancel(p_ctx, &op);
+        res = -1;
+    }
+    int failed = 0;
+    for (size_t i = first; i < first + count; i++) {
+        // bulbs still waiting when the whole batch failed share its status
+        if (p_fleet->p_status[i] == LIFX_OP_PENDING || p_fleet->p_status[i] == LIFX_OP_IDLE) {
+            p_fleet->p_status[i] = (uint8_t)op.status;
+        }
+        failed += p_fleet->p_status[i] != LIFX_OP_DONE && p_fleet->p_status[i] != LIFX_OP_SUPPRESSED;
+    }
+    return res < 0 ? -1 : failed;
+}
+
+int lifx_fleet_init(lifx_fleet_t *p_fleet) {
+    memset(p_fleet, 0, sizeof(*p_fleet));
+    if (reserve(p_fleet, FLEET_CAPACITY)) {
+        lifx_fleet_free(p_fleet);
+        return -1;
+    }
+    if (lx_hashindex_init(&p_fleet->target_index)) {
+        lifx_fleet_free(p_fleet);
+        return -1;
+    }
+    return 0;
+}
+
+int lifx_fleet_free(lifx_fleet_t *p_fleet) {
+    free(p_fleet->p_targets);
+    free(p_fleet->p_addrs);
+    free(p_fleet->p_ports);
+    free(p_fleet->p_colors);
+    free(p_fleet->p_on);
+    free(p_fleet->p_status);
+    free(p_fleet->p_peers);
+    lx_hashindex_free(&p_fleet->target_index);
+    memset(p_fleet, 0, sizeof(*p_fleet));
+    return 0;
+}
+
+long lifx_fleet_add(lifx_fleet_t *p_fleet, const bulb_service_t *p_bulb) {
+    long index = lx_hashindex_find(&p_fleet->target_index, p_bulb->target);
+    if (index < 0) {
+        if (p_fleet->count >= p_fleet->capacity && reserve(p_fleet, p_fleet->capacity * 2)) {
+            return -1;
+        }
+        index = (long)p_fleet->count;
+        if (lx_hashindex_put(&p_fleet->target_index, p_bulb->target, (uint32_t)index)) {
+            return -1;
+        }
+        p_fleet->p_targets[index] = p_bulb->target;
+        // unknown until the bulb is refreshed
+        p_fleet->p_colors[index] = (color_t) {0};
+        p_fleet->p_on[index] = false;
+        p_fleet->p_status[index] = LIFX_OP_IDLE;
+        // resolved by the first batch
+        p_fleet->p_peers[index] = UINT32_MAX;
+        p_fleet->count++;
+    }
+    p_fleet->p_addrs[index] = (uint32_t)p_bulb->in_addr;
+    p_fleet->p_ports[index] = (uint16_t)p_bulb->port;
+    return index;
+}
+
+int lifx_fleet_add_registry(lifx_fleet_t *p_fleet, const lifx_registry_t *p_registry) {
+    if (reserve(p_fleet, p_fleet->count + p_registry->count)) {
+        return -1;
+    }
+    for (size_t i = 0; i < p_registry->count; i++) {
+        if (lifx_fleet_add(p_fleet, &p_registry->p_bulbs[i]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+long lifx_fleet_find(const lifx_fleet_t *p_fleet, uint64_t target) {
+    return lx_hashindex_find(&p_fleet->target_index, target);
+}
+
+void lifx_fleet_bulb(const lifx_fleet_t *p_fleet, size_t index, bulb_service_t *p_bulb) {
+    p_bulb->in_addr = p_fleet->p_addrs[index];
+    p_bulb->target = p_fleet->p_targets[index];
+    p_bulb->service = 1;
+    p_bulb->port = p_fleet->p_ports[index];
+}
+
+int lifx_fleet_set_colors(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, size_t first, size_t count, const color_t *p_colors, uint32_t duration) {
+    lx_batch_t batch = {
+        .type = LX_BATCH_SET_COLOR,
+        .p_colors = p_colors,
+        .duration = duration,
+    };
+    return runBatch(p_ctx, p_fleet, first, count, &batch);
+}
+
+int lifx_fleet_set_power(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, size_t first, size_t count, bool on, uint32_t duration) {
+    lx_batch_t batch = {
+        .type = LX_BATCH_SET_POWER,
+        .on = on,
+        .duration = duration,
+    };
+    return runBatch(p_ctx, p_fleet, first, count, &batch);
+}
+
+int lifx_fleet_refresh(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, size_t first, size_t count, uint32_t max_age_ms) {
+    lx_batch_t batch = {
+        .type = LX_BATCH_GET_COLOR,
+        .max_age_ms = max_age_ms,
+    };
+    return runBatch(p_ctx, p_fleet, first, count, &batch);
+}
@@ -0,0 +1,78 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "bulb.h"
+#include "color.h"
+#include "hashindex.h"
+#include "lifx.h"
+#include "registry.h"
+
+
+/**
+ * Bulbs stored as parallel arrays (structure of arrays): a batch over a range of bulbs reads addrs, targets,
+ * ports & colors front to back without padding in between. Bulbs are addressed by their index, which never changes.
+ */
+typedef struct {
+    /** `count` entries each, the arrays are reallocated (and pointers into them invalidated) when a bulb gets added */
+    uint64_t *p_targets;
+    uint32_t *p_addrs;
+    uint16_t *p_ports;
+    /** color & power last read from or confirmed by each bulb, only confirmed values are written */
+    color_t *p_colors;
+    bool *p_on;
+    /** `lifx_op_status_t` of each bulb in its last batch, e.g. to find the bulbs that did not confirm it */
+    uint8_t *p_status;
+    /** index of each bulb in the peer table of the context it was last sent to, checked before it is used */
+    uint32_t *p_peers;
+    size_t count;
+    size_t capacity;
+    lx_hashindex_t target_index;
+} lifx_fleet_t;
+
+int lifx_fleet_init(lifx_fleet_t *p_fleet);
+
+int lifx_fleet_free(lifx_fleet_t *p_fleet);
+
+/**
+ * Adds the bulb or updates the addr of the bulb with the same target
+ * @returns the index of the bulb, -1 on error
+ */
+long lifx_fleet_add(lifx_fleet_t *p_fleet, const bulb_service_t *p_bulb);
+
+/** Adds all bulbs of the registry, in the order of the registry */
+int lifx_fleet_add_registry(lifx_fleet_t *p_fleet, const lifx_registry_t *p_registry);
+
+/** @returns the index of the bulb with the given MAC addr or -1 */
+long lifx_fleet_find(const lifx_fleet_t *p_fleet, uint64_t target);
+
+/** Fills `p_bulb` with the addr of the bulb at `index`, e.g. for the single bulb functions */
+void lifx_fleet_bulb(const lifx_fleet_t *p_fleet, size_t index, bulb_service_t *p_bulb);
+
+/*
+ * Batch requests to the bulbs [first, first + count), encoded straight from the arrays & tracked by a single request.
+ * Each one returns the number of bulbs that did not confirm it, -1 on error. The bulbs that confirmed get their
+ * `p_colors` & `p_on` updated, the others keep their last confirmed values. With `LIFX_RELIABILITY_NONE`
+ * nothing is confirmed and the arrays stay unchanged.
+ */
+
+/** sets the bulbs to `p_colors`, which holds `count` colors, the first one for the bulb at `first` */
+int lifx_fleet_set_colors(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, size_t first, size_t count, const color_t *p_colors, uint32_t duration);
+
+/** turns the bulbs on or off */
+int lifx_fleet_set_power(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, size_t first, size_t count, bool on, uint32_t duration);
+
+/**
+ * reads color & power of the bulbs into `p_colors` & `p_on`
+ * @param max_age_ms cached states confirmed at most this many milliseconds ago are used without asking the bulb
+ */
+int lifx_fleet_refresh(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, size_t first, size_t count, uint32_t max_age_ms);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hashindex.h"
+
+
+/** initial number of slots, has to be a power of 2 */
+#define HASHINDEX_SLOTS (64)
+
+
+static size_t slotOf(uint64_t key, size_t slot_count) {
+    return (size_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & (slot_count - 1);
+}
+
+int lx_hashindex_init(lx_hashindex_t *p_index) {
+    p_index->p_slots = calloc(HASHINDEX_SLOTS, sizeof(lx_hashindex_slot_t));
+    if (p_index->p_slots == NULL) {
+        printf("allocating hash index failed\n");
+        return -1;
+    }
+    p_index->slot_count = HASHINDEX_SLOTS;
+    p_index->count = 0;
+    return 0;
+}
+
+int lx_hashindex_free(lx_hashindex_t *p_index) {
+    free(p_index->p_slots);
+    p_index->p_slots = NULL;
+    p_index->slot_count = 0;
+    p_index->count = 0;
+    return 0;
+}
+
+long lx_hashindex_find(const lx_hashindex_t *p_index, uint64_t key) {
+    size_t mask = p_index->slot_count - 1;
+    for (size_t i = slotOf(key, p_index->slot_count); p_index->p_slots[i].value != 0; i = (i + 1) & mask) {
+        if (p_index->p_slots[i].key == key) {
+            return (long)p_index->p_slots[i].value - 1;
+        }
+    }
+    return -1;
+}
+
+/** doubles the number of slots and reinserts all entries */
+static int grow(lx_hashindex_t *p_index) {
+    size_t slot_count = p_index->slot_count * 2;
+    lx_hashindex_slot_t *p_slots = calloc(slot_count, sizeof(lx_hashindex_slot_t));
+    if (p_slots == NULL) {
+        printf("growing hash index failed\n");
+        return -1;
+    }
+    for (size_t i = 0; i < p_index->slot_count; i++) {
+        lx_hashindex_slot_t slot = p_index->p_slots[i];
+        if (slot.value == 0) {
+            continue;
+        }
+        size_t j = slotOf(slot.key, slot_count);
+        while (p_slots[j].value != 0) {
+            j = (j + 1) & (slot_count - 1);
+        }
+        p_slots[j] = slot;
+    }
+    free(p_index->p_slots);
+    p_index->p_slots = p_slots;
+    p_index->slot_count = slot_count;
+    return 0;
+}
+
+int lx_hashindex_put(lx_hashindex_t *p_index, uint64_t key, uint32_t value) {
+    // keep the load factor below 1/2
+    if (2 * (p_index->count + 1) > p_index->slot_count && grow(p_index)) {
+        return -1;
+    }
+    size_t mask = p_index->slot_count - 1;
+    size_t i = slotOf(key, p_index->slot_count);
+    while (p_index->p_slots[i].value != 0 && p_index->p_slots[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    if (p_index->p_slots[i].value == 0) {
+        p_index->count++;
+    }
+    p_index->p_slots[i].key = key;
+    p_index->p_slots[i].value = value + 1;
+    return 0;
+}
+
+int lx_hashindex_remove(lx_hashindex_t *p_index, uint64_t key) {
+    size_t mask = p_index->slot_count - 1;
+    size_t i = slotOf(key, p_index->slot_count);
+    while (p_index->p_slots[i].value != 0 && p_index->p_slots[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    if (p_index->p_slots[i].value == 0) {
+        return 0;
+    }
+    // backward shift deletion: move following entries of the cluster into the hole
+    size_t hole = i;
+    size_t j = (i + 1) & mask;
+    while (p_index->p_slots[j].value != 0) {
+        size_t home = slotOf(p_index->p_slots[j].key, p_index->slot_count);
+        // entry at j may fill the hole if its home slot is not between hole (exclusive) and j (inclusive)
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            p_index->p_slots[hole] = p_index->p_slots[j];
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+    p_index->p_slots[hole].value = 0;
+    p_index->count--;
+    return 0;
+}
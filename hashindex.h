@@ -0,0 +1,40 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+typedef struct {
+    uint64_t key;
+    /** index + 1, 0 marks an empty slot */
+    uint32_t value;
+} lx_hashindex_slot_t;
+
+/** Open addressing hash table (linear probing) mapping 64 bit keys to indices into a pool */
+typedef struct {
+    lx_hashindex_slot_t *p_slots;
+    /** number of slots, always a power of 2 */
+    size_t slot_count;
+    size_t count;
+} lx_hashindex_t;
+
+int lx_hashindex_init(lx_hashindex_t *p_index);
+
+int lx_hashindex_free(lx_hashindex_t *p_index);
+
+/** @returns the index stored for `key` or -1 if the key is unknown */
+long lx_hashindex_find(const lx_hashindex_t *p_index, uint64_t key);
+
+/** Stores `value` for `key`, an existing entry for `key` gets overwritten */
+int lx_hashindex_put(lx_hashindex_t *p_index, uint64_t key, uint32_t value);
+
+/** Removes the entry for `key` if there is one */
+int lx_hashindex_remove(lx_hashindex_t *p_index, uint64_t key);
+
+#endif
@@ -6,6 +6,8 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -15,47 +17,59 @@
 #include <netinet/ip.h> 
 #include <assert.h>
 #include <errno.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <ifaddrs.h>
+#include <net/if.h>
 
 #include "lifx.h"
+#include "batch.h"
+#include "clock.h"
+#include "hashindex.h"
+#include "protocol.h"
 
 
 #define SOCKET_TIMEOUT_US (500000)
-/** maximal number of discoverable bulbs */
-#define BULB_LIMIT (10)
-#define BROADCAST_PORT (56700)
 #define RECEIVE_RETRIES (5)
-
-#define PROTOCOL_NUMBER (1024)
-#define ADDRESSABLE (1)
-#define ORIGIN (0)
-#define LIFX_UDP_SERVICE (1)
-
-
-#pragma pack(push, 1)
-typedef struct {
-  /* frame */
-  uint16_t size;
-  uint16_t protocol:12;
-  uint8_t  addressable:1;
-  uint8_t  tagged:1;
-  uint8_t  origin:2;
-  uint32_t source;
-  /* frame address */
-  uint8_t  target[8];
-  uint8_t  reserved[6];
-  uint8_t  res_required:1;
-  uint8_t  ack_required:1;
-  uint8_t  :6;
-  uint8_t  sequence;
-  /* protocol header */
-  //uint64_t :64;
-  uint64_t reserved1;
-  uint16_t type;
-  //uint16_t :16;
-  uint16_t reserved2;
-  /* variable length payload follows */
-} lx_protocol_header_t;
-#pragma pack(pop)
+/** default time until an unanswered request is given up, retransmissions included */
+#define REQUEST_TIMEOUT_US (RECEIVE_RETRIES * SOCKET_TIMEOUT_US)
+/** retransmission timeout of a bulb without RTT samples */
+#define INITIAL_RTO_US (SOCKET_TIMEOUT_US)
+/** bounds of the retransmission timeout, the lower one keeps a jittery but healthy bulb from being flooded */
+#define MIN_RTO_US (20000)
+#define MAX_RTO_US (1000000)
+/** time during which responses to a discovery broadcast are collected */
+#define DISCOVERY_TIMEOUT_US ((RECEIVE_RETRIES - 1) * SOCKET_TIMEOUT_US)
+/** defaults of `lifx_sweep_t` */
+#define SWEEP_PROBES_PER_MS (64)
+#define SWEEP_ROUNDS (2)
+#define SWEEP_SETTLE_US (200000)
+/** interval in which the probes of a sweep are sent, `probes_per_ms` at a time */
+#define SWEEP_INTERVAL_US (1000)
+/** initial number of buckets in the in-flight table, has to be a power of 2 */
+#define INFLIGHT_BUCKETS (64)
+/** initial capacity of the deadline heap */
+#define HEAP_CAPACITY (64)
+/** initial capacity of the queue of pending callbacks */
+#define COMPLETED_CAPACITY (64)
+/** largest packet that can be sent or received, header & SetExtendedColorZones payload fit */
+#define PACKET_BUFFER_SIZE (1024)
+/** maximal number of packets flushed with a single sendmmsg call */
+#define TX_BATCH (256)
+/** size of the buffer the queued packets are encoded into back to back */
+#define TX_BUFFER_SIZE (65536)
+/** maximal number of packets received with a single recvmmsg call */
+#define RX_BATCH (64)
+/** number of receive buffers, has to be a multiple of RX_BATCH */
+#define RX_RING_SIZE (4 * RX_BATCH)
+/** requested size of the socket receive buffer, replies of a whole fleet arrive in bursts */
+#define SOCKET_RCVBUF_SIZE (4 * 1024 * 1024)
+/** number of header templates cached per bulb, one per message type & flags combination */
+#define PEER_TEMPLATES (8)
+/** initial number of bulbs the peer table has space for */
+#define PEER_CAPACITY (16)
+/** number of throttled set requests per bulb newer requests of the same type are coalesced into */
+#define PEER_PARKED (4)
 
 typedef struct {
     uint16_t payload_size;
@@ -63,69 +77,651 @@ typedef struct {
     uint8_t tagged;
     uint8_t ack_required;
     uint8_t res_required;
+    uint8_t sequence;
     uint16_t type;
 } packet_config_t;
 
+/** pre-serialized header of one message type sent to one bulb */
+typedef struct {
+    uint8_t p_header[sizeof(lx_protocol_header_t)];
+    uint16_t type;
+    /** tagged, ack_required & res_required of the template */
+    uint8_t flags;
+} lx_header_template_t;
 
-typedef enum {
-	MSG_TYPE_GET_SERVICE = 2,
-	MSG_TYPE_STATE_SERVICE,
-    MSG_TYPE_GET_LIGHT = 101,
-    MSG_TYPE_SET_COLOR,
-    MSG_TYPE_LIGHT_STATE = 107,
-    MSG_TYPE_GET_POWER = 116,
-    MSG_TYPE_SET_POWER = 117,
-    MSG_TYPE_STATE_POWER,
-} lx_protocol_header_msg_type;
-
-
-/** a negative number indicates non-existance */
-static int udp_socket = -1;
-
-static uint32_t source_id = 0;
-
-static uint8_t p_buffer[512];
+/** state the library keeps per bulb it talks to */
+typedef struct {
+    uint64_t target;
+    uint8_t template_count;
+    /** template that gets replaced next when all slots are in use */
+    uint8_t next_template;
+    lx_header_template_t templates[PEER_TEMPLATES];
+    /** smoothed RTT & its mean deviation (RFC 6298), 0 until the first sample */
+    int64_t srtt_us;
+    int64_t rttvar_us;
+    /** retransmission timeout for the next request */
+    int64_t rto_us;
+    /** theoretical arrival time of the next request (GCRA), requests before it are throttled */
+    int64_t next_send_us;
+    /** throttled set requests waiting for their slot, at most one per message type */
+    lifx_op_t *pp_parked[PEER_PARKED];
+    lifx_stats_t stats;
+    lifx_bulb_state_t state;
+    /** submission time of the latest request changing power / color, older responses must not be cached */
+    int64_t power_written_us;
+    int64_t color_written_us;
+} lx_peer_t;
 
-int init_lifx_lib() {
-	// open socket
-	udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+/** 
+ * read-only view of a received packet, pointing into the receive ring.
+ * It stays valid until `RX_RING_SIZE - RX_BATCH` further packets have been received.
+ */
+typedef struct {
+    const lx_protocol_header_t *p_header;
+    const uint8_t *p_payload;
+    uint16_t payload_size;
+    const struct sockaddr_in *p_server_addr;
+    /** bulb the packet came from, NULL if the library never sent a packet to it */
+    lx_peer_t *p_peer;
+    /** time the batch containing the packet was received */
+    int64_t received_us;
+} lx_packet_view_t;
+
+/** kinds of in-flight requests */
+typedef enum {
+    /** request to a single bulb completing with its first response */
+    OP_KIND_UNICAST = 0,
+    /** tagged broadcast collecting responses of all bulbs until its deadline */
+    OP_KIND_DISCOVERY,
+    /** request without response, done as soon as its packet is queued */
+    OP_KIND_FORGET,
+    /** tagged set request collecting the acknowledgements of all bulbs, see `lifx_broadcast_t` */
+    OP_KIND_BROADCAST,
+    /** discovery sending paced probes to ranges of addrs from its deadline, see `lifx_sweep_t` */
+    OP_KIND_SWEEP,
+    /** request to a range of bulbs of a fleet collecting the responses of all of them, see `lx_batch_t` */
+    OP_KIND_BATCH,
+} lx_op_kind;
+
+
+
+struct lifx_ctx {
+    /** a negative number indicates non-existance */
+    int udp_socket;
+    /** watches `udp_socket` and `timer_fd` */
+    int epoll_fd;
+    /** whether `epoll_fd` also watches `udp_socket` for writability, which it does while the send queue is stuck */
+    bool watch_writable;
+    /** expires at the earliest deadline of all requests in flight */
+    int timer_fd;
+
+    uint32_t source_id;
+
+    /** packets queued for the next sendmmsg call, encoded back to back into `p_tx_buffer` */
+    uint8_t p_tx_buffer[TX_BUFFER_SIZE];
+    size_t tx_offset;
+    unsigned int tx_count;
+    /** packets at the front of the queue the socket took already, the rest waits until it is writable again */
+    unsigned int tx_sent;
+    struct mmsghdr tx_msgs[TX_BATCH];
+    struct iovec tx_iovecs[TX_BATCH];
+    struct sockaddr_in tx_addrs[TX_BATCH];
+    /** 
+     * request each queued packet belongs to, failed if its packet cannot be sent.
+     * NULL for packets without a response & for requests completed while their packet was queued, which might be gone.
+     */
+    lifx_op_t *tx_ops[TX_BATCH];
+    /** peer table index of the destination of each queued packet */
+    uint32_t tx_peers[TX_BATCH];
+
+    /** 
+     * ring of receive buffers, each recvmmsg call fills the next RX_BATCH of them. 
+     * Decoders get views into these buffers, nothing is copied or allocated per packet.
+     */
+    uint8_t rx_ring[RX_RING_SIZE][PACKET_BUFFER_SIZE];
+    struct mmsghdr rx_msgs[RX_RING_SIZE];
+    struct iovec rx_iovecs[RX_RING_SIZE];
+    struct sockaddr_in rx_addrs[RX_RING_SIZE];
+    /** first slot of the next recvmmsg call */
+    size_t rx_head;
+
+    /** per bulb state in a contiguous pool, indexed by target */
+    lx_peer_t *p_peers;
+    size_t peer_count;
+    size_t peer_capacity;
+    lx_hashindex_t peer_index;
+
+    /** sequence number used for the next request */
+    uint8_t next_sequence;
+
+    /** reliability of set requests that do not specify one */
+    lifx_reliability_t reliability;
+    /** minimal time between two requests to the same bulb & number of requests that may be sent at once, 0 if unlimited */
+    int64_t send_interval_us;
+    int64_t send_burst_us;
+    /** maximal age of the cached state that set requests are compared against, 0 if they are always sent */
+    int64_t suppress_age_us;
+
+    /** where discovery broadcasts are sent to */
+    unsigned long broadcast_addr;
+    uint32_t broadcast_port;
+
+    /** 
+     * in-flight table: hash table with separate chaining keyed by (target, sequence), 
+     * the source is the same for all requests of this context
+     */
+    lifx_op_t **pp_inflight;
+    size_t inflight_buckets;
+    size_t inflight_count;
+    /** number of requests in the in-flight table per sequence number */
+    uint32_t sequence_use[UINT8_MAX + 1];
+    /** 
+     * requests to all bulbs (target 0) in flight by sequence number. Their responses carry the target of the 
+     * responding bulb, so they are kept apart from the in-flight table and no other request gets their sequence
+     */
+    lifx_op_t *pp_tagged[UINT8_MAX + 1];
+
+    /** binary min-heap of the requests in flight ordered by their deadline */
+    lifx_op_t **pp_heap;
+    size_t heap_count;
+    size_t heap_capacity;
+    /** deadline the timer is currently armed for, a negative number if it is disarmed */
+    int64_t armed_deadline_us;
+
+    /** 
+     * completed ops whose callback has not been called yet in the order they were completed, 
+     * the callbacks of [completed_head, completed_count) are pending
+     */
+    lifx_op_t **pp_completed;
+    size_t completed_head;
+    size_t completed_count;
+    size_t completed_capacity;
+
+    /** counters of all bulbs, the per bulb counters live in the peer table */
+    lifx_stats_t stats;
+};
+
+int init_lifx_lib(lifx_ctx_t **pp_ctx) {
+	// open non-blocking socket, waiting is done with epoll
+	int udp_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
 	if (udp_socket < 0) {
 		printf("opening socket failed\n");
 		return -1;
 	}
+    return lifx_init_with_socket(pp_ctx, udp_socket);
+}
+
+int lifx_init_with_socket(lifx_ctx_t **pp_ctx, int udp_socket) {
+    lifx_ctx_t *p_ctx = calloc(1, sizeof(lifx_ctx_t));
+    if (p_ctx == NULL) {
+        printf("allocating context failed\n");
+        close(udp_socket);
+        return -1;
+    }
+    p_ctx->udp_socket = udp_socket;
+    p_ctx->epoll_fd = -1;
+    p_ctx->timer_fd = -1;
+    p_ctx->armed_deadline_us = -1;
+    p_ctx->broadcast_addr = INADDR_BROADCAST;
+    p_ctx->broadcast_port = BROADCAST_PORT;
+    p_ctx->reliability = LIFX_RELIABILITY_RESPONSE;
+    *pp_ctx = p_ctx;
+
 	// set broadcast permission:
 	const int broadcastEnable = 1;
-	if (setsockopt(udp_socket, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable))) {
+	if (setsockopt(p_ctx->udp_socket, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable))) {
 		printf("aquiring broadcast permission failed\n");
+        close_lifx_lib(p_ctx);
 		return -1;
 	}
-    // set socket timeout
-    struct timeval read_timeout;
-    read_timeout.tv_sec = 0;
-    read_timeout.tv_usec = SOCKET_TIMEOUT_US;
-    if (setsockopt(udp_socket, SOL_SOCKET, SO_RCVTIMEO, &read_timeout, sizeof read_timeout)) {
-        printf("enabling socket timeout failed\n");
+    // large receive buffer, the forced variant exceeds rmem_max but requires CAP_NET_ADMIN
+    const int rcvbuf_size = SOCKET_RCVBUF_SIZE;
+    if (setsockopt(p_ctx->udp_socket, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf_size, sizeof(rcvbuf_size)) &&
+        setsockopt(p_ctx->udp_socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf_size, sizeof(rcvbuf_size))) {
+        printf("enlarging receive buffer failed\n");
+    }
+    // timer for request deadlines
+    p_ctx->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (p_ctx->timer_fd < 0) {
+        printf("creating deadline timer failed\n");
+        close_lifx_lib(p_ctx);
+        return -1;
+    }
+    p_ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (p_ctx->epoll_fd < 0) {
+        printf("creating epoll instance failed\n");
+        close_lifx_lib(p_ctx);
+        return -1;
+    }
+    struct epoll_event event = { .events = EPOLLIN };
+    event.data.fd = p_ctx->udp_socket;
+    if (epoll_ctl(p_ctx->epoll_fd, EPOLL_CTL_ADD, p_ctx->udp_socket, &event)) {
+        printf("watching socket failed\n");
+        close_lifx_lib(p_ctx);
+        return -1;
+    }
+    event.data.fd = p_ctx->timer_fd;
+    if (epoll_ctl(p_ctx->epoll_fd, EPOLL_CTL_ADD, p_ctx->timer_fd, &event)) {
+        printf("watching deadline timer failed\n");
+        close_lifx_lib(p_ctx);
+        return -1;
+    }
+
+    // point the message headers at their buffers once
+    for (size_t i = 0; i < RX_RING_SIZE; i++) {
+        p_ctx->rx_iovecs[i] = (struct iovec) {
+            .iov_base = p_ctx->rx_ring[i],
+            .iov_len = PACKET_BUFFER_SIZE,
+        };
+        p_ctx->rx_msgs[i].msg_hdr.msg_name = &p_ctx->rx_addrs[i];
+        p_ctx->rx_msgs[i].msg_hdr.msg_iov = &p_ctx->rx_iovecs[i];
+        p_ctx->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (lx_hashindex_init(&p_ctx->peer_index)) {
+        close_lifx_lib(p_ctx);
         return -1;
     }
 
-	// generate random source_id:
-	time_t t;
-	// init random number generator:
-   	srand((unsigned) time(&t));
-   	source_id = (uint32_t)rand();
+	// generate a random, non-zero source id without touching the global state of rand()
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t seed = ((uint64_t)ts.tv_sec << 30) ^ (uint64_t)ts.tv_nsec ^ (uint64_t)(uintptr_t)p_ctx;
+    seed *= UINT64_C(0x9E3779B97F4A7C15);
+    p_ctx->source_id = (uint32_t)(seed >> 32);
+    if (p_ctx->source_id == 0) {
+        p_ctx->source_id = 1;
+    }
 
 	return 0;
 }
 
-int close_lifx_lib() {
-	if (udp_socket >= 0) {
-		close(udp_socket);
+int close_lifx_lib(lifx_ctx_t *p_ctx) {
+    if (p_ctx == NULL) {
+        return 0;
+    }
+	if (p_ctx->udp_socket >= 0) {
+		close(p_ctx->udp_socket);
 	}
-	udp_socket = -1;
+    if (p_ctx->timer_fd >= 0) {
+        close(p_ctx->timer_fd);
+    }
+    if (p_ctx->epoll_fd >= 0) {
+        close(p_ctx->epoll_fd);
+    }
+    free(p_ctx->pp_heap);
+    free(p_ctx->pp_completed);
+    free(p_ctx->pp_inflight);
+    free(p_ctx->p_peers);
+    lx_hashindex_free(&p_ctx->peer_index);
+    free(p_ctx);
 	return 0;
 }
 
-static int createHeader(bulb_service_t *p_bulb, const packet_config_t *p_config, lx_protocol_header_t *p_header) {
+/** counters have a single writer, the thread driving the context, so a relaxed load & store suffices */
+static void statAdd(uint64_t *p_counter, uint64_t n) {
+    __atomic_store_n(p_counter, __atomic_load_n(p_counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/** adds `n` to a counter of the context and, if known, of the bulb */
+#define COUNT(p_ctx, p_peer, counter, n) do { \
+        statAdd(&(p_ctx)->stats.counter, (n)); \
+        if ((p_peer) != NULL) { \
+            statAdd(&(p_peer)->stats.counter, (n)); \
+        } \
+    } while (0)
+
+static void countRtt(lifx_ctx_t *p_ctx, lx_peer_t *p_peer, int64_t rtt_us) {
+    uint64_t rtt = rtt_us > 0 ? (uint64_t)rtt_us : 0;
+    size_t bucket = rtt > 1 ? 63 - (size_t)__builtin_clzll(rtt) : 0;
+    if (bucket >= LIFX_RTT_BUCKETS) {
+        bucket = LIFX_RTT_BUCKETS - 1;
+    }
+    COUNT(p_ctx, p_peer, rtt_count, 1);
+    COUNT(p_ctx, p_peer, rtt_sum_us, rtt);
+    COUNT(p_ctx, p_peer, rtt_histogram[bucket], 1);
+}
+
+static void copyStats(const lifx_stats_t *p_src, lifx_stats_t *p_dst) {
+    // all counters are uint64_t, copy them one by one so none of them is torn
+    const uint64_t *p_from = (const uint64_t *)p_src;
+    uint64_t *p_to = (uint64_t *)p_dst;
+    for (size_t i = 0; i < sizeof(lifx_stats_t) / sizeof(uint64_t); i++) {
+        p_to[i] = __atomic_load_n(&p_from[i], __ATOMIC_RELAXED);
+    }
+}
+
+static size_t inflightBucket(uint64_t target, uint8_t sequence, size_t buckets) {
+    uint64_t hash = (target ^ sequence) * UINT64_C(0x9E3779B97F4A7C15);
+    return (size_t)(hash >> 32) & (buckets - 1);
+}
+
+static lifx_op_t *findInflight(lifx_ctx_t *p_ctx, uint64_t target, uint8_t sequence) {
+    if (p_ctx->inflight_buckets == 0) {
+        return NULL;
+    }
+    lifx_op_t *p_op = p_ctx->pp_inflight[inflightBucket(target, sequence, p_ctx->inflight_buckets)];
+    while (p_op != NULL && (p_op->target != target || p_op->sequence != sequence)) {
+        p_op = p_op->p_next;
+    }
+    return p_op;
+}
+
+/** doubles the number of buckets (or allocates the initial ones) and rehashes all requests */
+static int growInflight(lifx_ctx_t *p_ctx) {
+    size_t buckets = p_ctx->inflight_buckets == 0 ? INFLIGHT_BUCKETS : p_ctx->inflight_buckets * 2;
+    lifx_op_t **pp_table = calloc(buckets, sizeof(lifx_op_t *));
+    if (pp_table == NULL) {
+        printf("allocating in-flight table failed\n");
+        return -1;
+    }
+    for (size_t i = 0; i < p_ctx->inflight_buckets; i++) {
+        lifx_op_t *p_op = p_ctx->pp_inflight[i];
+        while (p_op != NULL) {
+            lifx_op_t *p_next = p_op->p_next;
+            size_t bucket = inflightBucket(p_op->target, p_op->sequence, buckets);
+            p_op->p_next = pp_table[bucket];
+            pp_table[bucket] = p_op;
+            p_op = p_next;
+        }
+    }
+    free(p_ctx->pp_inflight);
+    p_ctx->pp_inflight = pp_table;
+    p_ctx->inflight_buckets = buckets;
+    return 0;
+}
+
+/** 
+ * assigns a request to all bulbs a sequence number no other one uses, preferably one without requests to single
+ * bulbs in flight, whose acknowledgements could not be told apart from the ones to the broadcast
+ */
+static int insertTagged(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    int best = -1;
+    for (int i = 0; i <= UINT8_MAX; i++) {
+        uint8_t sequence = (uint8_t)(p_ctx->next_sequence + i);
+        if (p_ctx->pp_tagged[sequence] == NULL && (best < 0 || p_ctx->sequence_use[sequence] < p_ctx->sequence_use[best])) {
+            best = sequence;
+            if (p_ctx->sequence_use[sequence] == 0) {
+                break;
+            }
+        }
+    }
+    if (best < 0) {
+        printf("too many broadcasts in flight\n");
+        return -1;
+    }
+    p_op->sequence = (uint8_t)best;
+    p_op->p_next = NULL;
+    p_ctx->pp_tagged[best] = p_op;
+    p_ctx->next_sequence = (uint8_t)(best + 1);
+    return 0;
+}
+
+/** assigns a sequence number that is not in use for the op's target and tracks the op */
+static int insertInflight(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    if (p_op->target == 0) {
+        return insertTagged(p_ctx, p_op);
+    }
+    if (p_ctx->inflight_count >= p_ctx->inflight_buckets && growInflight(p_ctx)) {
+        return -1;
+    }
+    // the sequence number is only 8 bits wide, skip numbers still in use for this target or by a broadcast
+    int attempts = 0;
+    while (findInflight(p_ctx, p_op->target, p_ctx->next_sequence) != NULL || p_ctx->pp_tagged[p_ctx->next_sequence] != NULL) {
+        p_ctx->next_sequence++;
+        if (++attempts > UINT8_MAX) {
+            printf("too many requests in flight for target %" PRIu64 "\n", p_op->target);
+            return -1;
+        }
+    }
+    p_op->sequence = p_ctx->next_sequence++;
+    size_t bucket = inflightBucket(p_op->target, p_op->sequence, p_ctx->inflight_buckets);
+    p_op->p_next = p_ctx->pp_inflight[bucket];
+    p_ctx->pp_inflight[bucket] = p_op;
+    p_ctx->inflight_count++;
+    p_ctx->sequence_use[p_op->sequence]++;
+    return 0;
+}
+
+static void removeInflight(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    if (p_op->target == 0) {
+        if (p_ctx->pp_tagged[p_op->sequence] == p_op) {
+            p_ctx->pp_tagged[p_op->sequence] = NULL;
+        }
+        return;
+    }
+    lifx_op_t **pp_link = &p_ctx->pp_inflight[inflightBucket(p_op->target, p_op->sequence, p_ctx->inflight_buckets)];
+    while (*pp_link != NULL) {
+        if (*pp_link == p_op) {
+            *pp_link = p_op->p_next;
+            p_op->p_next = NULL;
+            p_ctx->inflight_count--;
+            p_ctx->sequence_use[p_op->sequence]--;
+            return;
+        }
+        pp_link = &(*pp_link)->p_next;
+    }
+}
+
+static void heapSwap(lifx_ctx_t *p_ctx, size_t a, size_t b) {
+    lifx_op_t *p_tmp = p_ctx->pp_heap[a];
+    p_ctx->pp_heap[a] = p_ctx->pp_heap[b];
+    p_ctx->pp_heap[b] = p_tmp;
+    p_ctx->pp_heap[a]->heap_index = a;
+    p_ctx->pp_heap[b]->heap_index = b;
+}
+
+static void heapSiftUp(lifx_ctx_t *p_ctx, size_t index) {
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (p_ctx->pp_heap[parent]->deadline_us <= p_ctx->pp_heap[index]->deadline_us) {
+            break;
+        }
+        heapSwap(p_ctx, parent, index);
+        index = parent;
+    }
+}
+
+static void heapSiftDown(lifx_ctx_t *p_ctx, size_t index) {
+    while (true) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        size_t right = left + 1;
+        if (left < p_ctx->heap_count && p_ctx->pp_heap[left]->deadline_us < p_ctx->pp_heap[smallest]->deadline_us) {
+            smallest = left;
+        }
+        if (right < p_ctx->heap_count && p_ctx->pp_heap[right]->deadline_us < p_ctx->pp_heap[smallest]->deadline_us) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        heapSwap(p_ctx, smallest, index);
+        index = smallest;
+    }
+}
+
+static int heapInsert(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    if (p_ctx->heap_count >= p_ctx->heap_capacity) {
+        size_t capacity = p_ctx->heap_capacity == 0 ? HEAP_CAPACITY : p_ctx->heap_capacity * 2;
+        lifx_op_t **pp_new_heap = realloc(p_ctx->pp_heap, capacity * sizeof(lifx_op_t *));
+        if (pp_new_heap == NULL) {
+            printf("allocating deadline heap failed\n");
+            return -1;
+        }
+        p_ctx->pp_heap = pp_new_heap;
+        p_ctx->heap_capacity = capacity;
+    }
+    p_op->heap_index = p_ctx->heap_count;
+    p_ctx->pp_heap[p_ctx->heap_count] = p_op;
+    p_ctx->heap_count++;
+    heapSiftUp(p_ctx, p_op->heap_index);
+    return 0;
+}
+
+static void heapRemove(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    size_t index = p_op->heap_index;
+    p_ctx->heap_count--;
+    if (index != p_ctx->heap_count) {
+        heapSwap(p_ctx, index, p_ctx->heap_count);
+        heapSiftDown(p_ctx, index);
+        heapSiftUp(p_ctx, index);
+    }
+}
+
+/** arms the timer for the earliest deadline or disarms it if nothing is in flight */
+static int armTimer(lifx_ctx_t *p_ctx) {
+    int64_t deadline_us = p_ctx->heap_count > 0 ? p_ctx->pp_heap[0]->deadline_us : -1;
+    if (deadline_us == p_ctx->armed_deadline_us) {
+        return 0;
+    }
+    struct itimerspec spec;
+    bzero(&spec, sizeof(spec));
+    if (deadline_us >= 0) {
+        spec.it_value.tv_sec = deadline_us / 1000000;
+        spec.it_value.tv_nsec = (deadline_us % 1000000) * 1000;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            // a zero value would disarm the timer
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+    if (timerfd_settime(p_ctx->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL)) {
+        printf("arming deadline timer failed (err %d (%s))\n", errno, strerror(errno));
+        return -1;
+    }
+    p_ctx->armed_deadline_us = deadline_us;
+    return 0;
+}
+
+/** removes a throttled op from the requests of its bulb waiting for a slot */
+static void unparkOp(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    lx_peer_t *p_peer = &p_ctx->p_peers[p_op->peer_index];
+    for (size_t i = 0; i < PEER_PARKED; i++) {
+        if (p_peer->pp_parked[i] == p_op) {
+            p_peer->pp_parked[i] = NULL;
+        }
+    }
+    p_op->parked = false;
+}
+
+/** payload of the request, stored inline or, if it is too large, allocated */
+static uint8_t *opPayload(lifx_op_t *p_op) {
+    return p_op->p_heap_payload != NULL ? p_op->p_heap_payload : p_op->p_payload;
+}
+
+/** appends the op to the ops whose callback `lifx_run_once` calls */
+static void queueCallback(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    if (p_ctx->completed_count >= p_ctx->completed_capacity) {
+        size_t capacity = p_ctx->completed_capacity == 0 ? COMPLETED_CAPACITY : p_ctx->completed_capacity * 2;
+        lifx_op_t **pp_new_completed = realloc(p_ctx->pp_completed, capacity * sizeof(lifx_op_t *));
+        if (pp_new_completed == NULL) {
+            printf("allocating callback queue failed, the callback of the request is not called\n");
+            return;
+        }
+        p_ctx->pp_completed = pp_new_completed;
+        p_ctx->completed_capacity = capacity;
+    }
+    p_ctx->pp_completed[p_ctx->completed_count] = p_op;
+    p_ctx->completed_count++;
+}
+
+/** sets the final status of an op, the op is not referenced by the library anymore except for its pending callback */
+static void finishOp(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_op_status_t status) {
+    free(p_op->p_heap_payload);
+    p_op->p_heap_payload = NULL;
+    p_op->status = status;
+    if (p_op->p_callback != NULL) {
+        queueCallback(p_ctx, p_op);
+    }
+}
+
+/** 
+ * removes the op from the in-flight table (or the throttled requests), the deadline heap & the packets waiting
+ * in the send queue and sets its final status
+ */
+static void completeOp(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_op_status_t status) {
+    if (p_op->parked) {
+        unparkOp(p_ctx, p_op);
+    } else {
+        removeInflight(p_ctx, p_op);
+    }
+    heapRemove(p_ctx, p_op);
+    // the packets are still sent, but the op may be gone by then
+    for (unsigned int i = p_ctx->tx_sent; i < p_ctx->tx_count; i++) {
+        if (p_ctx->tx_ops[i] == p_op) {
+            p_ctx->tx_ops[i] = NULL;
+        }
+    }
+    finishOp(p_ctx, p_op, status);
+}
+
+/** writes HSBK values in the little endian wire format, on little endian hosts `color_t` already has that layout */
+static void encodeColors(uint8_t *p_dst, const color_t *p_colors, size_t count) {
+    #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    _Static_assert(sizeof(color_t) == HSBK_SIZE, "color_t has to match the HSBK wire format");
+    memcpy(p_dst, p_colors, count * HSBK_SIZE);
+    #else
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *p_hsbk = p_dst + i * HSBK_SIZE;
+        p_hsbk[0] = (p_colors[i].hue >> 0) & 0xFF;
+        p_hsbk[1] = (p_colors[i].hue >> 8) & 0xFF;
+        p_hsbk[2] = (p_colors[i].saturation >> 0) & 0xFF;
+        p_hsbk[3] = (p_colors[i].saturation >> 8) & 0xFF;
+        p_hsbk[4] = (p_colors[i].brightness >> 0) & 0xFF;
+        p_hsbk[5] = (p_colors[i].brightness >> 8) & 0xFF;
+        p_hsbk[6] = (p_colors[i].kelvin >> 0) & 0xFF;
+        p_hsbk[7] = (p_colors[i].kelvin >> 8) & 0xFF;
+    }
+    #endif
+}
+
+static void encodeSetPower(uint8_t p_payload[SET_POWER_SIZE], bool on, uint32_t duration) {
+    // put level
+    uint16_t level = on ? 65535 : 0;
+    p_payload[0] = (level >> 0) & 0xFF;
+    p_payload[1] = (level >> 8) & 0xFF;
+    // put duration
+    p_payload[2] = (duration >> 0) & 0xFF;
+    p_payload[3] = (duration >> 8) & 0xFF;
+    p_payload[4] = (duration >> 16) & 0xFF;
+    p_payload[5] = (duration >> 24) & 0xFF;
+}
+
+static void encodeSetColor(uint8_t p_payload[SET_COLOR_SIZE], color_t color, uint32_t duration) {
+    // reserved
+    p_payload[0] = 0;
+    // put color
+    p_payload[1] = (color.hue >> 0) & 0xFF;
+    p_payload[2] = (color.hue >> 8) & 0xFF;
+    p_payload[3] = (color.saturation >> 0) & 0xFF;
+    p_payload[4] = (color.saturation >> 8) & 0xFF;
+    p_payload[5] = (color.brightness >> 0) & 0xFF;
+    p_payload[6] = (color.brightness >> 8) & 0xFF;
+    p_payload[7] = (color.kelvin >> 0) & 0xFF;
+    p_payload[8] = (color.kelvin >> 8) & 0xFF;
+    // put duration
+    p_payload[9] = (duration >> 0) & 0xFF;
+    p_payload[10] = (duration >> 8) & 0xFF;
+    p_payload[11] = (duration >> 16) & 0xFF;
+    p_payload[12] = (duration >> 24) & 0xFF;
+}
+
+/** reads HSBK values in the little endian wire format */
+static void decodeColors(color_t *p_colors, const uint8_t *p_src, size_t count) {
+    #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(p_colors, p_src, count * HSBK_SIZE);
+    #else
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *p_hsbk = p_src + i * HSBK_SIZE;
+        p_colors[i].hue = ((uint16_t)p_hsbk[0] << 0) + ((uint16_t)p_hsbk[1] << 8);
+        p_colors[i].saturation = ((uint16_t)p_hsbk[2] << 0) + ((uint16_t)p_hsbk[3] << 8);
+        p_colors[i].brightness = ((uint16_t)p_hsbk[4] << 0) + ((uint16_t)p_hsbk[5] << 8);
+        p_colors[i].kelvin = ((uint16_t)p_hsbk[6] << 0) + ((uint16_t)p_hsbk[7] << 8);
+    }
+    #endif
+}
+
+static int createHeader(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, const packet_config_t *p_config, lx_protocol_header_t *p_header) {
     bzero(p_header, sizeof(lx_protocol_header_t));
 
 	*p_header = (lx_protocol_header_t) {
@@ -135,7 +731,7 @@ static int createHeader(bulb_service_t *p_bulb, const packet_config_t *p_config,
     	.addressable = ADDRESSABLE,
     	.tagged = p_config->tagged,
     	.origin = ORIGIN,
-    	.source = source_id,
+    	.source = p_ctx->source_id,
     	// frame address
     	.target[0] = (uint8_t)((p_bulb->target >> 0) & 0xFF),
     	.target[1] = (uint8_t)((p_bulb->target >> 8) & 0xFF),
@@ -147,6 +743,7 @@ static int createHeader(bulb_service_t *p_bulb, const packet_config_t *p_config,
     	.target[7] = (uint8_t)((p_bulb->target >> 56) & 0xFF),
         .ack_required = p_config->ack_required,
         .res_required = p_config->res_required,
+        .sequence = p_config->sequence,
 		// all set to 0
 		// protocol header
 		.type = p_config->type,
@@ -157,176 +754,335 @@ static int createHeader(bulb_service_t *p_bulb, const packet_config_t *p_config,
     return 0;
 }
 
-static int getServerAddr(bulb_service_t *p_bulb, struct sockaddr_in *p_server_addr) {
+static int getServerAddr(unsigned long in_addr, uint32_t port, struct sockaddr_in *p_server_addr) {
 	bzero(p_server_addr, sizeof(*p_server_addr));
 	p_server_addr->sin_family = AF_INET;
-    p_server_addr->sin_port = htons(p_bulb->port);
-    p_server_addr->sin_addr.s_addr = htonl(p_bulb->in_addr);
+    p_server_addr->sin_port = htons(port);
+    p_server_addr->sin_addr.s_addr = htonl(in_addr);
     return 0;
 }
 
-static int sendPacket(bulb_service_t *p_bulb, const packet_config_t *p_config) {
-	if (udp_socket < 0) {
-		printf("discoverBulbs - socket not open");
-		return -1;
-	}
+/** @returns the bulb's entry in the peer table, which gets created if necessary */
+static lx_peer_t *peerFor(lifx_ctx_t *p_ctx, uint64_t target) {
+    long index = lx_hashindex_find(&p_ctx->peer_index, target);
+    if (index >= 0) {
+        return &p_ctx->p_peers[index];
+    }
+    if (p_ctx->peer_count >= p_ctx->peer_capacity) {
+        size_t capacity = p_ctx->peer_capacity == 0 ? PEER_CAPACITY : p_ctx->peer_capacity * 2;
+        lx_peer_t *p_new_peers = realloc(p_ctx->p_peers, capacity * sizeof(lx_peer_t));
+        if (p_new_peers == NULL) {
+            printf("growing peer table failed\n");
+            return NULL;
+        }
+        p_ctx->p_peers = p_new_peers;
+        p_ctx->peer_capacity = capacity;
+    }
+    if (lx_hashindex_put(&p_ctx->peer_index, target, (uint32_t)p_ctx->peer_count)) {
+        return NULL;
+    }
+    lx_peer_t *p_peer = &p_ctx->p_peers[p_ctx->peer_count];
+    p_ctx->peer_count++;
+    bzero(p_peer, sizeof(*p_peer));
+    p_peer->target = target;
+    p_peer->rto_us = INITIAL_RTO_US;
+    return p_peer;
+}
 
-	struct sockaddr_in server_addr;
-    if (getServerAddr(p_bulb, &server_addr)) {
-    	printf("getServerAddr failed\n");
-    	return -1;
+/** 
+ * @returns the cached header for the bulb & message type, in which only size & sequence still have to be set.
+ * The template is built on first use.
+ */
+static const lx_header_template_t *headerTemplate(lifx_ctx_t *p_ctx, lx_peer_t *p_peer, const packet_config_t *p_config) {
+    uint8_t flags = (p_config->tagged << 0) | (p_config->ack_required << 1) | (p_config->res_required << 2);
+    for (uint8_t i = 0; i < p_peer->template_count; i++) {
+        if (p_peer->templates[i].type == p_config->type && p_peer->templates[i].flags == flags) {
+            return &p_peer->templates[i];
+        }
     }
 
+    lx_header_template_t *p_template;
+    if (p_peer->template_count < PEER_TEMPLATES) {
+        p_template = &p_peer->templates[p_peer->template_count];
+        p_peer->template_count++;
+    } else {
+        p_template = &p_peer->templates[p_peer->next_template];
+        p_peer->next_template = (p_peer->next_template + 1) % PEER_TEMPLATES;
+    }
 	lx_protocol_header_t header;
-	if (createHeader(p_bulb, p_config, &header)) {
-		printf("header creation for packet type %d failed\n", p_config->type);
+    bulb_service_t bulb = { .target = p_peer->target };
+	if (createHeader(p_ctx, &bulb, p_config, &header)) {
+		return NULL;
+	}
+    memcpy(p_template->p_header, &header, sizeof(header));
+    p_template->type = p_config->type;
+    p_template->flags = flags;
+    return p_template;
+}
+
+/** adds or removes the socket's writability to the events of `epoll_fd` */
+static void watchWritable(lifx_ctx_t *p_ctx, bool writable) {
+    if (p_ctx->watch_writable == writable) {
+        return;
+    }
+    struct epoll_event event = { .events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN };
+    event.data.fd = p_ctx->udp_socket;
+    if (epoll_ctl(p_ctx->epoll_fd, EPOLL_CTL_MOD, p_ctx->udp_socket, &event)) {
+        printf("watching socket for writability failed (err %d (%s))\n", errno, strerror(errno));
+        return;
+    }
+    p_ctx->watch_writable = writable;
+}
+
+/** 
+ * sends the queued packets with as few sendmmsg calls as possible without blocking. Packets the full socket buffer
+ * does not take stay queued & the socket is watched for writability until `lifx_run_once` sent them.
+ * @returns -1 if the socket failed, the requests of the unsent packets are failed then
+ */
+static int flushPackets(lifx_ctx_t *p_ctx) {
+    int res = 0;
+    while (p_ctx->tx_sent < p_ctx->tx_count) {
+        unsigned int sent = p_ctx->tx_sent;
+        int count = sendmmsg(p_ctx->udp_socket, p_ctx->tx_msgs + sent, p_ctx->tx_count - sent, 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watchWritable(p_ctx, true);
+            return 0;
+        }
+        if (count < 0) {
+            printf("sending packets failed (err %d (%s))\n", errno, strerror(errno));
+            res = -1;
+            break;
+        }
+        p_ctx->tx_sent += count;
+        int64_t now = lx_clock_now_us();
+        for (int i = 0; i < count; i++) {
+            lifx_op_t *p_op = p_ctx->tx_ops[sent + i];
+            lx_peer_t *p_peer = &p_ctx->p_peers[p_ctx->tx_peers[sent + i]];
+            if (p_op != NULL) {
+                p_op->sent_us = now;
+            }
+            COUNT(p_ctx, p_peer, packets_sent, 1);
+            COUNT(p_ctx, p_peer, bytes_sent, p_ctx->tx_msgs[sent + i].msg_len);
+            if (p_ctx->tx_msgs[sent + i].msg_len != p_ctx->tx_iovecs[sent + i].iov_len) {
+                printf("only partial packet sent\n");
+                COUNT(p_ctx, p_peer, send_failures, 1);
+                if (p_op != NULL && p_op->status == LIFX_OP_PENDING) {
+                    completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+                }
+                res = -1;
+            }
+        }
+    }
+    // fail the requests whose packets did not make it out
+    for (unsigned int i = p_ctx->tx_sent; i < p_ctx->tx_count; i++) {
+        COUNT(p_ctx, &p_ctx->p_peers[p_ctx->tx_peers[i]], send_failures, 1);
+        if (p_ctx->tx_ops[i] != NULL && p_ctx->tx_ops[i]->status == LIFX_OP_PENDING) {
+            completeOp(p_ctx, p_ctx->tx_ops[i], LIFX_OP_FAILED);
+        }
+    }
+    p_ctx->tx_count = 0;
+    p_ctx->tx_sent = 0;
+    p_ctx->tx_offset = 0;
+    watchWritable(p_ctx, false);
+    return res;
+}
+
+/** 
+ * encodes the packet to the bulb of `p_peer` into the send queue, the queue is flushed when it is full or 
+ * by `lifx_run_once`
+ * @returns 1 if the queue is full while the socket is not writable, the packet is dropped like a lost one then
+ */
+static int queuePeerPacket(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lx_peer_t *p_peer, unsigned long in_addr, uint32_t port, const packet_config_t *p_config) {
+	if (p_ctx->udp_socket < 0) {
+		printf("queuePacket - socket not open\n");
 		return -1;
 	}
+    uint32_t peer_index = (uint32_t)(p_peer - p_ctx->p_peers);
+    const lx_header_template_t *p_template = headerTemplate(p_ctx, p_peer, p_config);
+    if (p_template == NULL) {
+		printf("header creation for packet type %d failed\n", p_config->type);
+		return -1;
+    }
 
-	uint16_t packet_size = sizeof(header) + p_config->payload_size;
-    if (packet_size > sizeof(p_buffer)) {
-        printf("p_buffer not large enough to send packet\n");
+	uint16_t packet_size = sizeof(lx_protocol_header_t) + p_config->payload_size;
+    if (packet_size > PACKET_BUFFER_SIZE) {
+        printf("packet with type %d too large\n", p_config->type);
         return -1;
     }
-	// copy header
-	memcpy(p_buffer, &header, sizeof(header));
+    if (p_ctx->tx_count >= TX_BATCH || p_ctx->tx_offset + packet_size > sizeof(p_ctx->p_tx_buffer)) {
+        if (flushPackets(p_ctx)) {
+            return -1;
+        }
+        if (p_ctx->tx_count > 0) {
+            COUNT(p_ctx, p_peer, send_failures, 1);
+            return 1;
+        }
+    }
+
+    uint8_t *p_packet = p_ctx->p_tx_buffer + p_ctx->tx_offset;
+	// copy header & patch the fields that differ between packets
+	memcpy(p_packet, p_template->p_header, sizeof(lx_protocol_header_t));
+    p_packet[offsetof(lx_protocol_header_t, size)] = (packet_size >> 0) & 0xFF;
+    p_packet[offsetof(lx_protocol_header_t, size) + 1] = (packet_size >> 8) & 0xFF;
+    p_packet[offsetof(lx_protocol_header_t, sequence)] = p_config->sequence;
 	// copy p_payload
 	if (p_config->payload_size > 0) {
-		memcpy(p_buffer + sizeof(header), p_config->p_payload, p_config->payload_size);
+		memcpy(p_packet + sizeof(lx_protocol_header_t), p_config->p_payload, p_config->payload_size);
 	}
-	assert(((uint16_t *)p_buffer)[0] == packet_size);
+	assert((p_packet[0] | (p_packet[1] << 8)) == packet_size);
 
     #ifdef DEBUG
 	printf("packet [%d]\n", packet_size);
 	for (int i = 0; i < packet_size; i++) {
-    	if (i == 8 | i == 24 | i == 36) {
+    	if (i == 8 || i == 24 || i == 36) {
     		printf("|");
     	}
-    	printf("%02X", p_buffer[i]);
+    	printf("%02X", p_packet[i]);
     }
     printf("\n");
     #endif
-    
 
-	int res = sendto(udp_socket, p_buffer, packet_size, 0, (struct sockaddr *)&server_addr, sizeof(struct sockaddr_in));
-    if (res < 0) {
-    	printf("sending packet with type %d failed (err %d (%s))\n", p_config->type, errno, strerror(errno));
+    if (getServerAddr(in_addr, port, &p_ctx->tx_addrs[p_ctx->tx_count])) {
+    	printf("getServerAddr failed\n");
     	return -1;
     }
-	
-	if (res != packet_size) {
-		printf("only partial packet sent\n");
-		return -1;
-	}
+    p_ctx->tx_iovecs[p_ctx->tx_count] = (struct iovec) {
+        .iov_base = p_packet,
+        .iov_len = packet_size,
+    };
+    bzero(&p_ctx->tx_msgs[p_ctx->tx_count], sizeof(p_ctx->tx_msgs[p_ctx->tx_count]));
+    p_ctx->tx_msgs[p_ctx->tx_count].msg_hdr.msg_name = &p_ctx->tx_addrs[p_ctx->tx_count];
+    p_ctx->tx_msgs[p_ctx->tx_count].msg_hdr.msg_namelen = sizeof(p_ctx->tx_addrs[p_ctx->tx_count]);
+    p_ctx->tx_msgs[p_ctx->tx_count].msg_hdr.msg_iov = &p_ctx->tx_iovecs[p_ctx->tx_count];
+    p_ctx->tx_msgs[p_ctx->tx_count].msg_hdr.msg_iovlen = 1;
+    p_ctx->tx_ops[p_ctx->tx_count] = p_op;
+    p_ctx->tx_peers[p_ctx->tx_count] = peer_index;
+    p_ctx->tx_count++;
+    p_ctx->tx_offset += packet_size;
 	return 0;
 }
 
+/** like `queuePeerPacket`, the peer is looked up by the target of the bulb */
+static int queuePacket(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, const packet_config_t *p_config) {
+    lx_peer_t *p_peer = peerFor(p_ctx, p_bulb->target);
+    if (p_peer == NULL) {
+		printf("peer creation for target %" PRIu64 " failed\n", p_bulb->target);
+		return -1;
+    }
+    if (p_op != NULL) {
+        p_op->peer_index = (uint32_t)(p_peer - p_ctx->p_peers);
+    }
+    return queuePeerPacket(p_ctx, p_op, p_peer, p_bulb->in_addr, p_bulb->port, p_config);
+}
+
 /** 
- * @p_payload free after use
- * @returns 1 when a timeout occurred 
+ * receives up to `RX_BATCH` packets into the next slots of the receive ring with a single recvmmsg call
+ * @param p_first set to the ring slot of the first received packet
+ * @returns number of received packets, 0 when no packet is pending
  */
-static int recvPacketWithServerAddr(bulb_service_t *p_bulb, struct sockaddr_in *p_server_addr, lx_protocol_header_t *p_header, uint8_t **pp_payload, uint16_t *p_payload_size) {
-	if (udp_socket < 0) {
-		printf("discoverBulbs - socket not open");
+static int recvPackets(lifx_ctx_t *p_ctx, size_t *p_first) {
+	if (p_ctx->udp_socket < 0) {
+		printf("recvPackets - socket not open\n");
 		return -1;
 	}
 
-	unsigned int server_addr_size = sizeof(*p_server_addr);
-    if (getServerAddr(p_bulb, p_server_addr)) {
-    	printf("getServerAddr failed\n");
-    	return -1;
+    size_t first = p_ctx->rx_head;
+    for (size_t i = first; i < first + RX_BATCH; i++) {
+        // the kernel overwrites the addr length
+        p_ctx->rx_msgs[i].msg_hdr.msg_namelen = sizeof(p_ctx->rx_addrs[i]);
     }
 
-    int res = recvfrom(udp_socket, p_buffer, sizeof(p_buffer), 0, (struct sockaddr *)p_server_addr, &server_addr_size);
-    if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-        // timeout
-        return 1;
+    int res = recvmmsg(p_ctx->udp_socket, p_ctx->rx_msgs + first, RX_BATCH, 0, NULL);
+    if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        // nothing to read
+        return 0;
     }
     if (res < 0) {
-    	printf("receiving packet failed\n");
+    	printf("receiving packets failed (err %d (%s))\n", errno, strerror(errno));
     	return -1;
     }
+    p_ctx->rx_head = (first + RX_BATCH) % RX_RING_SIZE;
+    *p_first = first;
+    return res;
+}
+
+static uint64_t targetFromHeader(const lx_protocol_header_t *p_header) {
+    const uint8_t *p_bulb_mac_addr = p_header->target;
+    return  ((uint64_t)p_bulb_mac_addr[0] << 0) +
+            ((uint64_t)p_bulb_mac_addr[1] << 8) +
+            ((uint64_t)p_bulb_mac_addr[2] << 16) +
+            ((uint64_t)p_bulb_mac_addr[3] << 24) +
+            ((uint64_t)p_bulb_mac_addr[4] << 32) +
+            ((uint64_t)p_bulb_mac_addr[5] << 40) +
+            ((uint64_t)p_bulb_mac_addr[6] << 48) +
+            ((uint64_t)p_bulb_mac_addr[7] << 56);
+}
+
+/** 
+ * validates a received packet and creates a view into its ring slot
+ * @returns 1 when the packet was dropped
+ */
+static int viewPacket(lifx_ctx_t *p_ctx, size_t slot, int64_t received_us, lx_packet_view_t *p_view) {
+    const uint8_t *p_packet = p_ctx->rx_ring[slot];
+    int length = (int)p_ctx->rx_msgs[slot].msg_len;
 
     #ifdef DEBUG
-    printf("Response buffer[%d]\n", res);
-    for (int i = 0; i < res; i++) {
-        if (i == 8 | i == 24 | i == 36) {
+    printf("Response buffer[%d]\n", length);
+    for (int i = 0; i < length; i++) {
+        if (i == 8 || i == 24 || i == 36) {
             printf("|");
         }
-        printf("%02X", p_buffer[i]);
+        printf("%02X", p_packet[i]);
     }
     printf("\n");
     #endif
 
     // check length
-    if (res < (int)sizeof(*p_header)) {
+    if (length < (int)sizeof(lx_protocol_header_t)) {
     	printf("unexpected response length\n");
-    	return -1;
+        statAdd(&p_ctx->stats.packets_received, 1);
+        statAdd(&p_ctx->stats.bytes_received, (uint64_t)length);
+        statAdd(&p_ctx->stats.malformed, 1);
+    	return 1;
     }
 
-    *p_payload_size = res - sizeof(*p_header);
-
-    // copy header
-    memcpy(p_header, p_buffer, sizeof(*p_header));
-
-    // copy payload
-    if (*p_payload_size > 0) {
-        *pp_payload = malloc(*p_payload_size);
-    	memcpy(*pp_payload, p_buffer + sizeof(*p_header), *p_payload_size);
-    }
+    // the header is packed, so it can be read in place
+    p_view->p_header = (const lx_protocol_header_t *)p_packet;
+    long peer = lx_hashindex_find(&p_ctx->peer_index, targetFromHeader(p_view->p_header));
+    p_view->p_peer = peer >= 0 ? &p_ctx->p_peers[peer] : NULL;
+    p_view->received_us = received_us;
+    COUNT(p_ctx, p_view->p_peer, packets_received, 1);
+    COUNT(p_ctx, p_view->p_peer, bytes_received, (uint64_t)length);
 
     // check source
-    if (p_header->source != source_id) {
-    	printf("response source doesn't match: %d instead of %d", p_header->source, source_id);
-    	return -1;
+    if (p_view->p_header->source != p_ctx->source_id) {
+    	printf("response source doesn't match: %u instead of %u\n", p_view->p_header->source, p_ctx->source_id);
+        COUNT(p_ctx, p_view->p_peer, source_mismatches, 1);
+    	return 1;
     }
 
+    p_view->p_payload = p_packet + sizeof(lx_protocol_header_t);
+    p_view->payload_size = length - sizeof(lx_protocol_header_t);
+    p_view->p_server_addr = &p_ctx->rx_addrs[slot];
     return 0;
 }
 
-/** 
- * @p_payload free after use
- * @returns 1 when a timeout occurred 
- */
-static int recvPacket(bulb_service_t *p_bulb, lx_protocol_header_t *p_header, uint8_t **pp_payload, uint16_t *p_payload_size) {
-	struct sockaddr_in serverAddr;
-	return recvPacketWithServerAddr(p_bulb, &serverAddr, p_header, pp_payload, p_payload_size);
-}
-
-static int recvPacketWithRetry(bulb_service_t *p_bulb, lx_protocol_header_t *p_header, uint8_t **pp_payload, uint16_t *p_payload_size) {
-    int res;
-    for (int i = 0; i < RECEIVE_RETRIES; i++) {
-        res = recvPacket(p_bulb, p_header, pp_payload, p_payload_size);
-        if (res != 1) {
-            // error or success
-            return res;
-        }
-        // continue looping in case of timeout (res == 1)
-    }
-    printf("recvPacketWithRetry max retries reached\n");
-    return -1;
-}
-
-static int convertToBulbService(struct sockaddr_in *p_server_addr, lx_protocol_header_t *p_response_header, uint8_t *p_payload, const uint16_t payload_size, bulb_service_t *p_bulb) {
+static int convertToBulbService(const lx_packet_view_t *p_view, bulb_service_t *p_bulb) {
+    const uint8_t *p_payload = p_view->p_payload;
     // check payload size:
-    if (payload_size < 5) {
+    if (p_view->payload_size < 5) {
         return -1;
     }
     // check response type
-    if (p_response_header->type != MSG_TYPE_STATE_SERVICE) {
+    if (p_view->p_header->type != MSG_TYPE_STATE_SERVICE) {
         return -1;
     }
     // eval response header & response payload
-    uint8_t *p_bulb_mac_addr = p_response_header->target;
-    p_bulb->in_addr = ntohl(p_server_addr->sin_addr.s_addr);
-    p_bulb->target =    ((uint64_t)p_bulb_mac_addr[0] << 0) +
-                        ((uint64_t)p_bulb_mac_addr[1] << 8) +
-                        ((uint64_t)p_bulb_mac_addr[2] << 16) +
-                        ((uint64_t)p_bulb_mac_addr[3] << 24) +
-                        ((uint64_t)p_bulb_mac_addr[4] << 32) +
-                        ((uint64_t)p_bulb_mac_addr[5] << 40) +
-                        ((uint64_t)p_bulb_mac_addr[6] << 48) +
-                        ((uint64_t)p_bulb_mac_addr[7] << 56);
+    p_bulb->in_addr = ntohl(p_view->p_server_addr->sin_addr.s_addr);
+    p_bulb->target = targetFromHeader(p_view->p_header);
     p_bulb->service = p_payload[0];
     p_bulb->port =  ((uint32_t)p_payload[1] << 0) + 
                     ((uint32_t)p_payload[2] << 8) + 
@@ -341,86 +1097,1219 @@ static int convertToBulbService(struct sockaddr_in *p_server_addr, lx_protocol_h
     return 0;
 }
 
-/** NULL terminated array of bulbs, free after use */
-int discoverBulbs(bulb_service_t ***ppp_bulbs) {
-	
- 	// UDP broadcast to port 56700
-    bulb_service_t broadcastBulb = {
-    	.in_addr = INADDR_BROADCAST,
-    	.target = (uint64_t)0, // send to all bulbs
-    	.service = 1,
-    	.port = BROADCAST_PORT,
-    };
+/** whether a broadcast set waits for the confirmations of known bulbs or just collects them until it expires */
+static bool expectsConfirmations(const lifx_op_t *p_op) {
+    const lifx_broadcast_t *p_broadcast = p_op->p_sink;
+    return p_broadcast->p_expected != NULL && p_broadcast->p_expected->count > 0;
+}
 
+/** first addr & number of addrs a range of a sweep probes */
+static void sweepHosts(const lifx_cidr_t *p_range, unsigned long *p_first, uint64_t *p_count) {
+    uint32_t mask = p_range->prefix_length == 0 ? 0 : (uint32_t)0xFFFFFFFF << (32 - p_range->prefix_length);
+    *p_first = p_range->in_addr & mask;
+    *p_count = (uint64_t)1 << (32 - p_range->prefix_length);
+    if (*p_count > 2) {
+        // skip the network & broadcast addr
+        *p_first += 1;
+        *p_count -= 2;
+    }
+}
+
+/** sends a GetService with the sequence of the sweep, so that the responses match it */
+static int sendSweepProbe(lifx_ctx_t *p_ctx, lifx_op_t *p_op, unsigned long in_addr) {
+    bulb_service_t probe = {
+        .in_addr = in_addr,
+        .target = 0,
+        .service = 1,
+        .port = p_op->bulb.port,
+    };
     packet_config_t config = {
         .payload_size = 0,
         .p_payload = NULL,
         .tagged = 1,
         .ack_required = 0,
         .res_required = 0,
-        .type = MSG_TYPE_GET_SERVICE
+        .sequence = p_op->sequence,
+        .type = MSG_TYPE_GET_SERVICE,
     };
+    return queuePacket(p_ctx, p_op, &probe, &config);
+}
 
-    if (sendPacket(&broadcastBulb, &config)) {
-    	printf("send discover bulb packet failed\n");
-    	return -1;
+/** sends a GetService to the subnet-directed broadcast addr of every listed interface */
+static int sendSweepBroadcasts(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    lifx_sweep_t *p_sweep = p_op->p_sink;
+    if (p_sweep->interface_count == 0) {
+        return 0;
+    }
+    struct ifaddrs *p_addrs;
+    if (getifaddrs(&p_addrs)) {
+        printf("listing interfaces failed (err %d (%s))\n", errno, strerror(errno));
+        return -1;
+    }
+    int res = 0;
+    for (size_t i = 0; i < p_sweep->interface_count && res == 0; i++) {
+        bool found = false;
+        for (struct ifaddrs *p_addr = p_addrs; p_addr != NULL && res == 0; p_addr = p_addr->ifa_next) {
+            if (p_addr->ifa_addr == NULL || p_addr->ifa_addr->sa_family != AF_INET || p_addr->ifa_broadaddr == NULL
+                || !(p_addr->ifa_flags & IFF_UP) || !(p_addr->ifa_flags & IFF_BROADCAST)
+                || strcmp(p_addr->ifa_name, p_sweep->pp_interfaces[i]) != 0) {
+                continue;
+            }
+            // an interface can have several addrs, each in its own subnet
+            found = true;
+            // a broadcast dropped by the full send queue is repeated by the next round
+            res = sendSweepProbe(p_ctx, p_op, ntohl(((const struct sockaddr_in *)p_addr->ifa_broadaddr)->sin_addr.s_addr));
+            if (res == 0) {
+                p_sweep->broadcasts_sent++;
+            }
+        }
+        if (!found && p_sweep->round == 0) {
+            printf("interface %s has no IPv4 broadcast addr\n", p_sweep->pp_interfaces[i]);
+        }
     }
+    freeifaddrs(p_addrs);
+    return res < 0 ? -1 : 0;
+}
 
-    struct sockaddr_in serverAddr;
-    lx_protocol_header_t response_header;
-	uint16_t response_payload_size;
-    uint8_t *p_payload;
-    int counter = 0;
-    int bulb_counter = 0;
-    bulb_service_t **pp_bulbs = malloc(sizeof(bulb_service_t *) * (BULB_LIMIT + 1));
-    *ppp_bulbs = pp_bulbs;
-    while (true) {
-        int res = recvPacketWithServerAddr(&broadcastBulb, &serverAddr, &response_header, &p_payload, &response_payload_size);
-    	if (res == 1) {
-            // timeout 
-            printf("bulb discovery timeout\n");
-            if (counter >= RECEIVE_RETRIES - 1) {
+/** 
+ * sends the next batch of probes of a sweep & schedules the following one. Once all probes of a round are sent,
+ * the responses are collected until the settle time passed, then the next round starts or the sweep is done.
+ */
+static void sweepStep(lifx_ctx_t *p_ctx, lifx_op_t *p_op, int64_t now) {
+    lifx_sweep_t *p_sweep = p_op->p_sink;
+    uint32_t rounds = p_sweep->rounds > 0 ? p_sweep->rounds : SWEEP_ROUNDS;
+    if (p_sweep->range >= p_sweep->range_count) {
+        // the settle time of the round is over
+        p_sweep->round++;
+        if (p_sweep->round >= rounds) {
+            completeOp(p_ctx, p_op, LIFX_OP_DONE);
+            return;
+        }
+        p_sweep->range = 0;
+        p_sweep->host = 0;
+    }
+    if (p_sweep->range == 0 && p_sweep->host == 0 && sendSweepBroadcasts(p_ctx, p_op)) {
+        completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+        return;
+    }
+
+    uint32_t budget = p_sweep->probes_per_ms > 0 ? p_sweep->probes_per_ms : SWEEP_PROBES_PER_MS;
+    while (budget > 0 && p_sweep->range < p_sweep->range_count) {
+        unsigned long first;
+        uint64_t count;
+        sweepHosts(&p_sweep->p_ranges[p_sweep->range], &first, &count);
+        if (p_sweep->host >= count) {
+            p_sweep->range++;
+            p_sweep->host = 0;
+            continue;
+        }
+        unsigned long in_addr = first + (unsigned long)p_sweep->host;
+        p_sweep->host++;
+        if (p_sweep->round > 0 && lifx_registry_find_addr(p_sweep->p_registry, in_addr, p_op->bulb.port) != NULL) {
+            // answered already
+            continue;
+        }
+        int res = sendSweepProbe(p_ctx, p_op, in_addr);
+        if (res > 0) {
+            // the send queue is full, the probe is sent with the next batch
+            p_sweep->host--;
+            break;
+        }
+        if (res < 0) {
+            if (p_op->status == LIFX_OP_PENDING) {
+                completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+            }
+            return;
+        }
+        p_sweep->probes_sent++;
+        budget--;
+    }
+    if (p_sweep->range < p_sweep->range_count) {
+        p_op->deadline_us = now + SWEEP_INTERVAL_US;
+    } else {
+        p_op->deadline_us = now + (p_sweep->settle_ms > 0 ? (int64_t)p_sweep->settle_ms * 1000 : SWEEP_SETTLE_US);
+    }
+    if (p_op->deadline_us > p_op->expires_us) {
+        p_op->deadline_us = p_op->expires_us;
+    }
+    heapSiftDown(p_ctx, p_op->heap_index);
+}
+
+/** 
+ * puts the packet of a submitted or throttled op on the wire and tracks it in the in-flight table.
+ * Ops already in the deadline heap keep their position there.
+ */
+static int startOp(lifx_ctx_t *p_ctx, lifx_op_t *p_op, int64_t now) {
+    packet_config_t config = {
+        .payload_size = p_op->payload_size,
+        .p_payload = opPayload(p_op),
+        // only broadcasts address target 0
+        .tagged = p_op->target == 0,
+        .ack_required = p_op->ack_required,
+        .res_required = p_op->res_required,
+        .type = p_op->request_type,
+    };
+    bool in_heap = p_op->parked;
+    if (p_op->parked) {
+        unparkOp(p_ctx, p_op);
+    }
+
+    if (p_op->kind == OP_KIND_FORGET) {
+        // nothing to match, the op is not tracked and done as soon as its packet is queued
+        if (in_heap) {
+            heapRemove(p_ctx, p_op);
+        }
+        config.sequence = p_ctx->next_sequence++;
+        int res = queuePacket(p_ctx, NULL, &p_op->bulb, &config);
+        finishOp(p_ctx, p_op, res ? LIFX_OP_FAILED : LIFX_OP_DONE);
+        return res ? -1 : 0;
+    }
+
+    bool retransmits = p_op->kind == OP_KIND_UNICAST || (p_op->kind == OP_KIND_BROADCAST && expectsConfirmations(p_op));
+    if (retransmits) {
+        p_op->rto_us = p_ctx->p_peers[p_op->peer_index].rto_us;
+        p_op->deadline_us = now + p_op->rto_us < p_op->expires_us ? now + p_op->rto_us : p_op->expires_us;
+    } else if (p_op->kind == OP_KIND_SWEEP || p_op->kind == OP_KIND_BATCH) {
+        // the first probes (or packets of a batch) are sent right away, which moves the deadline to the next ones
+        p_op->deadline_us = now;
+    } else {
+        // broadcasts collect responses until they expire
+        p_op->deadline_us = p_op->expires_us;
+    }
+    if (insertInflight(p_ctx, p_op)) {
+        if (in_heap) {
+            heapRemove(p_ctx, p_op);
+        }
+        finishOp(p_ctx, p_op, LIFX_OP_FAILED);
+        return -1;
+    }
+    if (in_heap) {
+        heapSiftDown(p_ctx, p_op->heap_index);
+        heapSiftUp(p_ctx, p_op->heap_index);
+    } else if (heapInsert(p_ctx, p_op)) {
+        removeInflight(p_ctx, p_op);
+        finishOp(p_ctx, p_op, LIFX_OP_FAILED);
+        return -1;
+    }
+    if (p_op->kind == OP_KIND_SWEEP) {
+        sweepStep(p_ctx, p_op, now);
+        return p_op->status == LIFX_OP_FAILED ? -1 : 0;
+    }
+    if (p_op->kind == OP_KIND_BATCH) {
+        // the packets are encoded from the fleet by `lx_batch_submit`
+        return 0;
+    }
+    config.sequence = p_op->sequence;
+    // a packet dropped by the full send queue is only sent again by the retransmission timer
+    int res = queuePacket(p_ctx, p_op, &p_op->bulb, &config);
+    if (res < 0 || (res > 0 && !retransmits)) {
+        if (p_op->status == LIFX_OP_PENDING) {
+            completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static bool isCoalescable(uint16_t type) {
+    return type == MSG_TYPE_SET_COLOR || type == MSG_TYPE_SET_POWER;
+}
+
+/** 
+ * reserves the next send slot of the bulb (GCRA)
+ * @returns time the request may be sent, which is in the future if the bulb is throttled
+ */
+static int64_t reserveSlot(lifx_ctx_t *p_ctx, lx_peer_t *p_peer, int64_t now) {
+    int64_t slot = p_peer->next_send_us - p_ctx->send_burst_us;
+    if (slot < now) {
+        slot = now;
+    }
+    p_peer->next_send_us = (p_peer->next_send_us > now ? p_peer->next_send_us : now) + p_ctx->send_interval_us;
+    return slot;
+}
+
+/** 
+ * delays the op until the bulb has a free slot. A throttled set request of the same type is replaced:
+ * the newer one takes over its slot and the older one is never sent.
+ * @returns 1 if the op was throttled, 0 if it can be sent right away
+ */
+static int throttleOp(lifx_ctx_t *p_ctx, lifx_op_t *p_op, int64_t now) {
+    lx_peer_t *p_peer = &p_ctx->p_peers[p_op->peer_index];
+    lifx_op_t **pp_free = NULL;
+    if (isCoalescable(p_op->request_type)) {
+        for (size_t i = 0; i < PEER_PARKED; i++) {
+            lifx_op_t *p_parked = p_peer->pp_parked[i];
+            if (p_parked == NULL) {
+                pp_free = pp_free == NULL ? &p_peer->pp_parked[i] : pp_free;
+            } else if (p_parked->request_type == p_op->request_type) {
+                p_op->deadline_us = p_parked->deadline_us;
+                completeOp(p_ctx, p_parked, LIFX_OP_COALESCED);
+                COUNT(p_ctx, p_peer, coalesced, 1);
+                pp_free = &p_peer->pp_parked[i];
                 break;
             }
-        } else if (res) {
-            // failure
-            printf("receive discover bulb packet failed\n");
+        }
+    }
+    if (p_op->deadline_us == 0) {
+        int64_t slot = reserveSlot(p_ctx, p_peer, now);
+        if (slot <= now) {
+            return 0;
+        }
+        p_op->deadline_us = slot;
+        COUNT(p_ctx, p_peer, throttled, 1);
+    }
+    if (heapInsert(p_ctx, p_op)) {
+        finishOp(p_ctx, p_op, LIFX_OP_FAILED);
+        return -1;
+    }
+    p_op->parked = true;
+    if (pp_free != NULL) {
+        *pp_free = p_op;
+    }
+    return 1;
+}
+
+/** forgets the cached value a set request changes, until the request or a later one is confirmed */
+static void invalidateState(lx_peer_t *p_peer, uint16_t type, int64_t now) {
+    switch (type) {
+        case MSG_TYPE_SET_POWER:
+            p_peer->state.power_us = 0;
+            p_peer->power_written_us = now;
+            break;
+        case MSG_TYPE_SET_COLOR:
+        case MSG_TYPE_SET_EXTENDED_COLOR_ZONES:
+        case MSG_TYPE_SET_64:
+            p_peer->state.color_us = 0;
+            p_peer->color_written_us = now;
+            break;
+        default:
+            break;
+    }
+}
+
+/** caches power and / or color confirmed for a request submitted at `submitted_us`, NULL for values not confirmed */
+static void cacheValues(lx_peer_t *p_peer, int64_t submitted_us, int64_t received_us, const bool *p_on, const color_t *p_color) {
+    lifx_bulb_state_t *p_state = &p_peer->state;
+    if (p_on != NULL && submitted_us >= p_peer->power_written_us) {
+        p_state->on = *p_on;
+        p_state->power_us = received_us;
+    }
+    if (p_color != NULL && submitted_us >= p_peer->color_written_us) {
+        p_state->color = *p_color;
+        p_state->color_us = received_us;
+    }
+}
+
+/** 
+ * caches the state a completed request confirmed. Responses to requests submitted before the latest change
+ * might show the state before it and are not cached.
+ */
+static void cacheState(lx_peer_t *p_peer, lifx_op_t *p_op, int64_t received_us) {
+    const uint8_t *p_payload = opPayload(p_op);
+    switch (p_op->request_type) {
+        case MSG_TYPE_GET_LIGHT:
+            // LightState carries the power as well
+            cacheValues(p_peer, p_op->submitted_us, received_us, &p_op->on, &p_op->color);
+            memcpy(p_peer->state.label, p_op->label, sizeof(p_peer->state.label));
+            p_peer->state.label_us = received_us;
+            break;
+        case MSG_TYPE_GET_POWER:
+            cacheValues(p_peer, p_op->submitted_us, received_us, &p_op->on, NULL);
+            break;
+        case MSG_TYPE_SET_POWER: {
+            // bulbs answer set requests with the state before the change, so the requested value is cached
+            bool on = p_payload[0] != 0 || p_payload[1] != 0;
+            cacheValues(p_peer, p_op->submitted_us, received_us, &on, NULL);
+            break;
+        }
+        case MSG_TYPE_SET_COLOR: {
+            color_t color;
+            decodeColors(&color, p_payload + 1, 1);
+            cacheValues(p_peer, p_op->submitted_us, received_us, NULL, &color);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/** whether a cached value confirmed at `confirmed_us`, 0 if it is unknown, was confirmed at `oldest_us` or later */
+static bool isFresh(int64_t confirmed_us, int64_t oldest_us) {
+    return confirmed_us != 0 && confirmed_us >= oldest_us;
+}
+
+/** 
+ * answers a power or color read from the state cache if the values it needs are fresh enough
+ * @returns true if the op was completed
+ */
+static bool readCachedState(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, bool light) {
+    if (p_op->max_age_ms == 0) {
+        return false;
+    }
+    long index = lx_hashindex_find(&p_ctx->peer_index, p_bulb->target);
+    if (index < 0) {
+        return false;
+    }
+    lx_peer_t *p_peer = &p_ctx->p_peers[index];
+    const lifx_bulb_state_t *p_state = &p_peer->state;
+    int64_t oldest_us = lx_clock_now_us() - (int64_t)p_op->max_age_ms * 1000;
+    if (!isFresh(p_state->power_us, oldest_us)) {
+        return false;
+    }
+    if (light && (!isFresh(p_state->color_us, oldest_us) || !isFresh(p_state->label_us, oldest_us))) {
+        return false;
+    }
+    p_op->on = p_state->on;
+    if (light) {
+        p_op->color = p_state->color;
+        memcpy(p_op->label, p_state->label, sizeof(p_op->label));
+    }
+    p_op->p_heap_payload = NULL;
+    finishOp(p_ctx, p_op, LIFX_OP_DONE);
+    COUNT(p_ctx, p_peer, cache_hits, 1);
+    return true;
+}
+
+/** 
+ * completes a set request without sending it if write suppression is enabled and the cached state of the bulb
+ * is fresh and matches the request
+ * @param p_on requested power or NULL, p_color requested color or NULL
+ * @returns true if the op was completed
+ */
+static bool suppressWrite(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, const bool *p_on, const color_t *p_color) {
+    if (p_ctx->suppress_age_us == 0) {
+        return false;
+    }
+    long index = lx_hashindex_find(&p_ctx->peer_index, p_bulb->target);
+    if (index < 0) {
+        return false;
+    }
+    lx_peer_t *p_peer = &p_ctx->p_peers[index];
+    const lifx_bulb_state_t *p_state = &p_peer->state;
+    int64_t oldest_us = lx_clock_now_us() - p_ctx->suppress_age_us;
+    if (p_on != NULL && (!isFresh(p_state->power_us, oldest_us) || p_state->on != *p_on)) {
+        return false;
+    }
+    if (p_color != NULL && (!isFresh(p_state->color_us, oldest_us) || 
+            memcmp(&p_state->color, p_color, sizeof(color_t)) != 0)) {
+        return false;
+    }
+    p_op->p_heap_payload = NULL;
+    finishOp(p_ctx, p_op, LIFX_OP_SUPPRESSED);
+    COUNT(p_ctx, p_peer, suppressed, 1);
+    return true;
+}
+
+/** 
+ * stores the request in the op, so it can be throttled & retransmitted, and puts it on the wire
+ * @param timeout_us overall deadline, requests to a single bulb use the one of the op if it has one
+ */
+static int submitOp(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, const packet_config_t *p_config, uint16_t response_type, lx_op_kind kind, int64_t timeout_us) {
+    p_op->p_heap_payload = NULL;
+    if (p_config->payload_size > PACKET_BUFFER_SIZE - sizeof(lx_protocol_header_t)) {
+        printf("payload of packet type %d too large\n", p_config->type);
+        finishOp(p_ctx, p_op, LIFX_OP_FAILED);
+        return -1;
+    }
+    lx_peer_t *p_peer = peerFor(p_ctx, p_bulb->target);
+    if (p_peer == NULL) {
+        finishOp(p_ctx, p_op, LIFX_OP_FAILED);
+        return -1;
+    }
+    int64_t now = lx_clock_now_us();
+    p_op->status = LIFX_OP_PENDING;
+    p_op->target = p_bulb->target;
+    p_op->response_type = response_type;
+    p_op->kind = kind;
+    p_op->retries = 0;
+    p_op->parked = false;
+    p_op->deadline_us = 0;
+    p_op->expires_us = now + (kind != OP_KIND_DISCOVERY && p_op->timeout_ms > 0 ? (int64_t)p_op->timeout_ms * 1000 : timeout_us);
+    p_op->p_next = NULL;
+    p_op->submitted_us = now;
+    p_op->peer_index = (uint32_t)(p_peer - p_ctx->p_peers);
+    p_op->bulb = *p_bulb;
+    p_op->request_type = p_config->type;
+    p_op->ack_required = p_config->ack_required;
+    p_op->res_required = p_config->res_required;
+    p_op->payload_size = p_config->payload_size;
+    if (p_config->payload_size > LIFX_OP_PAYLOAD_SIZE) {
+        p_op->p_heap_payload = malloc(p_config->payload_size);
+        if (p_op->p_heap_payload == NULL) {
+            printf("allocating payload failed\n");
+            finishOp(p_ctx, p_op, LIFX_OP_FAILED);
             return -1;
-        } else {
-            // response received
-            printf("bulb response received\n");
-            bulb_service_t *p_bulbs = malloc(sizeof(bulb_service_t));
-            if (!convertToBulbService(&serverAddr, &response_header, p_payload, response_payload_size, p_bulbs)) {
-                free(p_payload);
-                pp_bulbs[bulb_counter] = p_bulbs;
-                bulb_counter++;
-                if (bulb_counter >= BULB_LIMIT) {
-                    break;
+        }
+    }
+    if (p_config->payload_size > 0) {
+        memcpy(opPayload(p_op), p_config->p_payload, p_config->payload_size);
+    }
+    invalidateState(p_peer, p_config->type, now);
+
+    if (p_op->target != 0 && p_ctx->send_interval_us > 0) {
+        int res = throttleOp(p_ctx, p_op, now);
+        if (res != 0) {
+            return res < 0 ? -1 : 0;
+        }
+    }
+    return startOp(p_ctx, p_op, now);
+}
+
+/** 
+ * submits a set request with the reliability of the op or, if it has none, of the context
+ * @param state_type response to wait for with `LIFX_RELIABILITY_RESPONSE`, 0 if the message is never answered 
+ * with a state, then an acknowledgement is waited for instead
+ */
+static int submitSetOp(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, packet_config_t *p_config, uint16_t state_type) {
+    lifx_reliability_t reliability = p_op->reliability != LIFX_RELIABILITY_DEFAULT ? p_op->reliability : p_ctx->reliability;
+    if (reliability == LIFX_RELIABILITY_RESPONSE && state_type == 0) {
+        reliability = LIFX_RELIABILITY_ACK;
+    }
+    switch (reliability) {
+        case LIFX_RELIABILITY_ACK:
+            p_config->ack_required = 1;
+            p_config->res_required = 0;
+            return submitOp(p_ctx, p_op, p_bulb, p_config, MSG_TYPE_ACKNOWLEDGEMENT, OP_KIND_UNICAST, REQUEST_TIMEOUT_US);
+        case LIFX_RELIABILITY_NONE:
+            p_config->ack_required = 0;
+            p_config->res_required = 0;
+            return submitOp(p_ctx, p_op, p_bulb, p_config, 0, OP_KIND_FORGET, REQUEST_TIMEOUT_US);
+        default:
+            p_config->ack_required = 0;
+            p_config->res_required = 1;
+            return submitOp(p_ctx, p_op, p_bulb, p_config, state_type, OP_KIND_UNICAST, REQUEST_TIMEOUT_US);
+    }
+}
+
+/** 
+ * sends the request again with the same sequence number, so a late response to an earlier attempt still matches.
+ * The retransmission timeout of the op and of its bulb is backed off.
+ */
+static void retransmitOp(lifx_ctx_t *p_ctx, lifx_op_t *p_op, int64_t now) {
+    lx_peer_t *p_peer = &p_ctx->p_peers[p_op->peer_index];
+    p_op->retries++;
+    p_op->rto_us = 2 * p_op->rto_us < MAX_RTO_US ? 2 * p_op->rto_us : MAX_RTO_US;
+    if (p_peer->rto_us < p_op->rto_us) {
+        p_peer->rto_us = p_op->rto_us;
+    }
+    p_op->deadline_us = now + p_op->rto_us < p_op->expires_us ? now + p_op->rto_us : p_op->expires_us;
+    heapSiftDown(p_ctx, p_op->heap_index);
+    COUNT(p_ctx, p_peer, retries, 1);
+
+    packet_config_t config = {
+        .payload_size = p_op->payload_size,
+        .p_payload = opPayload(p_op),
+        .tagged = p_op->target == 0,
+        .ack_required = p_op->ack_required,
+        .res_required = p_op->res_required,
+        .sequence = p_op->sequence,
+        .type = p_op->request_type,
+    };
+    if (queuePacket(p_ctx, p_op, &p_op->bulb, &config) < 0 && p_op->status == LIFX_OP_PENDING) {
+        completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+    }
+}
+
+/** feeds an RTT sample into the bulb's estimator and derives its retransmission timeout (RFC 6298) */
+static void updateRto(lx_peer_t *p_peer, int64_t rtt_us) {
+    if (rtt_us < 0) {
+        rtt_us = 0;
+    }
+    if (p_peer->srtt_us == 0) {
+        p_peer->srtt_us = rtt_us > 0 ? rtt_us : 1;
+        p_peer->rttvar_us = rtt_us / 2;
+    } else {
+        int64_t deviation = p_peer->srtt_us > rtt_us ? p_peer->srtt_us - rtt_us : rtt_us - p_peer->srtt_us;
+        p_peer->rttvar_us = (3 * p_peer->rttvar_us + deviation) / 4;
+        p_peer->srtt_us = (7 * p_peer->srtt_us + rtt_us) / 8;
+    }
+    int64_t rto_us = p_peer->srtt_us + 4 * p_peer->rttvar_us;
+    p_peer->rto_us = rto_us < MIN_RTO_US ? MIN_RTO_US : rto_us > MAX_RTO_US ? MAX_RTO_US : rto_us;
+}
+
+/** 
+ * adds the responding bulb to the registry a discovery fills
+ * @returns 1 if the bulb is new
+ */
+static int addDiscoveredBulb(lifx_registry_t *p_registry, const lx_packet_view_t *p_view) {
+    bulb_service_t bulb;
+    if (convertToBulbService(p_view, &bulb)) {
+        return 0;
+    }
+    int res = lifx_registry_upsert(p_registry, &bulb);
+    if (res < 0) {
+        printf("adding bulb to registry failed\n");
+    } else if (res > 0) {
+        printf("bulb response received\n");
+    }
+    return res;
+}
+
+/** decodes the response into the op it answers */
+static void handleResponse(lifx_ctx_t *p_ctx, lifx_op_t *p_op, const lx_packet_view_t *p_view) {
+    const lx_protocol_header_t *p_header = p_view->p_header;
+    const uint8_t *p_payload = p_view->p_payload;
+    uint16_t payload_size = p_view->payload_size;
+    if (p_header->type != p_op->response_type) {
+        printf("wrong response type received: %d instead of %d\n", p_header->type, p_op->response_type);
+        COUNT(p_ctx, p_view->p_peer, wrong_types, 1);
+        completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+        return;
+    }
+
+    switch (p_header->type) {
+        case MSG_TYPE_STATE_POWER: {
+            if (payload_size < 2) {
+                printf("StatePower response too short\n");
+                COUNT(p_ctx, p_view->p_peer, malformed, 1);
+                completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+                return;
+            }
+            uint16_t level = ((uint16_t)p_payload[0] << 0) + 
+                                ((uint16_t)p_payload[1] << 8);
+            p_op->on = level == 0 ? false : true;
+            break;
+        }
+        case MSG_TYPE_LIGHT_STATE: {
+            if (payload_size < 52) {
+                printf("LightState response too short\n");
+                COUNT(p_ctx, p_view->p_peer, malformed, 1);
+                completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+                return;
+            }
+            p_op->color.hue =    ((uint16_t)p_payload[0] << 0) + 
+                                ((uint16_t)p_payload[1] << 8);
+            p_op->color.saturation = ((uint16_t)p_payload[2] << 0) + 
+                                    ((uint16_t)p_payload[3] << 8);
+            p_op->color.brightness = ((uint16_t)p_payload[4] << 0) + 
+                                    ((uint16_t)p_payload[5] << 8);
+            p_op->color.kelvin = ((uint16_t)p_payload[6] << 0) + 
+                                ((uint16_t)p_payload[7] << 8);
+
+            uint16_t power =    ((uint16_t)p_payload[10] << 0) + 
+                                ((uint16_t)p_payload[11] << 8);
+            p_op->on = power == 0 ? false : true;
+
+            p_op->label[LIFX_LABEL_LENGTH] = '\0'; // NULL terminator
+            memcpy(p_op->label, p_payload + 12, LIFX_LABEL_LENGTH);
+            break;
+        }
+        case MSG_TYPE_STATE_EXTENDED_COLOR_ZONES: {
+            if (payload_size < STATE_EXTENDED_COLOR_ZONES_SIZE) {
+                printf("StateExtendedColorZones response too short\n");
+                COUNT(p_ctx, p_view->p_peer, malformed, 1);
+                completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+                return;
+            }
+            p_op->zone_count = ((uint16_t)p_payload[0] << 0) + ((uint16_t)p_payload[1] << 8);
+            p_op->zone_index = ((uint16_t)p_payload[2] << 0) + ((uint16_t)p_payload[3] << 8);
+            size_t count = p_payload[4] < EXTENDED_ZONES ? p_payload[4] : EXTENDED_ZONES;
+            p_op->color_count = count < p_op->color_capacity ? count : p_op->color_capacity;
+            decodeColors(p_op->p_colors, p_payload + 5, p_op->color_count);
+            break;
+        }
+        case MSG_TYPE_STATE_64: {
+            if (payload_size < STATE_64_SIZE) {
+                printf("State64 response too short\n");
+                COUNT(p_ctx, p_view->p_peer, malformed, 1);
+                completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+                return;
+            }
+            p_op->color_count = TILE_COLORS < p_op->color_capacity ? TILE_COLORS : p_op->color_capacity;
+            decodeColors(p_op->p_colors, p_payload + 5, p_op->color_count);
+            break;
+        }
+        default:
+            break;
+    }
+    if (p_op->retries == 0) {
+        // Karn: the response to a retransmitted request could answer any of the attempts
+        countRtt(p_ctx, p_view->p_peer, p_view->received_us - p_op->sent_us);
+        updateRto(&p_ctx->p_peers[p_op->peer_index], p_view->received_us - p_op->sent_us);
+    }
+    cacheState(&p_ctx->p_peers[p_op->peer_index], p_op, p_view->received_us);
+    completeOp(p_ctx, p_op, LIFX_OP_DONE);
+}
+
+/** marks the responding bulb as confirmed, the op is done once all expected bulbs confirmed */
+static void handleBroadcastResponse(lifx_ctx_t *p_ctx, lifx_op_t *p_op, const lx_packet_view_t *p_view) {
+    lifx_broadcast_t *p_broadcast = p_op->p_sink;
+    const lifx_registry_t *p_expected = p_broadcast->p_expected;
+    bulb_service_t *p_bulb = p_expected != NULL ? lifx_registry_find_target(p_expected, targetFromHeader(p_view->p_header)) : NULL;
+    if (p_bulb == NULL) {
+        p_broadcast->unexpected_count++;
+        return;
+    }
+    size_t index = (size_t)(p_bulb - p_expected->p_bulbs);
+    if (p_broadcast->p_confirmed[index]) {
+        // acknowledgement of a repeated broadcast
+        return;
+    }
+    p_broadcast->p_confirmed[index] = true;
+    p_broadcast->confirmed_count++;
+    if (p_view->p_peer != NULL) {
+        cacheState(p_view->p_peer, p_op, p_view->received_us);
+    }
+    if (p_broadcast->confirmed_count == p_expected->count) {
+        completeOp(p_ctx, p_op, LIFX_OP_DONE);
+    }
+}
+
+/** 
+ * @returns the peer of the bulb, `*p_hint` is the index of the peer in the peer table, which is checked first and
+ * updated if it does not belong to the bulb. Peers are never removed, so their indices stay valid.
+ */
+static lx_peer_t *hintedPeer(lifx_ctx_t *p_ctx, uint64_t target, uint32_t *p_hint) {
+    if (*p_hint < p_ctx->peer_count && p_ctx->p_peers[*p_hint].target == target) {
+        return &p_ctx->p_peers[*p_hint];
+    }
+    lx_peer_t *p_peer = peerFor(p_ctx, target);
+    if (p_peer != NULL) {
+        *p_hint = (uint32_t)(p_peer - p_ctx->p_peers);
+    }
+    return p_peer;
+}
+
+/** @returns the fleet index of the bulb if it is part of the batch, -1 otherwise */
+static long batchIndex(const lx_batch_t *p_batch, uint64_t target) {
+    long index = lx_hashindex_find(&p_batch->p_fleet->target_index, target);
+    if (index < 0 || (size_t)index < p_batch->first || (size_t)index >= p_batch->first + p_batch->count) {
+        return -1;
+    }
+    return index;
+}
+
+/** sets the final status of a bulb of the batch */
+static void settleBulb(lx_batch_t *p_batch, size_t index, lifx_op_status_t status) {
+    p_batch->p_fleet->p_status[index] = (uint8_t)status;
+    p_batch->pending_count--;
+}
+
+/** 
+ * writes the values the bulb confirmed to the fleet & the state cache. Bulbs answer set requests with the state 
+ * before the change, so the requested values are written.
+ */
+static void confirmBatchBulb(lifx_ctx_t *p_ctx, lifx_op_t *p_op, size_t index, const lx_packet_view_t *p_view) {
+    lx_batch_t *p_batch = p_op->p_sink;
+    lifx_fleet_t *p_fleet = p_batch->p_fleet;
+    lx_peer_t *p_peer = &p_ctx->p_peers[p_fleet->p_peers[index]];
+    const uint8_t *p_payload = p_view->p_payload;
+    bool on;
+    color_t color;
+    const bool *p_on = NULL;
+    const color_t *p_color = NULL;
+    if (p_view->p_header->type == MSG_TYPE_LIGHT_STATE) {
+        decodeColors(&color, p_payload, 1);
+        on = ((uint16_t)p_payload[10] | ((uint16_t)p_payload[11] << 8)) != 0;
+        p_on = &on;
+        p_color = &color;
+    }
+    if (p_batch->type == LX_BATCH_SET_COLOR) {
+        color = p_batch->p_colors[index - p_batch->first];
+        p_color = &color;
+    } else if (p_batch->type == LX_BATCH_SET_POWER) {
+        on = p_batch->on;
+        p_on = &on;
+    } else {
+        memcpy(p_peer->state.label, p_payload + 12, LIFX_LABEL_LENGTH);
+        p_peer->state.label[LIFX_LABEL_LENGTH] = '\0';
+        p_peer->state.label_us = p_view->received_us;
+    }
+    if (p_on != NULL) {
+        p_fleet->p_on[index] = *p_on;
+    }
+    if (p_color != NULL) {
+        p_fleet->p_colors[index] = *p_color;
+    }
+    cacheValues(p_peer, p_op->submitted_us, p_view->received_us, p_on, p_color);
+    if (p_op->retries == 0 && !p_batch->throttled) {
+        // Karn: only the first round has a single send time for all bulbs of the batch
+        countRtt(p_ctx, p_peer, p_view->received_us - p_op->sent_us);
+        updateRto(p_peer, p_view->received_us - p_op->sent_us);
+    }
+    settleBulb(p_batch, index, LIFX_OP_DONE);
+}
+
+/** confirms the responding bulb, the op is done once all bulbs of the batch confirmed */
+static void handleBatchResponse(lifx_ctx_t *p_ctx, lifx_op_t *p_op, const lx_packet_view_t *p_view) {
+    lx_batch_t *p_batch = p_op->p_sink;
+    long index = batchIndex(p_batch, targetFromHeader(p_view->p_header));
+    if (index < 0) {
+        COUNT(p_ctx, p_view->p_peer, unmatched, 1);
+        return;
+    }
+    if (p_batch->p_fleet->p_status[index] != LIFX_OP_PENDING) {
+        // response to a repeated request
+        return;
+    }
+    uint16_t type = p_view->p_header->type;
+    uint16_t min_size = type == MSG_TYPE_LIGHT_STATE ? 52 : type == MSG_TYPE_STATE_POWER ? 2 : 0;
+    if (p_view->payload_size < min_size) {
+        printf("response of type %d too short\n", type);
+        COUNT(p_ctx, p_view->p_peer, malformed, 1);
+        settleBulb(p_batch, (size_t)index, LIFX_OP_FAILED);
+    } else {
+        confirmBatchBulb(p_ctx, p_op, (size_t)index, p_view);
+    }
+    if (p_batch->pending_count == 0) {
+        completeOp(p_ctx, p_op, LIFX_OP_DONE);
+    }
+}
+
+/** 
+ * sends the request to the bulbs of the batch whose slot has come and, once the retransmission timer fired, again
+ * to the bulbs that did not confirm it yet. The deadline moves to the next slot or retransmission.
+ * @param first whether this is the first step of the batch, throttled bulbs are only counted once
+ */
+static void batchStep(lifx_ctx_t *p_ctx, lifx_op_t *p_op, int64_t now, bool first) {
+    lx_batch_t *p_batch = p_op->p_sink;
+    lifx_fleet_t *p_fleet = p_batch->p_fleet;
+    bool retransmit = p_batch->retransmit_us != 0 && now >= p_batch->retransmit_us;
+    if (retransmit) {
+        p_op->retries++;
+        p_op->rto_us = 2 * p_op->rto_us < MAX_RTO_US ? 2 * p_op->rto_us : MAX_RTO_US;
+    }
+    packet_config_t config = {
+        .payload_size = p_op->payload_size,
+        .p_payload = opPayload(p_op),
+        .tagged = 0,
+        .ack_required = p_op->ack_required,
+        .res_required = p_op->res_required,
+        .sequence = p_op->sequence,
+        .type = p_op->request_type,
+    };
+    bool awaiting = false;
+    int64_t wake_us = p_op->expires_us;
+    for (size_t i = p_batch->first; i < p_batch->first + p_batch->count; i++) {
+        uint8_t status = p_fleet->p_status[i];
+        if (status == LIFX_OP_PENDING && !retransmit) {
+            awaiting = true;
+            continue;
+        }
+        if (status != LIFX_OP_PENDING && status != LIFX_OP_IDLE) {
+            continue;
+        }
+        lx_peer_t *p_peer = &p_ctx->p_peers[p_fleet->p_peers[i]];
+        if (status == LIFX_OP_IDLE && p_ctx->send_interval_us > 0) {
+            int64_t slot_us = p_peer->next_send_us - p_ctx->send_burst_us;
+            if (slot_us > now) {
+                wake_us = slot_us < wake_us ? slot_us : wake_us;
+                p_batch->throttled = true;
+                if (first) {
+                    COUNT(p_ctx, p_peer, throttled, 1);
                 }
+                continue;
+            }
+            reserveSlot(p_ctx, p_peer, now);
+        } else if (status == LIFX_OP_PENDING) {
+            COUNT(p_ctx, p_peer, retries, 1);
+            if (p_peer->rto_us < p_op->rto_us) {
+                p_peer->rto_us = p_op->rto_us;
+            }
+        }
+        if (p_batch->type == LX_BATCH_SET_COLOR) {
+            encodeSetColor(opPayload(p_op), p_batch->p_colors[i - p_batch->first], p_batch->duration);
+        }
+        // a packet dropped by the full send queue is only sent again with the next retransmission
+        int res = queuePeerPacket(p_ctx, p_op, p_peer, p_fleet->p_addrs[i], p_fleet->p_ports[i], &config);
+        if (res < 0) {
+            if (p_op->status == LIFX_OP_PENDING) {
+                completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+            }
+            return;
+        }
+        if (p_op->response_type == 0) {
+            settleBulb(p_batch, i, res == 0 ? LIFX_OP_DONE : LIFX_OP_FAILED);
+        } else {
+            p_fleet->p_status[i] = LIFX_OP_PENDING;
+            awaiting = true;
+        }
+    }
+    if (p_batch->pending_count == 0) {
+        completeOp(p_ctx, p_op, LIFX_OP_DONE);
+        return;
+    }
+    if (!awaiting) {
+        p_batch->retransmit_us = 0;
+    } else if (retransmit || p_batch->retransmit_us == 0) {
+        p_batch->retransmit_us = now + p_op->rto_us;
+    }
+    if (awaiting && p_batch->retransmit_us < wake_us) {
+        wake_us = p_batch->retransmit_us;
+    }
+    p_op->deadline_us = wake_us;
+    heapSiftDown(p_ctx, p_op->heap_index);
+}
+
+/** gives up the bulbs of the batch that did not confirm */
+static void expireBatch(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    lx_batch_t *p_batch = p_op->p_sink;
+    lifx_fleet_t *p_fleet = p_batch->p_fleet;
+    for (size_t i = p_batch->first; i < p_batch->first + p_batch->count; i++) {
+        if (p_fleet->p_status[i] == LIFX_OP_PENDING || p_fleet->p_status[i] == LIFX_OP_IDLE) {
+            COUNT(p_ctx, &p_ctx->p_peers[p_fleet->p_peers[i]], timeouts, 1);
+            settleBulb(p_batch, i, LIFX_OP_TIMEOUT);
+        }
+    }
+    completeOp(p_ctx, p_op, LIFX_OP_TIMEOUT);
+}
+
+/** 
+ * whether the broadcast still waits for the confirmation of the bulb. Only then it gets an acknowledgement that 
+ * could also answer a request to the bulb with the same sequence, the bulb acknowledges both packets
+ */
+static bool awaitsConfirmation(const lifx_op_t *p_op, uint64_t target) {
+    if (p_op->kind == OP_KIND_BATCH) {
+        const lx_batch_t *p_batch = p_op->p_sink;
+        long index = batchIndex(p_batch, target);
+        return index >= 0 && p_batch->p_fleet->p_status[index] == LIFX_OP_PENDING;
+    }
+    if (p_op->kind != OP_KIND_BROADCAST) {
+        return true;
+    }
+    if (!expectsConfirmations(p_op)) {
+        return false;
+    }
+    const lifx_broadcast_t *p_broadcast = p_op->p_sink;
+    const bulb_service_t *p_bulb = lifx_registry_find_target(p_broadcast->p_expected, target);
+    return p_bulb != NULL && !p_broadcast->p_confirmed[p_bulb - p_broadcast->p_expected->p_bulbs];
+}
+
+/** matches a received packet to the in-flight request with the same (target, sequence) or to the broadcast with the same sequence */
+static void dispatchResponse(lifx_ctx_t *p_ctx, const lx_packet_view_t *p_view) {
+    const lx_protocol_header_t *p_header = p_view->p_header;
+    uint64_t target = targetFromHeader(p_header);
+    lifx_op_t *p_op = findInflight(p_ctx, target, p_header->sequence);
+    // responses to a broadcast carry the target of the responding bulb, whose own request might have the same sequence
+    lifx_op_t *p_tagged = p_ctx->pp_tagged[p_header->sequence];
+    if (p_tagged != NULL && p_tagged->response_type == p_header->type && 
+        (p_op == NULL || p_op->response_type != p_header->type || awaitsConfirmation(p_tagged, target))) {
+        p_op = p_tagged;
+    }
+    if (p_op == NULL) {
+        // late response to a request that was already given up
+        COUNT(p_ctx, p_view->p_peer, unmatched, 1);
+        return;
+    }
+
+    if (p_op->kind == OP_KIND_DISCOVERY) {
+        addDiscoveredBulb(p_op->p_sink, p_view);
+    } else if (p_op->kind == OP_KIND_SWEEP) {
+        lifx_sweep_t *p_sweep = p_op->p_sink;
+        if (addDiscoveredBulb(p_sweep->p_registry, p_view) > 0) {
+            p_sweep->bulbs_found++;
+        }
+    } else if (p_op->kind == OP_KIND_BROADCAST) {
+        handleBroadcastResponse(p_ctx, p_op, p_view);
+    } else if (p_op->kind == OP_KIND_BATCH) {
+        handleBatchResponse(p_ctx, p_op, p_view);
+    } else {
+        handleResponse(p_ctx, p_op, p_view);
+    }
+}
+
+/** sends throttled requests whose slot has come, retransmits requests whose retransmission timer fired and finishes all requests that expired */
+static void expireOps(lifx_ctx_t *p_ctx, int64_t now) {
+    while (p_ctx->heap_count > 0 && p_ctx->pp_heap[0]->deadline_us <= now) {
+        lifx_op_t *p_op = p_ctx->pp_heap[0];
+        if (p_op->parked && p_op->deadline_us < p_op->expires_us) {
+            // the throttled request got its slot
+            startOp(p_ctx, p_op, now);
+        } else if (p_op->kind == OP_KIND_SWEEP && p_op->deadline_us < p_op->expires_us) {
+            sweepStep(p_ctx, p_op, now);
+        } else if (p_op->kind == OP_KIND_BATCH) {
+            if (p_op->deadline_us < p_op->expires_us) {
+                batchStep(p_ctx, p_op, now, false);
             } else {
-                free(p_payload);
-                free(p_bulbs);
+                expireBatch(p_ctx, p_op);
             }
+        } else if (p_op->kind == OP_KIND_DISCOVERY || (p_op->kind == OP_KIND_BROADCAST && !expectsConfirmations(p_op))) {
+            // the collection window is over
+            completeOp(p_ctx, p_op, LIFX_OP_DONE);
+        } else if (p_op->deadline_us < p_op->expires_us) {
+            retransmitOp(p_ctx, p_op, now);
+        } else {
+            // reported by the status of the op & the timeouts counter, a line per request would flood large fleets
+            #ifdef DEBUG
+            printf("request for target %" PRIu64 " timed out\n", p_op->target);
+            #endif
+            COUNT(p_ctx, &p_ctx->p_peers[p_op->peer_index], timeouts, 1);
+            completeOp(p_ctx, p_op, LIFX_OP_TIMEOUT);
+        }
+    }
+}
+
+/** 
+ * calls the callbacks of the completed ops in the order they were completed. A callback may submit new requests,
+ * whose callbacks are called in the same pass if they complete right away
+ */
+static void runCallbacks(lifx_ctx_t *p_ctx) {
+    while (p_ctx->completed_head < p_ctx->completed_count) {
+        // taken off the queue before the call, a callback might wait for other requests & get here again
+        lifx_op_t *p_op = p_ctx->pp_completed[p_ctx->completed_head];
+        p_ctx->completed_head++;
+        p_op->p_callback(p_op, p_op->p_user);
+    }
+    p_ctx->completed_head = 0;
+    p_ctx->completed_count = 0;
+}
+
+/** fails all requests in flight, used when the socket becomes unusable */
+static void failAllOps(lifx_ctx_t *p_ctx) {
+    while (p_ctx->heap_count > 0) {
+        completeOp(p_ctx, p_ctx->pp_heap[0], LIFX_OP_FAILED);
+    }
+}
+
+int lifx_run_once(lifx_ctx_t *p_ctx) {
+    if (p_ctx->udp_socket < 0) {
+        printf("lifx_run_once - socket not open\n");
+        return -1;
+    }
+
+    // put queued requests on the wire, also when the socket became writable again
+    if (p_ctx->tx_count > 0 && flushPackets(p_ctx)) {
+        printf("sending queued packets failed\n");
+    }
+
+    // drain the socket
+    int count;
+    do {
+        size_t first = 0;
+        count = recvPackets(p_ctx, &first);
+        if (count < 0) {
+            failAllOps(p_ctx);
+            runCallbacks(p_ctx);
+            return -1;
+        }
+        int64_t received_us = count > 0 ? lx_clock_now_us() : 0;
+        for (int i = 0; i < count; i++) {
+            lx_packet_view_t view;
+            if (viewPacket(p_ctx, first + i, received_us, &view) == 0) {
+                dispatchResponse(p_ctx, &view);
+            }
+        }
+    } while (count == RX_BATCH);
+
+    int64_t now = lx_clock_now_us();
+    if (p_ctx->armed_deadline_us >= 0 && p_ctx->armed_deadline_us <= now) {
+        // acknowledge the timer, the number of expirations is irrelevant as the heap is checked anyways
+        uint64_t expirations;
+        if (read(p_ctx->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+            printf("reading deadline timer failed\n");
+        }
+        p_ctx->armed_deadline_us = -1;
+    }
+    expireOps(p_ctx, now);
+    runCallbacks(p_ctx);
+    // put retransmissions & requests submitted by callbacks on the wire right away
+    if (p_ctx->tx_count > 0 && flushPackets(p_ctx)) {
+        printf("sending retransmissions failed\n");
+    }
+    return armTimer(p_ctx);
+}
+
+int lifx_get_fd(lifx_ctx_t *p_ctx) {
+    return p_ctx->epoll_fd;
+}
+
+int lifx_process_events(lifx_ctx_t *p_ctx) {
+    return lifx_run_once(p_ctx);
+}
+
+int lifx_poll(lifx_ctx_t *p_ctx, int timeout_ms) {
+    if (p_ctx->epoll_fd < 0) {
+        printf("lifx_poll - library not initialized\n");
+        return -1;
+    }
+    // requests submitted since the last call might be queued and their deadline not armed yet
+    if (p_ctx->tx_count > 0 && flushPackets(p_ctx)) {
+        printf("sending queued packets failed\n");
+    }
+    if (armTimer(p_ctx)) {
+        return -1;
+    }
+    struct epoll_event events[2];
+    int res = epoll_wait(p_ctx->epoll_fd, events, 2, timeout_ms);
+    if (res < 0 && errno != EINTR) {
+        printf("waiting for events failed (err %d (%s))\n", errno, strerror(errno));
+        return -1;
+    }
+    return lifx_run_once(p_ctx);
+}
+
+int lifx_wait(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    // fire and forget requests are done already but might still be queued
+    if (p_ctx->tx_count > 0 && flushPackets(p_ctx)) {
+        printf("sending queued packets failed\n");
+    }
+    while (p_op->status == LIFX_OP_PENDING || p_ctx->tx_count > 0) {
+        if (lifx_poll(p_ctx, -1)) {
+            return -1;
         }
-        counter++;
     }
-
-    // NULL terminate
-    pp_bulbs[bulb_counter] = NULL;
-
+    return p_op->status == LIFX_OP_DONE || p_op->status == LIFX_OP_COALESCED || p_op->status == LIFX_OP_SUPPRESSED ? 0 : -1;
+}
+
+int lifx_wait_all(lifx_ctx_t *p_ctx) {
+    // the heap also contains throttled requests, which are not in flight yet
+    while (p_ctx->heap_count > 0 || p_ctx->tx_count > 0) {
+        if (lifx_poll(p_ctx, -1)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int lifx_cancel(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    if (p_op->status != LIFX_OP_PENDING) {
+        return -1;
+    }
+    completeOp(p_ctx, p_op, LIFX_OP_FAILED);
+    return 0;
+}
+
+/** waits for the op of a blocking function, which lives on its stack and is given up if waiting failed */
+static int waitBlocking(lifx_ctx_t *p_ctx, lifx_op_t *p_op) {
+    int res = lifx_wait(p_ctx, p_op);
+    if (res && p_op->status == LIFX_OP_PENDING) {
+        lifx_cancel(p_ctx, p_op);
+    }
+    return res;
+}
+
+int lifx_set_broadcast_addr(lifx_ctx_t *p_ctx, unsigned long in_addr, uint32_t port) {
+    p_ctx->broadcast_addr = in_addr;
+    p_ctx->broadcast_port = port;
+    return 0;
+}
+
+int lifx_set_rate_limit(lifx_ctx_t *p_ctx, uint32_t messages_per_second, uint32_t burst) {
+    if (messages_per_second == 0) {
+        p_ctx->send_interval_us = 0;
+        p_ctx->send_burst_us = 0;
+        return 0;
+    }
+    p_ctx->send_interval_us = 1000000 / messages_per_second;
+    p_ctx->send_burst_us = (int64_t)(burst > 1 ? burst - 1 : 0) * p_ctx->send_interval_us;
+    return 0;
+}
+
+int lifx_set_reliability(lifx_ctx_t *p_ctx, lifx_reliability_t reliability) {
+    if (reliability == LIFX_RELIABILITY_DEFAULT) {
+        reliability = LIFX_RELIABILITY_RESPONSE;
+    }
+    p_ctx->reliability = reliability;
+    return 0;
+}
+
+int lifx_set_write_suppression(lifx_ctx_t *p_ctx, uint32_t max_age_ms) {
+    p_ctx->suppress_age_us = (int64_t)max_age_ms * 1000;
+    return 0;
+}
+
+int lifx_submit_discover(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_registry_t *p_registry) {
+	
+ 	// UDP broadcast to port 56700
+    bulb_service_t broadcastBulb = {
+    	.in_addr = p_ctx->broadcast_addr,
+    	.target = (uint64_t)0, // send to all bulbs
+    	.service = 1,
+    	.port = p_ctx->broadcast_port,
+    };
+
+    packet_config_t config = {
+        .payload_size = 0,
+        .p_payload = NULL,
+        .tagged = 1,
+        .ack_required = 0,
+        .res_required = 0,
+        .type = MSG_TYPE_GET_SERVICE
+    };
+
+    p_op->p_sink = p_registry;
+    if (submitOp(p_ctx, p_op, &broadcastBulb, &config, MSG_TYPE_STATE_SERVICE, OP_KIND_DISCOVERY, DISCOVERY_TIMEOUT_US)) {
+    	printf("send discover bulb packet failed\n");
+    	return -1;
+    }
+    return 0;
+}
+
+int discoverBulbs(lifx_ctx_t *p_ctx, lifx_registry_t *p_registry) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE };
+    if (lifx_submit_discover(p_ctx, &op, p_registry)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
+        printf("receive discover bulb packet failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int lifx_submit_discover_sweep(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_sweep_t *p_sweep, lifx_registry_t *p_registry) {
+    uint64_t probes = 0;
+    for (size_t i = 0; i < p_sweep->range_count; i++) {
+        if (p_sweep->p_ranges[i].prefix_length > 32) {
+            printf("invalid prefix length %u\n", p_sweep->p_ranges[i].prefix_length);
+            p_op->p_heap_payload = NULL;
+            finishOp(p_ctx, p_op, LIFX_OP_FAILED);
+            return -1;
+        }
+        unsigned long first;
+        uint64_t count;
+        sweepHosts(&p_sweep->p_ranges[i], &first, &count);
+        probes += count;
+    }
+    p_sweep->probes_sent = 0;
+    p_sweep->broadcasts_sent = 0;
+    p_sweep->bulbs_found = 0;
+    p_sweep->p_registry = p_registry;
+    p_sweep->round = 0;
+    p_sweep->range = 0;
+    p_sweep->host = 0;
+
+    // the sweep finishes on its own, the timeout only guards against a sweep that cannot keep its pace
+    uint32_t rate = p_sweep->probes_per_ms > 0 ? p_sweep->probes_per_ms : SWEEP_PROBES_PER_MS;
+    int64_t round_us = (int64_t)(probes / rate + 1) * SWEEP_INTERVAL_US + 
+        (p_sweep->settle_ms > 0 ? (int64_t)p_sweep->settle_ms * 1000 : SWEEP_SETTLE_US);
+    int64_t timeout_us = 2 * (p_sweep->rounds > 0 ? p_sweep->rounds : SWEEP_ROUNDS) * round_us + REQUEST_TIMEOUT_US;
+
+    bulb_service_t sweepBulb = {
+        .in_addr = 0,
+        .target = 0,
+        .service = 1,
+        .port = p_sweep->port > 0 ? p_sweep->port : BROADCAST_PORT,
+    };
+    packet_config_t config = {
+        .payload_size = 0,
+        .p_payload = NULL,
+        .tagged = 1,
+        .ack_required = 0,
+        .res_required = 0,
+        .type = MSG_TYPE_GET_SERVICE
+    };
+    p_op->p_sink = p_sweep;
+    if (submitOp(p_ctx, p_op, &sweepBulb, &config, MSG_TYPE_STATE_SERVICE, OP_KIND_SWEEP, timeout_us)) {
+        printf("starting discovery sweep failed\n");
+        return -1;
+    }
     return 0;
 }
 
-int freeBulbs(bulb_service_t **pp_bulbs) {
-    int bulb_counter = 0;
-    while (pp_bulbs[bulb_counter] != NULL) {
-        free(pp_bulbs[bulb_counter]);
-        pp_bulbs[bulb_counter] = NULL;
+int lifx_discover_sweep(lifx_ctx_t *p_ctx, lifx_sweep_t *p_sweep, lifx_registry_t *p_registry) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE };
+    if (lifx_submit_discover_sweep(p_ctx, &op, p_sweep, p_registry)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
+        printf("discovery sweep failed\n");
+        return -1;
     }
     return 0;
 }
 
-int getPower(bulb_service_t *p_bulb, bool *p_on) {
+int lifx_submit_get_power(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb) {
     packet_config_t config = {
         .payload_size = 0,
         .p_payload = NULL,
@@ -430,160 +2319,362 @@ int getPower(bulb_service_t *p_bulb, bool *p_on) {
         .type = MSG_TYPE_GET_POWER
     };
 
-    if (sendPacket(p_bulb, &config)) {
+    if (readCachedState(p_ctx, p_op, p_bulb, false)) {
+        return 0;
+    }
+    if (submitOp(p_ctx, p_op, p_bulb, &config, MSG_TYPE_STATE_POWER, OP_KIND_UNICAST, REQUEST_TIMEOUT_US)) {
         printf("send getPower packet failed\n");
         return -1;
     }
+    return 0;
+}
 
-    lx_protocol_header_t res_header;
-    uint8_t *p_res_payload = NULL;
-    uint16_t res_payload_size;
-    if (recvPacketWithRetry(p_bulb, &res_header, &p_res_payload, &res_payload_size)) {
-        printf("receive getPower packet failed\n");
+int lifx_submit_set_power(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, bool on, uint32_t duration) {
+    uint8_t p_payload[SET_POWER_SIZE];
+    encodeSetPower(p_payload, on, duration);
+
+    packet_config_t config = {
+        .payload_size = sizeof(p_payload),
+        .p_payload = p_payload,
+        .tagged = 0, // destination bulb is specified in the bulb_service_t struct
+        .ack_required = 0,
+        .res_required = 1,
+        .type = MSG_TYPE_SET_POWER
+    };
+
+    if (suppressWrite(p_ctx, p_op, p_bulb, &on, NULL)) {
+        return 0;
+    }
+    if (submitSetOp(p_ctx, p_op, p_bulb, &config, MSG_TYPE_STATE_POWER)) {
+        printf("send setPower packet failed\n");
         return -1;
     }
+    return 0;
+}
+
+int lifx_submit_get_color(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb) {
+    packet_config_t config = {
+        .payload_size = 0,
+        .p_payload = NULL,
+        .tagged = 0, // destination bulb is specified in the bulb_service_t struct
+        .ack_required = 0,
+        .res_required = 1,
+        .type = MSG_TYPE_GET_LIGHT
+    };
 
-    if (res_header.type != MSG_TYPE_STATE_POWER) {
-        printf("wrong response type received: %d instead of %d\n", res_header.type, MSG_TYPE_STATE_POWER);
+    if (readCachedState(p_ctx, p_op, p_bulb, true)) {
+        return 0;
+    }
+    if (submitOp(p_ctx, p_op, p_bulb, &config, MSG_TYPE_LIGHT_STATE, OP_KIND_UNICAST, REQUEST_TIMEOUT_US)) {
+        printf("send getColor packet failed\n");
         return -1;
     }
+    return 0;
+}
+
+int lifx_submit_set_color(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, color_t color, uint32_t duration) {
+    uint8_t p_payload[SET_COLOR_SIZE];
+    encodeSetColor(p_payload, color, duration);
+
+    packet_config_t config = {
+        .payload_size = sizeof(p_payload),
+        .p_payload = p_payload,
+        .tagged = 0, // destination bulb is specified in the bulb_service_t struct
+        .ack_required = 0,
+        .res_required = 1,
+        .type = MSG_TYPE_SET_COLOR,
+    };
 
-    if (res_payload_size < 2) {
-        printf("getPower response too short\n");
+    if (suppressWrite(p_ctx, p_op, p_bulb, NULL, &color)) {
+        return 0;
+    }
+    if (submitSetOp(p_ctx, p_op, p_bulb, &config, MSG_TYPE_LIGHT_STATE)) {
+        printf("send setColor packet failed\n");
         return -1;
     }
+    return 0;
+}
 
-    uint16_t level = ((uint16_t)p_res_payload[0] << 0) + 
-                        ((uint16_t)p_res_payload[1] << 8);
+/** sends a set request to all bulbs with a single tagged packet, see `lifx_broadcast_t` */
+static int submitBroadcastOp(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_broadcast_t *p_broadcast, packet_config_t *p_config) {
+    bulb_service_t broadcast_bulb = {
+        .in_addr = p_broadcast->in_addr != 0 ? p_broadcast->in_addr : p_ctx->broadcast_addr,
+        .target = (uint64_t)0, // send to all bulbs
+        .service = 1,
+        .port = p_broadcast->in_addr != 0 ? p_broadcast->port : p_ctx->broadcast_port,
+    };
+    p_broadcast->confirmed_count = 0;
+    p_broadcast->unexpected_count = 0;
+    if (p_broadcast->p_expected != NULL && p_broadcast->p_expected->count > 0) {
+        memset(p_broadcast->p_confirmed, 0, p_broadcast->p_expected->count * sizeof(bool));
+    }
+    // every bulb might change, none of the cached values can be relied upon until its bulb confirmed
+    int64_t now = lx_clock_now_us();
+    for (size_t i = 0; i < p_ctx->peer_count; i++) {
+        invalidateState(&p_ctx->p_peers[i], p_config->type, now);
+    }
 
-    *p_on = level == 0 ? false : true;
+    p_op->p_sink = p_broadcast;
+    p_config->tagged = 1;
+    if (p_op->reliability == LIFX_RELIABILITY_NONE || (p_op->reliability == LIFX_RELIABILITY_DEFAULT && p_ctx->reliability == LIFX_RELIABILITY_NONE)) {
+        p_config->ack_required = 0;
+        p_config->res_required = 0;
+        return submitOp(p_ctx, p_op, &broadcast_bulb, p_config, 0, OP_KIND_FORGET, REQUEST_TIMEOUT_US);
+    }
+    // state responses would show the state before the change, acknowledgements are smaller
+    p_config->ack_required = 1;
+    p_config->res_required = 0;
+    return submitOp(p_ctx, p_op, &broadcast_bulb, p_config, MSG_TYPE_ACKNOWLEDGEMENT, OP_KIND_BROADCAST, REQUEST_TIMEOUT_US);
+}
 
-    free(p_res_payload);
-    p_res_payload = NULL;
+int lifx_submit_broadcast_set_power(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_broadcast_t *p_broadcast, bool on, uint32_t duration) {
+    uint8_t p_payload[SET_POWER_SIZE];
+    encodeSetPower(p_payload, on, duration);
+    packet_config_t config = {
+        .payload_size = sizeof(p_payload),
+        .p_payload = p_payload,
+        .type = MSG_TYPE_SET_POWER,
+    };
 
+    if (submitBroadcastOp(p_ctx, p_op, p_broadcast, &config)) {
+        printf("send broadcast setPower packet failed\n");
+        return -1;
+    }
     return 0;
 }
 
-int setPower(bulb_service_t *p_bulb, bool on, uint32_t duration) {
-    // create payload
-    uint8_t p_payload[6];
-    // put level
-    uint16_t level = on ? 65535 : 0;
-    p_payload[0] = (level >> 0) & 0xFF;
-    p_payload[1] = (level >> 8) & 0xFF;
-    // put duration
-    p_payload[2] = (duration >> 0) & 0xFF;
-    p_payload[3] = (duration >> 8) & 0xFF;
-    p_payload[4] = (duration >> 16) & 0xFF;
-    p_payload[5] = (duration >> 24) & 0xFF;
-
+int lifx_submit_broadcast_set_color(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_broadcast_t *p_broadcast, color_t color, uint32_t duration) {
+    uint8_t p_payload[SET_COLOR_SIZE];
+    encodeSetColor(p_payload, color, duration);
     packet_config_t config = {
         .payload_size = sizeof(p_payload),
         .p_payload = p_payload,
-        .tagged = 0, // destination bulb is specified in the bulb_service_t struct
-        .ack_required = 0,
-        .res_required = 1,
-        .type = MSG_TYPE_SET_POWER
+        .type = MSG_TYPE_SET_COLOR,
     };
 
-    if (sendPacket(p_bulb, &config)) {
-        printf("send setPower packet failed\n");
+    if (submitBroadcastOp(p_ctx, p_op, p_broadcast, &config)) {
+        printf("send broadcast setColor packet failed\n");
         return -1;
     }
+    return 0;
+}
+
+/** 
+ * answers a bulb of a batch from the state cache: reads whose values are fresh enough and, with write suppression, 
+ * set requests the bulb is known to be in already
+ * @returns true if the bulb was settled without a packet
+ */
+static bool settleCachedBulb(lifx_ctx_t *p_ctx, lx_batch_t *p_batch, lx_peer_t *p_peer, size_t index, int64_t now) {
+    lifx_fleet_t *p_fleet = p_batch->p_fleet;
+    const lifx_bulb_state_t *p_state = &p_peer->state;
+    int64_t oldest_us = now - p_ctx->suppress_age_us;
+    switch (p_batch->type) {
+        case LX_BATCH_GET_COLOR:
+            oldest_us = now - (int64_t)p_batch->max_age_ms * 1000;
+            if (p_batch->max_age_ms == 0 || !isFresh(p_state->power_us, oldest_us) || !isFresh(p_state->color_us, oldest_us)) {
+                return false;
+            }
+            p_fleet->p_colors[index] = p_state->color;
+            p_fleet->p_on[index] = p_state->on;
+            p_fleet->p_status[index] = LIFX_OP_DONE;
+            COUNT(p_ctx, p_peer, cache_hits, 1);
+            return true;
+        case LX_BATCH_SET_COLOR: {
+            const color_t *p_color = &p_batch->p_colors[index - p_batch->first];
+            if (p_ctx->suppress_age_us == 0 || !isFresh(p_state->color_us, oldest_us) || 
+                    memcmp(&p_state->color, p_color, sizeof(color_t)) != 0) {
+                return false;
+            }
+            p_fleet->p_colors[index] = *p_color;
+            break;
+        }
+        default:
+            if (p_ctx->suppress_age_us == 0 || !isFresh(p_state->power_us, oldest_us) || p_state->on != p_batch->on) {
+                return false;
+            }
+            p_fleet->p_on[index] = p_batch->on;
+            break;
+    }
+    p_fleet->p_status[index] = LIFX_OP_SUPPRESSED;
+    COUNT(p_ctx, p_peer, suppressed, 1);
+    return true;
+}
 
-    lx_protocol_header_t res_header;
-    uint8_t *p_res_payload = NULL;
-    uint16_t res_payload_size;
-    if (recvPacketWithRetry(p_bulb, &res_header, &p_res_payload, &res_payload_size)) {
-        printf("receive setPower packet failed\n");
+int lx_batch_submit(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lx_batch_t *p_batch) {
+    lifx_fleet_t *p_fleet = p_batch->p_fleet;
+    uint8_t p_payload[SET_COLOR_SIZE];
+    packet_config_t config = {
+        .payload_size = 0,
+        .p_payload = p_payload,
+        .type = MSG_TYPE_GET_LIGHT,
+    };
+    if (p_batch->type == LX_BATCH_SET_COLOR) {
+        // encoded per bulb when it is sent
+        config.payload_size = SET_COLOR_SIZE;
+        config.type = MSG_TYPE_SET_COLOR;
+        bzero(p_payload, sizeof(p_payload));
+    } else if (p_batch->type == LX_BATCH_SET_POWER) {
+        config.payload_size = SET_POWER_SIZE;
+        config.type = MSG_TYPE_SET_POWER;
+        encodeSetPower(p_payload, p_batch->on, p_batch->duration);
+    }
+
+    int64_t now = lx_clock_now_us();
+    int64_t rto_us = MIN_RTO_US;
+    p_batch->pending_count = 0;
+    p_batch->retransmit_us = 0;
+    p_batch->throttled = false;
+    for (size_t i = p_batch->first; i < p_batch->first + p_batch->count; i++) {
+        lx_peer_t *p_peer = hintedPeer(p_ctx, p_fleet->p_targets[i], &p_fleet->p_peers[i]);
+        if (p_peer == NULL) {
+            p_fleet->p_status[i] = LIFX_OP_FAILED;
+            continue;
+        }
+        if (settleCachedBulb(p_ctx, p_batch, p_peer, i, now)) {
+            continue;
+        }
+        invalidateState(p_peer, config.type, now);
+        for (size_t j = 0; isCoalescable(config.type) && j < PEER_PARKED; j++) {
+            lifx_op_t *p_parked = p_peer->pp_parked[j];
+            if (p_parked != NULL && p_parked->request_type == config.type) {
+                // the batch replaces the throttled request like a newer request of the same type does
+                completeOp(p_ctx, p_parked, LIFX_OP_COALESCED);
+                COUNT(p_ctx, p_peer, coalesced, 1);
+            }
+        }
+        p_fleet->p_status[i] = LIFX_OP_IDLE;
+        p_batch->pending_count++;
+        // one retransmission timer serves all bulbs, it must not fire before the slowest one answered
+        rto_us = p_peer->rto_us > rto_us ? p_peer->rto_us : rto_us;
+    }
+    if (p_batch->pending_count == 0) {
+        p_op->p_heap_payload = NULL;
+        finishOp(p_ctx, p_op, LIFX_OP_DONE);
+        return 0;
+    }
+
+    uint16_t response_type = MSG_TYPE_LIGHT_STATE;
+    lifx_reliability_t reliability = p_op->reliability != LIFX_RELIABILITY_DEFAULT ? p_op->reliability : p_ctx->reliability;
+    if (p_batch->type == LX_BATCH_GET_COLOR || reliability == LIFX_RELIABILITY_RESPONSE) {
+        config.res_required = 1;
+        response_type = p_batch->type == LX_BATCH_SET_POWER ? MSG_TYPE_STATE_POWER : MSG_TYPE_LIGHT_STATE;
+    } else if (reliability == LIFX_RELIABILITY_ACK) {
+        config.ack_required = 1;
+        response_type = MSG_TYPE_ACKNOWLEDGEMENT;
+    } else {
+        response_type = 0;
+    }
+    // tracked like a broadcast: the op gets a sequence no request to a single bulb uses while the batch is in flight
+    bulb_service_t batch_bulb = {
+        .target = (uint64_t)0,
+    };
+    p_op->p_sink = p_batch;
+    if (submitOp(p_ctx, p_op, &batch_bulb, &config, response_type, OP_KIND_BATCH, REQUEST_TIMEOUT_US)) {
+        printf("submitting batch failed\n");
         return -1;
     }
+    p_op->rto_us = rto_us;
+    batchStep(p_ctx, p_op, lx_clock_now_us(), true);
+    return p_op->status == LIFX_OP_FAILED ? -1 : 0;
+}
 
-    if (res_header.type != MSG_TYPE_STATE_POWER) {
-        printf("wrong response type received: %d instead of %d\n", res_header.type, MSG_TYPE_STATE_POWER);
+int lifx_submit_set_extended_color_zones(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, uint16_t zone_index, const color_t *p_colors, size_t count, uint32_t duration, lifx_zone_apply_t apply) {
+    if (count > EXTENDED_ZONES) {
+        printf("too many zones: %zu\n", count);
+        p_op->p_heap_payload = NULL;
+        finishOp(p_ctx, p_op, LIFX_OP_FAILED);
         return -1;
     }
+    // the message always carries EXTENDED_ZONES colors, the unused ones are zero
+    uint8_t p_payload[SET_EXTENDED_COLOR_ZONES_SIZE];
+    p_payload[0] = (duration >> 0) & 0xFF;
+    p_payload[1] = (duration >> 8) & 0xFF;
+    p_payload[2] = (duration >> 16) & 0xFF;
+    p_payload[3] = (duration >> 24) & 0xFF;
+    p_payload[4] = (uint8_t)apply;
+    p_payload[5] = (zone_index >> 0) & 0xFF;
+    p_payload[6] = (zone_index >> 8) & 0xFF;
+    p_payload[7] = (uint8_t)count;
+    encodeColors(p_payload + 8, p_colors, count);
+    memset(p_payload + 8 + count * HSBK_SIZE, 0, (EXTENDED_ZONES - count) * HSBK_SIZE);
 
-    free(p_res_payload);
-    p_res_payload = NULL;
+    packet_config_t config = {
+        .payload_size = sizeof(p_payload),
+        .p_payload = p_payload,
+        .tagged = 0, // destination bulb is specified in the bulb_service_t struct
+        .type = MSG_TYPE_SET_EXTENDED_COLOR_ZONES,
+    };
 
-	return 0;
+    if (submitSetOp(p_ctx, p_op, p_bulb, &config, MSG_TYPE_STATE_EXTENDED_COLOR_ZONES)) {
+        printf("send setExtendedColorZones packet failed\n");
+        return -1;
+    }
+    return 0;
 }
 
-/** @param p_label 32 byte string and 1 null character as terminator */
-int getColor(bulb_service_t *p_bulb, bool *p_on, color_t *p_color, char p_label[LIFX_LABEL_LENGTH + 1]) {
+int lifx_submit_get_extended_color_zones(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb) {
     packet_config_t config = {
         .payload_size = 0,
         .p_payload = NULL,
         .tagged = 0, // destination bulb is specified in the bulb_service_t struct
         .ack_required = 0,
         .res_required = 1,
-        .type = MSG_TYPE_GET_LIGHT
+        .type = MSG_TYPE_GET_EXTENDED_COLOR_ZONES,
     };
 
-    if (sendPacket(p_bulb, &config)) {
-        printf("send getColor packet failed\n");
+    p_op->color_count = 0;
+    if (submitOp(p_ctx, p_op, p_bulb, &config, MSG_TYPE_STATE_EXTENDED_COLOR_ZONES, OP_KIND_UNICAST, REQUEST_TIMEOUT_US)) {
+        printf("send getExtendedColorZones packet failed\n");
         return -1;
     }
+    return 0;
+}
 
-    lx_protocol_header_t res_header;
-    uint8_t *p_res_payload = NULL;
-    uint16_t res_payload_size;
-    if (recvPacketWithRetry(p_bulb, &res_header, &p_res_payload, &res_payload_size)) {
-        printf("receive getColor packet failed\n");
+int lifx_submit_set64(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, uint8_t tile_index, uint8_t x, uint8_t y, uint8_t width, const color_t *p_colors, size_t count, uint32_t duration) {
+    if (count > TILE_COLORS) {
+        printf("too many tile colors: %zu\n", count);
+        p_op->p_heap_payload = NULL;
+        finishOp(p_ctx, p_op, LIFX_OP_FAILED);
         return -1;
     }
+    // the message always carries TILE_COLORS colors, the unused ones are zero
+    uint8_t p_payload[SET_64_SIZE];
+    p_payload[0] = tile_index;
+    p_payload[1] = 1; // length: number of tiles starting at tile_index
+    p_payload[2] = 0; // reserved
+    p_payload[3] = x;
+    p_payload[4] = y;
+    p_payload[5] = width;
+    p_payload[6] = (duration >> 0) & 0xFF;
+    p_payload[7] = (duration >> 8) & 0xFF;
+    p_payload[8] = (duration >> 16) & 0xFF;
+    p_payload[9] = (duration >> 24) & 0xFF;
+    encodeColors(p_payload + 10, p_colors, count);
+    memset(p_payload + 10 + count * HSBK_SIZE, 0, (TILE_COLORS - count) * HSBK_SIZE);
 
-    if (res_header.type != MSG_TYPE_LIGHT_STATE) {
-        printf("wrong response type received: %d instead of %d\n", res_header.type, MSG_TYPE_LIGHT_STATE);
-        return -1;
-    }
+    packet_config_t config = {
+        .payload_size = sizeof(p_payload),
+        .p_payload = p_payload,
+        .tagged = 0, // destination bulb is specified in the bulb_service_t struct
+        .type = MSG_TYPE_SET_64,
+    };
 
-    if (res_payload_size < 52) {
-        printf("getColor response too short\n");
+    // tiles never answer Set64 with a state
+    if (submitSetOp(p_ctx, p_op, p_bulb, &config, 0)) {
+        printf("send set64 packet failed\n");
         return -1;
     }
-
-    p_color->hue =    ((uint16_t)p_res_payload[0] << 0) + 
-                    ((uint16_t)p_res_payload[1] << 8);
-    p_color->saturation = ((uint16_t)p_res_payload[2] << 0) + 
-                        ((uint16_t)p_res_payload[3] << 8);
-    p_color->brightness = ((uint16_t)p_res_payload[4] << 0) + 
-                        ((uint16_t)p_res_payload[5] << 8);
-    p_color->kelvin = ((uint16_t)p_res_payload[6] << 0) + 
-                    ((uint16_t)p_res_payload[7] << 8);
-
-    uint16_t power =    ((uint16_t)p_res_payload[10] << 0) + 
-                        ((uint16_t)p_res_payload[11] << 8);
-
-    p_label[LIFX_LABEL_LENGTH] = '\0'; // NULL terminator
-    memcpy(p_label, p_res_payload + 12, LIFX_LABEL_LENGTH);
-
-    *p_on = power == 0 ? false : true;
-
-    free(p_res_payload);
-    p_res_payload = NULL;
-
     return 0;
 }
 
-int setColor(bulb_service_t *p_bulb, color_t color, uint32_t duration) {
-    // create payload
-    uint8_t p_payload[13];
-    // put color
-    p_payload[1] = (color.hue >> 0) & 0xFF;
-    p_payload[2] = (color.hue >> 8) & 0xFF;
-    p_payload[3] = (color.saturation >> 0) & 0xFF;
-    p_payload[4] = (color.saturation >> 8) & 0xFF;
-    p_payload[5] = (color.brightness >> 0) & 0xFF;
-    p_payload[6] = (color.brightness >> 8) & 0xFF;
-    p_payload[7] = (color.kelvin >> 0) & 0xFF;
-    p_payload[8] = (color.kelvin >> 8) & 0xFF;
-    // put duration
-    p_payload[9] = (duration >> 0) & 0xFF;
-    p_payload[10] = (duration >> 8) & 0xFF;
-    p_payload[11] = (duration >> 16) & 0xFF;
-    p_payload[12] = (duration >> 24) & 0xFF;
+int lifx_submit_get64(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, uint8_t tile_index, uint8_t x, uint8_t y, uint8_t width) {
+    uint8_t p_payload[GET_64_SIZE];
+    p_payload[0] = tile_index;
+    p_payload[1] = 1; // length: number of tiles starting at tile_index
+    p_payload[2] = 0; // reserved
+    p_payload[3] = x;
+    p_payload[4] = y;
+    p_payload[5] = width;
 
     packet_config_t config = {
         .payload_size = sizeof(p_payload),
@@ -591,29 +2682,243 @@ int setColor(bulb_service_t *p_bulb, color_t color, uint32_t duration) {
         .tagged = 0, // destination bulb is specified in the bulb_service_t struct
         .ack_required = 0,
         .res_required = 1,
-        .type = MSG_TYPE_SET_COLOR,
+        .type = MSG_TYPE_GET_64,
     };
 
-    if (sendPacket(p_bulb, &config)) {
-        printf("send setColor packet failed\n");
+    p_op->color_count = 0;
+    if (submitOp(p_ctx, p_op, p_bulb, &config, MSG_TYPE_STATE_64, OP_KIND_UNICAST, REQUEST_TIMEOUT_US)) {
+        printf("send get64 packet failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int lifx_set_color_many(lifx_ctx_t *p_ctx, bulb_service_t **pp_bulbs, const color_t *p_colors, size_t n, uint32_t duration) {
+    lifx_op_t *p_ops = calloc(n, sizeof(lifx_op_t));
+    if (n > 0 && p_ops == NULL) {
+        printf("allocating requests failed\n");
+        return -1;
+    }
+
+    // all packets are encoded into the send queue and leave in batches of up to TX_BATCH
+    for (size_t i = 0; i < n; i++) {
+        if (lifx_submit_set_color(p_ctx, &p_ops[i], pp_bulbs[i], p_colors[i], duration)) {
+            // the op is completed with LIFX_OP_FAILED, it is counted with the other results below
+            printf("submitting request %zu of %zu failed\n", i, n);
+        }
+    }
+
+    int failed = 0;
+    int res = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (lifx_wait(p_ctx, &p_ops[i]) == 0) {
+            continue;
+        }
+        if (p_ops[i].status == LIFX_OP_PENDING) {
+            // the ops are freed below, the context must not reference them anymore
+            printf("waiting for the requests failed\n");
+            for (size_t j = i; j < n; j++) {
+                lifx_cancel(p_ctx, &p_ops[j]);
+            }
+            res = -1;
+            break;
+        }
+        failed++;
+    }
+    free(p_ops);
+    return res < 0 ? -1 : failed;
+}
+
+int getPower(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, bool *p_on) {
+    return lifx_get_power(p_ctx, p_bulb, 0, p_on);
+}
+
+int lifx_get_power(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint32_t max_age_ms, bool *p_on) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE, .max_age_ms = max_age_ms };
+    if (lifx_submit_get_power(p_ctx, &op, p_bulb)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
+        printf("receive getPower packet failed\n");
+        return -1;
+    }
+    *p_on = op.on;
+    return 0;
+}
+
+int setPower(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, bool on, uint32_t duration) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE };
+    if (lifx_submit_set_power(p_ctx, &op, p_bulb, on, duration)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
+        printf("receive setPower packet failed\n");
+        return -1;
+    }
+	return 0;
+}
+
+/** @param p_label 32 byte string and 1 null character as terminator */
+int getColor(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, bool *p_on, color_t *p_color, char p_label[LIFX_LABEL_LENGTH + 1]) {
+    return lifx_get_color(p_ctx, p_bulb, 0, p_on, p_color, p_label);
+}
+
+/** @param p_label 32 byte string and 1 null character as terminator */
+int lifx_get_color(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint32_t max_age_ms, bool *p_on, color_t *p_color, char p_label[LIFX_LABEL_LENGTH + 1]) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE, .max_age_ms = max_age_ms };
+    if (lifx_submit_get_color(p_ctx, &op, p_bulb)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
+        printf("receive getColor packet failed\n");
         return -1;
     }
-    
-    lx_protocol_header_t res_header;
-    uint8_t *p_res_payload = NULL;
-    uint16_t res_payload_size;
-    if (recvPacketWithRetry(p_bulb, &res_header, &p_res_payload, &res_payload_size)) {
+    *p_on = op.on;
+    *p_color = op.color;
+    memcpy(p_label, op.label, LIFX_LABEL_LENGTH + 1);
+    return 0;
+}
+
+int setColor(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, color_t color, uint32_t duration) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE };
+    if (lifx_submit_set_color(p_ctx, &op, p_bulb, color, duration)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
         printf("receive setColor packet failed\n");
         return -1;
     }
+    return 0;
+}
+
+int setExtendedColorZones(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint16_t zone_index, const color_t *p_colors, size_t count, uint32_t duration) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE };
+    if (lifx_submit_set_extended_color_zones(p_ctx, &op, p_bulb, zone_index, p_colors, count, duration, LIFX_ZONE_APPLY)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
+        printf("receive setExtendedColorZones packet failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int getExtendedColorZones(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, color_t *p_colors, size_t capacity, size_t *p_count, uint16_t *p_zone_count) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE, .p_colors = p_colors, .color_capacity = capacity };
+    if (lifx_submit_get_extended_color_zones(p_ctx, &op, p_bulb)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
+        printf("receive getExtendedColorZones packet failed\n");
+        return -1;
+    }
+    *p_count = op.color_count;
+    *p_zone_count = op.zone_count;
+    return 0;
+}
+
+int set64(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint8_t tile_index, uint8_t x, uint8_t y, uint8_t width, const color_t *p_colors, size_t count, uint32_t duration) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE };
+    if (lifx_submit_set64(p_ctx, &op, p_bulb, tile_index, x, y, width, p_colors, count, duration)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
+        printf("receive set64 packet failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int get64(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint8_t tile_index, uint8_t x, uint8_t y, uint8_t width, color_t *p_colors, size_t capacity, size_t *p_count) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE, .p_colors = p_colors, .color_capacity = capacity };
+    if (lifx_submit_get64(p_ctx, &op, p_bulb, tile_index, x, y, width)) {
+        return -1;
+    }
+    if (waitBlocking(p_ctx, &op)) {
+        printf("receive get64 packet failed\n");
+        return -1;
+    }
+    *p_count = op.color_count;
+    return 0;
+}
+
+/** @returns the number of expected bulbs that did not confirm the broadcast */
+static int waitBroadcast(lifx_ctx_t *p_ctx, lifx_op_t *p_op, const lifx_broadcast_t *p_broadcast) {
+    int res = waitBlocking(p_ctx, p_op);
+    if (p_op->status != LIFX_OP_DONE && p_op->status != LIFX_OP_TIMEOUT) {
+        return res;
+    }
+    size_t expected = p_broadcast->p_expected != NULL ? p_broadcast->p_expected->count : 0;
+    // fire and forget broadcasts do not collect any confirmations
+    return p_op->kind == OP_KIND_FORGET ? 0 : (int)(expected - p_broadcast->confirmed_count);
+}
+
+int lifx_broadcast_set_power(lifx_ctx_t *p_ctx, lifx_broadcast_t *p_broadcast, bool on, uint32_t duration) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE };
+    if (lifx_submit_broadcast_set_power(p_ctx, &op, p_broadcast, on, duration)) {
+        return -1;
+    }
+    return waitBroadcast(p_ctx, &op, p_broadcast);
+}
+
+int lifx_broadcast_set_color(lifx_ctx_t *p_ctx, lifx_broadcast_t *p_broadcast, color_t color, uint32_t duration) {
+    lifx_op_t op = { .status = LIFX_OP_IDLE };
+    if (lifx_submit_broadcast_set_color(p_ctx, &op, p_broadcast, color, duration)) {
+        return -1;
+    }
+    return waitBroadcast(p_ctx, &op, p_broadcast);
+}
+
+int lifx_get_stats(lifx_ctx_t *p_ctx, lifx_stats_t *p_stats) {
+    copyStats(&p_ctx->stats, p_stats);
+    return 0;
+}
+
+int lifx_get_bulb_stats(lifx_ctx_t *p_ctx, uint64_t target, lifx_stats_t *p_stats) {
+    long index = lx_hashindex_find(&p_ctx->peer_index, target);
+    if (index < 0) {
+        return -1;
+    }
+    copyStats(&p_ctx->p_peers[index].stats, p_stats);
+    return 0;
+}
 
-    if (res_header.type != MSG_TYPE_LIGHT_STATE) {
-        printf("wrong response type received: %d instead of %d\n", res_header.type, MSG_TYPE_LIGHT_STATE);
+int lifx_get_bulb_state(lifx_ctx_t *p_ctx, uint64_t target, lifx_bulb_state_t *p_state) {
+    long index = lx_hashindex_find(&p_ctx->peer_index, target);
+    if (index < 0) {
         return -1;
     }
+    *p_state = p_ctx->p_peers[index].state;
+    return 0;
+}
 
-    free(p_res_payload);
-    p_res_payload = NULL;
-    
+int lifx_reset_stats(lifx_ctx_t *p_ctx) {
+    bzero(&p_ctx->stats, sizeof(p_ctx->stats));
+    for (size_t i = 0; i < p_ctx->peer_count; i++) {
+        bzero(&p_ctx->p_peers[i].stats, sizeof(p_ctx->p_peers[i].stats));
+    }
     return 0;
 }
+
+uint64_t lifx_stats_rtt_percentile_us(const lifx_stats_t *p_stats, double p) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < LIFX_RTT_BUCKETS; i++) {
+        count += p_stats->rtt_histogram[i];
+    }
+    if (count == 0) {
+        return 0;
+    }
+    // nearest rank of the sample
+    uint64_t rank = (uint64_t)(p * (double)count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LIFX_RTT_BUCKETS; i++) {
+        seen += p_stats->rtt_histogram[i];
+        if (seen >= rank) {
+            return (uint64_t)1 << (i + 1);
+        }
+    }
+    return (uint64_t)1 << LIFX_RTT_BUCKETS;
+}
@@ -7,43 +7,439 @@
 #define LIFX_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "bulb.h"
 #include "color.h"
+#include "registry.h"
+#include "stats.h"
 
 #define LIFX_LABEL_LENGTH (32) // does not include NULL char at the end
+/** largest request payload a `lifx_op_t` keeps inline for retransmissions, larger ones are allocated */
+#define LIFX_OP_PAYLOAD_SIZE (16)
+/** maximal number of zones set or read with a single extended multizone message */
+#define LIFX_EXTENDED_ZONES (82)
+/** number of colors of a tile (8x8), set or read with a single message */
+#define LIFX_TILE_COLORS (64)
 
 
-/** opens a UDP socket and initializes it. In addition, a random source_id gets generated */
-int init_lifx_lib(void);
+/** 
+ * Library context owning a socket, its buffers, a source id and all requests in flight.
+ * Contexts are independent of each other: each thread can drive its own context without any locking, 
+ * but a single context must not be used by several threads at the same time.
+ */
+typedef struct lifx_ctx lifx_ctx_t;
+
+
+typedef enum {
+    /** not submitted yet */
+    LIFX_OP_IDLE = 0,
+    /** sent and waiting for its response */
+    LIFX_OP_PENDING,
+    /** response received and decoded */
+    LIFX_OP_DONE,
+    /** sending failed or an unexpected response was received */
+    LIFX_OP_FAILED,
+    /** no response arrived in time */
+    LIFX_OP_TIMEOUT,
+    /** set request replaced by a newer one of the same type while its bulb was throttled, it was never sent */
+    LIFX_OP_COALESCED,
+    /** set request not sent because the bulb is known to be in the requested state already */
+    LIFX_OP_SUPPRESSED,
+} lifx_op_status_t;
+
+/** what a set request waits for before it is completed */
+typedef enum {
+    /** use the reliability of the context */
+    LIFX_RELIABILITY_DEFAULT = 0,
+    /** wait for the full state message (StatePower / LightState), the default of a context */
+    LIFX_RELIABILITY_RESPONSE,
+    /** wait for the small Acknowledgement message only */
+    LIFX_RELIABILITY_ACK,
+    /** fire and forget: the request is completed once its packet is queued (throttled ones after their slot), it is never retransmitted */
+    LIFX_RELIABILITY_NONE,
+} lifx_reliability_t;
+
+/** how a multizone strip applies the colors of a SetExtendedColorZones message */
+typedef enum {
+    /** store the colors, they are shown with the next message that applies */
+    LIFX_ZONE_NO_APPLY = 0,
+    /** store & show the colors together with all stored ones */
+    LIFX_ZONE_APPLY,
+    /** show the stored colors, the colors of the message are ignored */
+    LIFX_ZONE_APPLY_ONLY,
+} lifx_zone_apply_t;
+
+/** 
+ * Set request sent to all bulbs of a network with a single tagged packet, every bulb acknowledges it.
+ * The packet is broadcast again until all expected bulbs confirmed it or the op times out.
+ */
+typedef struct {
+    /** input: destination, e.g. a subnet-directed broadcast addr, 0 uses the broadcast addr & port of the context */
+    unsigned long in_addr;
+    uint32_t port;
+    /** 
+     * input: bulbs expected to confirm, the op is done as soon as all of them did. 
+     * Without expected bulbs, the packet is sent once and confirmations are counted until the op times out
+     */
+    const lifx_registry_t *p_expected;
+    /** output: one flag per bulb of `p_expected` in the order of its `p_bulbs`, set once the bulb confirmed */
+    bool *p_confirmed;
+    size_t confirmed_count;
+    /** output: confirmations of bulbs that are not expected */
+    size_t unexpected_count;
+} lifx_broadcast_t;
+
+/** range of IPv4 addrs, e.g. 192.168.4.0/22 */
+typedef struct {
+    unsigned long in_addr;
+    uint8_t prefix_length;
+} lifx_cidr_t;
+
+/** 
+ * Discovery that does not depend on the limited broadcast reaching all bulbs: every addr of the ranges gets a 
+ * unicast GetService, paced to `probes_per_ms`, and the listed interfaces get one on their subnet-directed 
+ * broadcast addr. Responses are collected while the probes are still being sent. 
+ * Later rounds only probe addrs without a known bulb, to find bulbs whose response got lost.
+ */
+typedef struct {
+    /** input: ranges to probe, the network & broadcast addr of ranges up to /30 are skipped */
+    const lifx_cidr_t *p_ranges;
+    size_t range_count;
+    /** input: names of the interfaces to broadcast on, e.g. "eth0" */
+    const char *const *pp_interfaces;
+    size_t interface_count;
+    /** input: port probes & broadcasts are sent to, 0 uses 56700 */
+    uint32_t port;
+    /** input: number of probes sent per millisecond, 0 uses 64 */
+    uint32_t probes_per_ms;
+    /** input: number of rounds, 0 uses 2 */
+    uint32_t rounds;
+    /** input: time in milliseconds responses are collected after the last probe of a round, 0 uses 200 */
+    uint32_t settle_ms;
+    /** output: packets sent & bulbs added to the registry */
+    size_t probes_sent;
+    size_t broadcasts_sent;
+    size_t bulbs_found;
 
-/** closes the UDP socket, which was opened in `init_lifx_lib` */
-int close_lifx_lib(void);
+    /* bookkeeping of the library, do not modify */
+    lifx_registry_t *p_registry;
+    uint32_t round;
+    size_t range;
+    uint64_t host;
+} lifx_sweep_t;
 
+/** last state of a bulb the library knows from confirmed requests */
+typedef struct {
+    bool on;
+    color_t color;
+    char label[LIFX_LABEL_LENGTH + 1];
+    /** CLOCK_MONOTONIC time in microseconds each value was confirmed, 0 if it is unknown */
+    int64_t power_us;
+    int64_t color_us;
+    int64_t label_us;
+} lifx_bulb_state_t;
+
+struct lifx_op;
+
+/** called once a request is completed, `p_op` holds the final status & the decoded response */
+typedef void (*lifx_callback_t)(struct lifx_op *p_op, void *p_user);
+
+/**
+ * A single asynchronous request. The struct is owned by the caller and has to stay valid
+ * while the request is in the `LIFX_OP_PENDING` state.
+ */
+typedef struct lifx_op {
+    lifx_op_status_t status;
+    /** 
+     * input: time in milliseconds after which the request is given up, including all retransmissions. 
+     * 0 uses the default of 2.5 seconds
+     */
+    uint32_t timeout_ms;
+    /** input: reliability of set requests, ignored by get requests which always need the response */
+    lifx_reliability_t reliability;
+    /** 
+     * input of power & color reads: a cached state confirmed at most this many milliseconds ago is returned 
+     * without a packet, the op is `LIFX_OP_DONE` right away. 0 always asks the bulb
+     */
+    uint32_t max_age_ms;
+    /** 
+     * input: called once the request is completed, including requests that fail or complete right away when they
+     * are submitted. Callbacks are only called from `lifx_process_events` (and `lifx_poll` & `lifx_wait`), never from
+     * a submit function. The op must stay valid & must not be submitted again before its callback was called. NULL if unused
+     */
+    lifx_callback_t p_callback;
+    void *p_user;
+    /** decoded response: on/off state (StatePower & LightState) */
+    bool on;
+    /** decoded response: color (LightState) */
+    color_t color;
+    /** decoded response: label (LightState) */
+    char label[LIFX_LABEL_LENGTH + 1];
+    /** input of zone & tile reads: buffer the colors are decoded into & its capacity */
+    color_t *p_colors;
+    size_t color_capacity;
+    /** decoded response: number of colors written to `p_colors` (StateExtendedColorZones & State64) */
+    size_t color_count;
+    /** decoded response: number of zones of the strip & index of the first decoded zone (StateExtendedColorZones) */
+    uint16_t zone_count;
+    uint16_t zone_index;
+
+    /* bookkeeping of the library, do not modify */
+    uint64_t target;
+    uint16_t response_type;
+    uint8_t sequence;
+    uint8_t kind;
+    /** next retransmission, the slot of a throttled request or, for the last attempt, `expires_us` */
+    int64_t deadline_us;
+    /** time the request is given up */
+    int64_t expires_us;
+    /** current retransmission timeout, doubled with every retransmission */
+    int64_t rto_us;
+    uint8_t retries;
+    /** throttled by the rate limit, waiting for its slot in the deadline heap */
+    bool parked;
+    /** request as it gets retransmitted */
+    bulb_service_t bulb;
+    uint16_t request_type;
+    uint8_t ack_required;
+    uint8_t res_required;
+    uint16_t payload_size;
+    uint8_t p_payload[LIFX_OP_PAYLOAD_SIZE];
+    /** payloads larger than `LIFX_OP_PAYLOAD_SIZE`, freed once the op is completed */
+    uint8_t *p_heap_payload;
+    /** time the request was submitted & the packet was last handed to the kernel */
+    int64_t submitted_us;
+    int64_t sent_us;
+    size_t heap_index;
+    uint32_t peer_index;
+    void *p_sink;
+    struct lifx_op *p_next;
+} lifx_op_t;
+
+
+/** allocates a context, opens its UDP socket and initializes it. In addition, a random source_id gets generated */
+int init_lifx_lib(lifx_ctx_t **pp_ctx);
+
+/** 
+ * Like `init_lifx_lib`, but on a socket opened by the caller, e.g. one bound to a certain port or interface.
+ * The socket has to be a non-blocking IPv4 UDP socket, the context takes it over and closes it, also on error
+ */
+int lifx_init_with_socket(lifx_ctx_t **pp_ctx, int udp_socket);
+
+/** closes the UDP socket, which was opened in `init_lifx_lib`, and frees the context */
+int close_lifx_lib(lifx_ctx_t *p_ctx);
+
+
+/** 
+ * Sets the address discovery broadcasts are sent to (255.255.255.255:56700 by default), 
+ * e.g. a subnet-directed broadcast or a simulator on the loopback interface
+ * @param in_addr IP addr in host byte order
+ */
+int lifx_set_broadcast_addr(lifx_ctx_t *p_ctx, unsigned long in_addr, uint32_t port);
+
+/** 
+ * Limits the number of requests per second sent to each bulb, 0 removes the limit (default).
+ * LIFX recommends at most 20 messages per second. While a bulb is throttled, requests wait for their slot 
+ * and a newer SetColor or SetPower replaces a waiting one of the same type, which then completes as `LIFX_OP_COALESCED`.
+ * Retransmissions & broadcasts are not limited.
+ * @param burst number of requests that may be sent back to back before the limit applies
+ */
+int lifx_set_rate_limit(lifx_ctx_t *p_ctx, uint32_t messages_per_second, uint32_t burst);
+
+/** Sets the reliability of set requests which do not specify one, `LIFX_RELIABILITY_RESPONSE` by default */
+int lifx_set_reliability(lifx_ctx_t *p_ctx, lifx_reliability_t reliability);
+
+/** 
+ * Skips SetPower & SetColor requests that would not change anything: if the cached state of the bulb 
+ * (see `lifx_get_bulb_state`) was confirmed at most `max_age_ms` ago and equals the requested one, the request
+ * completes as `LIFX_OP_SUPPRESSED` without a packet. 0 disables the suppression (default).
+ * Changes made by other clients within `max_age_ms` are not noticed.
+ */
+int lifx_set_write_suppression(lifx_ctx_t *p_ctx, uint32_t max_age_ms);
 
 /** 
  * Discovers LIFX bulbs in the local network
- * @param ppp_bulbs pointer to a NULL terminated array of pointers to bulb structs, `freeBulbs` has to be called when the array is no longer needed 
+ * @param p_registry initialized registry, responding bulbs are added or updated
  */
-int discoverBulbs(bulb_service_t ***ppp_bulbs);
+int discoverBulbs(lifx_ctx_t *p_ctx, lifx_registry_t *p_registry);
 
-/** Frees the NULL terminated array as well as the bulbs in the array */
-int freeBulbs(bulb_service_t **pp_bulbs);
+/** 
+ * Asynchronous `discoverBulbs`, e.g. to refresh bulbs loaded with `lifx_registry_load` while they are used already:
+ * new bulbs are added and bulbs with a new IP addr are updated as the responses arrive. The op is `LIFX_OP_DONE`
+ * once the responses were collected. Bulbs may be added at any `lifx_poll`, which invalidates pointers into the registry
+ */
+int lifx_submit_discover(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_registry_t *p_registry);
+
+/** 
+ * Sweeps the ranges & interfaces of `p_sweep` (see `lifx_sweep_t`), responding bulbs are added to or updated in
+ * the registry like with `lifx_submit_discover`. The op is `LIFX_OP_DONE` after the last round, `p_sweep` has to
+ * stay valid until then
+ */
+int lifx_submit_discover_sweep(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_sweep_t *p_sweep, lifx_registry_t *p_registry);
+
+/** blocking variant of `lifx_submit_discover_sweep` */
+int lifx_discover_sweep(lifx_ctx_t *p_ctx, lifx_sweep_t *p_sweep, lifx_registry_t *p_registry);
 
 
 /** Retrieves the on/off state of a bulb */
-int getPower(bulb_service_t *p_bulb, bool *p_on);
+int getPower(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, bool *p_on);
+
+/** Like `getPower`, but answers from the state cache if the power of the bulb was confirmed at most `max_age_ms` ago */
+int lifx_get_power(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint32_t max_age_ms, bool *p_on);
 
-/** Sets the on/off state of a bulb with a duration in milliseconds to transition to the new state */
-int setPower(bulb_service_t *p_bulb, bool on, uint32_t duration);
+/** 
+ * Sets the on/off state of a bulb with a duration in milliseconds to transition to the new state.
+ * Waits according to the reliability of the context.
+ */
+int setPower(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, bool on, uint32_t duration);
 
 
 /** 
  * Retrives the currently set color, the on/off state as well as the bulb's label
  * @param p_label 32 byte string and 1 null character as terminator
  */
-int getColor(bulb_service_t *p_bulb, bool *p_on, color_t *p_color, char p_label[LIFX_LABEL_LENGTH + 1]);
+int getColor(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, bool *p_on, color_t *p_color, char p_label[LIFX_LABEL_LENGTH + 1]);
+
+/** Like `getColor`, but answers from the state cache if power, color & label were confirmed at most `max_age_ms` ago */
+int lifx_get_color(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint32_t max_age_ms, bool *p_on, color_t *p_color, char p_label[LIFX_LABEL_LENGTH + 1]);
+
+/** 
+ * Sets the color of a bulb with a duration in milliseconds to transition to the new color.
+ * Waits according to the reliability of the context.
+ */
+int setColor(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, color_t color, uint32_t duration);
+
+
+/** 
+ * Sets up to `LIFX_EXTENDED_ZONES` zones of a multizone strip starting at `zone_index` with a single packet
+ * and applies them with a duration in milliseconds
+ */
+int setExtendedColorZones(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint16_t zone_index, const color_t *p_colors, size_t count, uint32_t duration);
+
+/** 
+ * Retrieves the zones of a multizone strip with a single packet. 
+ * Strips with more than `LIFX_EXTENDED_ZONES` zones answer with several messages, of which the first one is decoded.
+ * @param p_count set to the number of colors written to `p_colors`
+ * @param p_zone_count set to the number of zones of the strip
+ */
+int getExtendedColorZones(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, color_t *p_colors, size_t capacity, size_t *p_count, uint16_t *p_zone_count);
+
+/** 
+ * Sets up to `LIFX_TILE_COLORS` colors of a tile with a single packet, filling a rectangle of `width` columns 
+ * starting at (x, y) row by row
+ */
+int set64(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint8_t tile_index, uint8_t x, uint8_t y, uint8_t width, const color_t *p_colors, size_t count, uint32_t duration);
+
+/** 
+ * Retrieves up to `LIFX_TILE_COLORS` colors of a tile from a rectangle of `width` columns starting at (x, y)
+ * @param p_count set to the number of colors written to `p_colors`
+ */
+int get64(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, uint8_t tile_index, uint8_t x, uint8_t y, uint8_t width, color_t *p_colors, size_t capacity, size_t *p_count);
+
+
+/** 
+ * Asynchronous variants of the functions above: they put the request on the wire and return immediately. 
+ * The request is matched to its response by (source, sequence, target), so any number of requests 
+ * can be in flight at the same time. The result is available in `p_op` once `lifx_wait` returns.
+ */
+int lifx_submit_get_power(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb);
+int lifx_submit_set_power(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, bool on, uint32_t duration);
+int lifx_submit_get_color(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb);
+int lifx_submit_set_color(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, color_t color, uint32_t duration);
+int lifx_submit_set_extended_color_zones(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, uint16_t zone_index, const color_t *p_colors, size_t count, uint32_t duration, lifx_zone_apply_t apply);
+/** decodes into `p_op->p_colors`, which has to be set before */
+int lifx_submit_get_extended_color_zones(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb);
+/** tiles do not answer Set64 with a state message, `LIFX_RELIABILITY_RESPONSE` waits for an acknowledgement instead */
+int lifx_submit_set64(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, uint8_t tile_index, uint8_t x, uint8_t y, uint8_t width, const color_t *p_colors, size_t count, uint32_t duration);
+/** decodes into `p_op->p_colors`, which has to be set before */
+int lifx_submit_get64(lifx_ctx_t *p_ctx, lifx_op_t *p_op, bulb_service_t *p_bulb, uint8_t tile_index, uint8_t x, uint8_t y, uint8_t width);
+
+/** 
+ * Sets the power or color of all bulbs reached by a broadcast with a single packet. Bulbs that did not confirm 
+ * the request after its retransmission timeout get it broadcast again, which restarts the transition on the others.
+ * The op is `LIFX_OP_DONE` once all expected bulbs confirmed, otherwise it times out. 
+ * `LIFX_RELIABILITY_NONE` sends the packet once without waiting for confirmations.
+ */
+int lifx_submit_broadcast_set_power(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_broadcast_t *p_broadcast, bool on, uint32_t duration);
+int lifx_submit_broadcast_set_color(lifx_ctx_t *p_ctx, lifx_op_t *p_op, lifx_broadcast_t *p_broadcast, color_t color, uint32_t duration);
+
+/** 
+ * Blocking variants of the broadcast set requests
+ * @returns the number of expected bulbs that did not confirm the request, -1 on error
+ */
+int lifx_broadcast_set_power(lifx_ctx_t *p_ctx, lifx_broadcast_t *p_broadcast, bool on, uint32_t duration);
+int lifx_broadcast_set_color(lifx_ctx_t *p_ctx, lifx_broadcast_t *p_broadcast, color_t color, uint32_t duration);
+
+/** 
+ * Sets the color of `n` bulbs at once: all packets are encoded into one buffer and sent with as few
+ * sendmmsg calls as possible, the responses are drained with recvmmsg.
+ * @param p_colors color for each bulb in `pp_bulbs`
+ * @returns the number of bulbs that did not confirm the new color, -1 on error
+ */
+int lifx_set_color_many(lifx_ctx_t *p_ctx, bulb_service_t **pp_bulbs, const color_t *p_colors, size_t n, uint32_t duration);
+
+/** 
+ * Processes all pending responses and expired deadlines without blocking.
+ * Waiting is driven by epoll: the socket is non-blocking and a timerfd fires at the earliest deadline.
+ */
+int lifx_run_once(lifx_ctx_t *p_ctx);
+
+/** 
+ * @returns fd to integrate the context into an external event loop (epoll, libuv, asio, ...): it becomes readable
+ * when responses arrived, a deadline passed or the socket took no more packets & is writable again,
+ * `lifx_process_events` has to be called then
+ */
+int lifx_get_fd(lifx_ctx_t *p_ctx);
+
+/** 
+ * Sends queued requests, processes responses & deadlines and calls the callbacks of completed requests without
+ * blocking. Has to be called whenever the fd of `lifx_get_fd` is readable and after requests were submitted,
+ * which are only queued by the submit functions
+ */
+int lifx_process_events(lifx_ctx_t *p_ctx);
+
+/** Waits up to `timeout_ms` (-1 for infinity) for a response or deadline and processes it via `lifx_run_once` */
+int lifx_poll(lifx_ctx_t *p_ctx, int timeout_ms);
+
+/** 
+ * Sends all queued packets and processes responses until `p_op` is completed, 
+ * returns 0 if its status is `LIFX_OP_DONE`, `LIFX_OP_COALESCED` or `LIFX_OP_SUPPRESSED`
+ */
+int lifx_wait(lifx_ctx_t *p_ctx, lifx_op_t *p_op);
+
+/** Processes responses until no request is in flight or throttled anymore */
+int lifx_wait_all(lifx_ctx_t *p_ctx);
+
+/** 
+ * Gives up a pending request, e.g. when `lifx_wait` failed: the context no longer references `p_op` except for 
+ * its callback, which is still called. The status becomes `LIFX_OP_FAILED`, returns -1 if it was not pending
+ */
+int lifx_cancel(lifx_ctx_t *p_ctx, lifx_op_t *p_op);
+
+
+/** 
+ * Copies the counters of all bulbs of the context into `p_stats`. 
+ * Counters are updated without locks, this function can be called from any thread.
+ */
+int lifx_get_stats(lifx_ctx_t *p_ctx, lifx_stats_t *p_stats);
+
+/** 
+ * Copies the counters of a single bulb into `p_stats`, target 0 collects the discovery broadcasts.
+ * Has to be called by the thread driving the context.
+ * @returns -1 if no packet was ever sent to the bulb
+ */
+int lifx_get_bulb_stats(lifx_ctx_t *p_ctx, uint64_t target, lifx_stats_t *p_stats);
+
+/** 
+ * Copies the cached state of a bulb. It is updated from the responses to get requests and from confirmed
+ * set requests, for which the requested value is cached since bulbs answer them with their state before the change.
+ * A set request invalidates the value it changes until it or a later request is confirmed.
+ * Has to be called by the thread driving the context.
+ * @returns -1 if no packet was ever sent to the bulb
+ */
+int lifx_get_bulb_state(lifx_ctx_t *p_ctx, uint64_t target, lifx_bulb_state_t *p_state);
 
-/** Sets the color of a bulb with a duration in milliseconds to transition to the new color */
-int setColor(bulb_service_t *p_bulb, color_t color, uint32_t duration);
+/** Sets the counters of the context and of all bulbs to zero, has to be called by the thread driving the context */
+int lifx_reset_stats(lifx_ctx_t *p_ctx);
 
 #endif
@@ -0,0 +1,89 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+/* wire format of the LIFX LAN protocol, shared by the library and the simulator */
+
+#define BROADCAST_PORT (56700)
+
+#define PROTOCOL_NUMBER (1024)
+#define ADDRESSABLE (1)
+#define ORIGIN (0)
+#define LIFX_UDP_SERVICE (1)
+
+
+#pragma pack(push, 1)
+typedef struct {
+  /* frame */
+  uint16_t size;
+  uint16_t protocol:12;
+  uint8_t  addressable:1;
+  uint8_t  tagged:1;
+  uint8_t  origin:2;
+  uint32_t source;
+  /* frame address */
+  uint8_t  target[8];
+  uint8_t  reserved[6];
+  uint8_t  res_required:1;
+  uint8_t  ack_required:1;
+  uint8_t  :6;
+  uint8_t  sequence;
+  /* protocol header */
+  //uint64_t :64;
+  uint64_t reserved1;
+  uint16_t type;
+  //uint16_t :16;
+  uint16_t reserved2;
+  /* variable length payload follows */
+} lx_protocol_header_t;
+#pragma pack(pop)
+
+
+typedef enum {
+	MSG_TYPE_GET_SERVICE = 2,
+	MSG_TYPE_STATE_SERVICE,
+    MSG_TYPE_ACKNOWLEDGEMENT = 45,
+    MSG_TYPE_GET_LIGHT = 101,
+    MSG_TYPE_SET_COLOR,
+    MSG_TYPE_LIGHT_STATE = 107,
+    MSG_TYPE_GET_POWER = 116,
+    MSG_TYPE_SET_POWER = 117,
+    MSG_TYPE_STATE_POWER,
+    MSG_TYPE_SET_EXTENDED_COLOR_ZONES = 510,
+    MSG_TYPE_GET_EXTENDED_COLOR_ZONES,
+    MSG_TYPE_STATE_EXTENDED_COLOR_ZONES,
+    MSG_TYPE_GET_64 = 707,
+    MSG_TYPE_STATE_64 = 711,
+    MSG_TYPE_SET_64 = 715,
+} lx_protocol_header_msg_type;
+
+/** size of a HSBK value on the wire: hue, saturation, brightness & kelvin as little endian uint16 */
+#define HSBK_SIZE (8)
+/** number of HSBK values carried by the extended multizone messages */
+#define EXTENDED_ZONES (82)
+/** number of HSBK values carried by the tile messages (8x8) */
+#define TILE_COLORS (64)
+
+/** level (2) & duration (4) */
+#define SET_POWER_SIZE (6)
+/** reserved (1), color & duration (4) */
+#define SET_COLOR_SIZE (5 + HSBK_SIZE)
+
+/** duration (4), apply (1), zone_index (2), colors_count (1) & colors */
+#define SET_EXTENDED_COLOR_ZONES_SIZE (8 + EXTENDED_ZONES * HSBK_SIZE)
+/** zones_count (2), zone_index (2), colors_count (1) & colors */
+#define STATE_EXTENDED_COLOR_ZONES_SIZE (5 + EXTENDED_ZONES * HSBK_SIZE)
+/** tile_index (1), length (1), reserved (1), x (1), y (1), width (1) */
+#define GET_64_SIZE (6)
+/** tile_index (1), length (1), reserved (1), x (1), y (1), width (1), duration (4) & colors */
+#define SET_64_SIZE (10 + TILE_COLORS * HSBK_SIZE)
+/** tile_index (1), reserved (1), x (1), y (1), width (1) & colors */
+#define STATE_64_SIZE (5 + TILE_COLORS * HSBK_SIZE)
+
+#endif
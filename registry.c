@@ -0,0 +1,162 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cachefile.h"
+#include "registry.h"
+
+
+/** initial number of bulbs the pool has space for */
+#define REGISTRY_CAPACITY (16)
+/** "LXRG" followed by the version of the file format */
+#define CACHE_MAGIC (0x4752584Cu)
+#define CACHE_VERSION (1)
+/** target, IP addr, port & service */
+#define CACHE_RECORD_SIZE (17)
+
+
+static uint64_t addrKey(unsigned long in_addr, uint32_t port) {
+    return ((uint64_t)(in_addr & 0xFFFFFFFF) << 32) | port;
+}
+
+int lifx_registry_init(lifx_registry_t *p_registry) {
+    p_registry->p_bulbs = malloc(REGISTRY_CAPACITY * sizeof(bulb_service_t));
+    if (p_registry->p_bulbs == NULL) {
+        printf("allocating registry failed\n");
+        return -1;
+    }
+    p_registry->count = 0;
+    p_registry->capacity = REGISTRY_CAPACITY;
+    if (lx_hashindex_init(&p_registry->target_index)) {
+        free(p_registry->p_bulbs);
+        return -1;
+    }
+    if (lx_hashindex_init(&p_registry->addr_index)) {
+        lx_hashindex_free(&p_registry->target_index);
+        free(p_registry->p_bulbs);
+        return -1;
+    }
+    return 0;
+}
+
+int lifx_registry_free(lifx_registry_t *p_registry) {
+    free(p_registry->p_bulbs);
+    p_registry->p_bulbs = NULL;
+    p_registry->count = 0;
+    p_registry->capacity = 0;
+    lx_hashindex_free(&p_registry->target_index);
+    lx_hashindex_free(&p_registry->addr_index);
+    return 0;
+}
+
+/** grows the array to at least `capacity` bulbs */
+static int reserve(lifx_registry_t *p_registry, size_t capacity) {
+    if (capacity <= p_registry->capacity) {
+        return 0;
+    }
+    bulb_service_t *p_bulbs = realloc(p_registry->p_bulbs, capacity * sizeof(bulb_service_t));
+    if (p_bulbs == NULL) {
+        printf("growing registry failed\n");
+        return -1;
+    }
+    p_registry->p_bulbs = p_bulbs;
+    p_registry->capacity = capacity;
+    return 0;
+}
+
+int lifx_registry_upsert(lifx_registry_t *p_registry, const bulb_service_t *p_bulb) {
+    long index = lx_hashindex_find(&p_registry->target_index, p_bulb->target);
+    if (index >= 0) {
+        // repeated response, the bulb might have gotten a new IP addr in the meantime
+        bulb_service_t *p_known = &p_registry->p_bulbs[index];
+        if (p_known->in_addr != p_bulb->in_addr || p_known->port != p_bulb->port) {
+            uint64_t old_key = addrKey(p_known->in_addr, p_known->port);
+            // the old addr might have been taken over by another bulb already
+            if (lx_hashindex_find(&p_registry->addr_index, old_key) == index) {
+                lx_hashindex_remove(&p_registry->addr_index, old_key);
+            }
+            if (lx_hashindex_put(&p_registry->addr_index, addrKey(p_bulb->in_addr, p_bulb->port), (uint32_t)index)) {
+                return -1;
+            }
+        }
+        *p_known = *p_bulb;
+        return 0;
+    }
+
+    if (p_registry->count >= p_registry->capacity && reserve(p_registry, p_registry->capacity * 2)) {
+        return -1;
+    }
+    uint32_t new_index = (uint32_t)p_registry->count;
+    if (lx_hashindex_put(&p_registry->target_index, p_bulb->target, new_index)) {
+        return -1;
+    }
+    if (lx_hashindex_put(&p_registry->addr_index, addrKey(p_bulb->in_addr, p_bulb->port), new_index)) {
+        lx_hashindex_remove(&p_registry->target_index, p_bulb->target);
+        return -1;
+    }
+    p_registry->p_bulbs[new_index] = *p_bulb;
+    p_registry->count++;
+    return 1;
+}
+
+bulb_service_t *lifx_registry_find_target(const lifx_registry_t *p_registry, uint64_t target) {
+    long index = lx_hashindex_find(&p_registry->target_index, target);
+    return index < 0 ? NULL : &p_registry->p_bulbs[index];
+}
+
+bulb_service_t *lifx_registry_find_addr(const lifx_registry_t *p_registry, unsigned long in_addr, uint32_t port) {
+    long index = lx_hashindex_find(&p_registry->addr_index, addrKey(in_addr, port));
+    return index < 0 ? NULL : &p_registry->p_bulbs[index];
+}
+
+int lifx_registry_save(const lifx_registry_t *p_registry, const char *p_path) {
+    uint8_t *p_records = malloc(p_registry->count > 0 ? p_registry->count * CACHE_RECORD_SIZE : 1);
+    if (p_records == NULL) {
+        printf("allocating registry cache failed\n");
+        return -1;
+    }
+    for (size_t i = 0; i < p_registry->count; i++) {
+        const bulb_service_t *p_bulb = &p_registry->p_bulbs[i];
+        uint8_t *p_record = p_records + i * CACHE_RECORD_SIZE;
+        lx_cachefile_put_le(p_record, p_bulb->target, 8);
+        lx_cachefile_put_le(p_record + 8, p_bulb->in_addr, 4);
+        lx_cachefile_put_le(p_record + 12, p_bulb->port, 4);
+        p_record[16] = p_bulb->service;
+    }
+    int res = lx_cachefile_write(p_path, CACHE_MAGIC, CACHE_VERSION, p_records, p_registry->count, CACHE_RECORD_SIZE);
+    free(p_records);
+    return res;
+}
+
+long lifx_registry_load(lifx_registry_t *p_registry, const char *p_path) {
+    size_t count;
+    uint8_t *p_records = lx_cachefile_read(p_path, CACHE_MAGIC, CACHE_VERSION, CACHE_RECORD_SIZE, &count);
+    if (p_records == NULL) {
+        return -1;
+    }
+    if (reserve(p_registry, p_registry->count + count)) {
+        free(p_records);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *p_record = p_records + i * CACHE_RECORD_SIZE;
+        bulb_service_t bulb = {
+            .target = lx_cachefile_get_le(p_record, 8),
+            .in_addr = (unsigned long)lx_cachefile_get_le(p_record + 8, 4),
+            .port = (uint32_t)lx_cachefile_get_le(p_record + 12, 4),
+            .service = p_record[16],
+        };
+        if (lifx_registry_upsert(p_registry, &bulb) < 0) {
+            free(p_records);
+            return -1;
+        }
+    }
+    free(p_records);
+    return (long)count;
+}
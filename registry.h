@@ -0,0 +1,56 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stddef.h>
+#include "bulb.h"
+#include "hashindex.h"
+
+
+/** 
+ * Set of known bulbs without an upper limit. The bulbs are stored in one contiguous array, 
+ * which is indexed by target (MAC addr) and by IP addr & port.
+ */
+typedef struct {
+    /** `count` valid bulbs, pointers into the array are invalidated when a bulb gets added */
+    bulb_service_t *p_bulbs;
+    size_t count;
+    size_t capacity;
+    lx_hashindex_t target_index;
+    lx_hashindex_t addr_index;
+} lifx_registry_t;
+
+int lifx_registry_init(lifx_registry_t *p_registry);
+
+int lifx_registry_free(lifx_registry_t *p_registry);
+
+/** 
+ * Adds the bulb or updates the bulb with the same target 
+ * @returns 1 if the bulb was added, 0 if it was already known and -1 on error
+ */
+int lifx_registry_upsert(lifx_registry_t *p_registry, const bulb_service_t *p_bulb);
+
+/** @returns the bulb with the given MAC addr or NULL */
+bulb_service_t *lifx_registry_find_target(const lifx_registry_t *p_registry, uint64_t target);
+
+/** @returns the bulb listening on the given IP addr & port or NULL */
+bulb_service_t *lifx_registry_find_addr(const lifx_registry_t *p_registry, unsigned long in_addr, uint32_t port);
+
+/** 
+ * Writes target, IP addr, port & service of all bulbs to a compact binary file.
+ * The file is replaced atomically, a concurrent load sees either the old or the new bulbs
+ */
+int lifx_registry_save(const lifx_registry_t *p_registry, const char *p_path);
+
+/** 
+ * Upserts the bulbs of a file written by `lifx_registry_save`, e.g. to use the bulbs of the last run right away
+ * while `lifx_submit_discover` refreshes them in the background
+ * @returns number of bulbs in the file, -1 on error. A missing or invalid file leaves the registry unchanged
+ */
+long lifx_registry_load(lifx_registry_t *p_registry, const char *p_path);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cachefile.h"
+#include "scene.h"
+
+
+/** "LXSC" followed by the version of the file format */
+#define SCENE_MAGIC (0x4353584Cu)
+#define SCENE_VERSION (1)
+/** target, power & HSBK */
+#define SCENE_RECORD_SIZE (17)
+
+
+int lifx_scene_init(lifx_scene_t *p_scene) {
+    p_scene->p_entries = NULL;
+    p_scene->count = 0;
+    return 0;
+}
+
+int lifx_scene_free(lifx_scene_t *p_scene) {
+    free(p_scene->p_entries);
+    p_scene->p_entries = NULL;
+    p_scene->count = 0;
+    return 0;
+}
+
+/** gives up the pending ops after waiting failed, the context must not reference them once they are freed */
+static void cancelOps(lifx_ctx_t *p_ctx, lifx_op_t *p_ops, size_t count) {
+    printf("waiting for the requests failed\n");
+    for (size_t i = 0; i < count; i++) {
+        lifx_cancel(p_ctx, &p_ops[i]);
+    }
+}
+
+int lifx_scene_capture(lifx_ctx_t *p_ctx, lifx_scene_t *p_scene, const lifx_registry_t *p_registry, uint32_t max_age_ms) {
+    size_t count = p_registry->count;
+    lifx_scene_entry_t *p_entries = malloc((count > 0 ? count : 1) * sizeof(lifx_scene_entry_t));
+    lifx_op_t *p_ops = calloc(count > 0 ? count : 1, sizeof(lifx_op_t));
+    if (p_entries == NULL || p_ops == NULL) {
+        printf("allocating scene failed\n");
+        free(p_entries);
+        free(p_ops);
+        return -1;
+    }
+
+    // LightState carries power & color, all requests leave in batches before the first response is awaited
+    for (size_t i = 0; i < count; i++) {
+        p_ops[i].max_age_ms = max_age_ms;
+        lifx_submit_get_color(p_ctx, &p_ops[i], &p_registry->p_bulbs[i]);
+    }
+    int missing = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool valid = lifx_wait(p_ctx, &p_ops[i]) == 0;
+        if (!valid && p_ops[i].status == LIFX_OP_PENDING) {
+            cancelOps(p_ctx, p_ops + i, count - i);
+            free(p_ops);
+            free(p_entries);
+            return -1;
+        }
+        p_entries[i] = (lifx_scene_entry_t) {
+            .target = p_registry->p_bulbs[i].target,
+            .on = p_ops[i].on,
+            .color = p_ops[i].color,
+            .valid = valid,
+        };
+        missing += !valid;
+    }
+    free(p_ops);
+
+    free(p_scene->p_entries);
+    p_scene->p_entries = p_entries;
+    p_scene->count = count;
+    return missing;
+}
+
+int lifx_scene_restore(lifx_ctx_t *p_ctx, const lifx_scene_t *p_scene, const lifx_registry_t *p_registry, uint32_t duration) {
+    // color & power of a bulb, the color is set first so that a bulb that is turned on fades in with it
+    lifx_op_t *p_ops = calloc(p_scene->count > 0 ? 2 * p_scene->count : 1, sizeof(lifx_op_t));
+    if (p_ops == NULL) {
+        printf("allocating requests failed\n");
+        return -1;
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < p_scene->count; i++) {
+        const lifx_scene_entry_t *p_entry = &p_scene->p_entries[i];
+        if (!p_entry->valid) {
+            continue;
+        }
+        bulb_service_t *p_bulb = lifx_registry_find_target(p_registry, p_entry->target);
+        if (p_bulb == NULL) {
+            failed++;
+            continue;
+        }
+        lifx_submit_set_color(p_ctx, &p_ops[2 * i], p_bulb, p_entry->color, duration);
+        lifx_submit_set_power(p_ctx, &p_ops[2 * i + 1], p_bulb, p_entry->on, duration);
+    }
+    for (size_t i = 0; i < p_scene->count; i++) {
+        if (p_ops[2 * i].status == LIFX_OP_IDLE) {
+            continue;
+        }
+        bool color_set = lifx_wait(p_ctx, &p_ops[2 * i]) == 0;
+        bool power_set = lifx_wait(p_ctx, &p_ops[2 * i + 1]) == 0;
+        if (p_ops[2 * i].status == LIFX_OP_PENDING || p_ops[2 * i + 1].status == LIFX_OP_PENDING) {
+            cancelOps(p_ctx, p_ops + 2 * i, 2 * (p_scene->count - i));
+            failed = -1;
+            break;
+        }
+        failed += !color_set || !power_set;
+    }
+    free(p_ops);
+    return failed;
+}
+
+int lifx_scene_save(const lifx_scene_t *p_scene, const char *p_path) {
+    size_t valid = 0;
+    for (size_t i = 0; i < p_scene->count; i++) {
+        valid += p_scene->p_entries[i].valid;
+    }
+    uint8_t *p_records = malloc(valid > 0 ? valid * SCENE_RECORD_SIZE : 1);
+    if (p_records == NULL) {
+        printf("allocating scene file failed\n");
+        return -1;
+    }
+    uint8_t *p_record = p_records;
+    for (size_t i = 0; i < p_scene->count; i++) {
+        const lifx_scene_entry_t *p_entry = &p_scene->p_entries[i];
+        if (!p_entry->valid) {
+            continue;
+        }
+        lx_cachefile_put_le(p_record, p_entry->target, 8);
+        p_record[8] = p_entry->on;
+        lx_cachefile_put_le(p_record + 9, p_entry->color.hue, 2);
+        lx_cachefile_put_le(p_record + 11, p_entry->color.saturation, 2);
+        lx_cachefile_put_le(p_record + 13, p_entry->color.brightness, 2);
+        lx_cachefile_put_le(p_record + 15, p_entry->color.kelvin, 2);
+        p_record += SCENE_RECORD_SIZE;
+    }
+    int res = lx_cachefile_write(p_path, SCENE_MAGIC, SCENE_VERSION, p_records, valid, SCENE_RECORD_SIZE);
+    free(p_records);
+    return res;
+}
+
+int lifx_scene_load(lifx_scene_t *p_scene, const char *p_path) {
+    size_t count;
+    uint8_t *p_records = lx_cachefile_read(p_path, SCENE_MAGIC, SCENE_VERSION, SCENE_RECORD_SIZE, &count);
+    if (p_records == NULL) {
+        return -1;
+    }
+    lifx_scene_entry_t *p_entries = malloc((count > 0 ? count : 1) * sizeof(lifx_scene_entry_t));
+    if (p_entries == NULL) {
+        printf("allocating scene failed\n");
+        free(p_records);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *p_record = p_records + i * SCENE_RECORD_SIZE;
+        p_entries[i] = (lifx_scene_entry_t) {
+            .target = lx_cachefile_get_le(p_record, 8),
+            .on = p_record[8] != 0,
+            .color = {
+                .hue = (uint16_t)lx_cachefile_get_le(p_record + 9, 2),
+                .saturation = (uint16_t)lx_cachefile_get_le(p_record + 11, 2),
+                .brightness = (uint16_t)lx_cachefile_get_le(p_record + 13, 2),
+                .kelvin = (uint16_t)lx_cachefile_get_le(p_record + 15, 2),
+            },
+            .valid = true,
+        };
+    }
+    free(p_records);
+
+    free(p_scene->p_entries);
+    p_scene->p_entries = p_entries;
+    p_scene->count = count;
+    return 0;
+}
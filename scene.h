@@ -0,0 +1,61 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+#include "lifx.h"
+#include "registry.h"
+
+
+/** power & color of a single bulb */
+typedef struct {
+    uint64_t target;
+    bool on;
+    color_t color;
+    /** false if the state of the bulb could not be captured, such a bulb is not restored */
+    bool valid;
+} lifx_scene_entry_t;
+
+/**
+ * Snapshot of power & color of a set of bulbs, e.g. to bring them back after an alarm overrode them.
+ * Bulbs are identified by target, so a scene stays valid when their IP addrs change.
+ */
+typedef struct {
+    lifx_scene_entry_t *p_entries;
+    size_t count;
+} lifx_scene_t;
+
+int lifx_scene_init(lifx_scene_t *p_scene);
+
+int lifx_scene_free(lifx_scene_t *p_scene);
+
+/**
+ * Replaces the scene with the state of all bulbs of the registry. The requests to all bulbs are in flight at once.
+ * @param max_age_ms cached states confirmed at most this many milliseconds ago are used without asking the bulb
+ * @returns the number of bulbs whose state could not be captured, -1 on error
+ */
+int lifx_scene_capture(lifx_ctx_t *p_ctx, lifx_scene_t *p_scene, const lifx_registry_t *p_registry, uint32_t max_age_ms);
+
+/**
+ * Sets color & power of every captured bulb in one pipelined batch, the bulbs are looked up in the registry by target
+ * @returns the number of bulbs that could not be restored (including unknown ones), -1 on error
+ */
+int lifx_scene_restore(lifx_ctx_t *p_ctx, const lifx_scene_t *p_scene, const lifx_registry_t *p_registry, uint32_t duration);
+
+/** Writes the captured bulbs to a compact binary file, which is replaced atomically */
+int lifx_scene_save(const lifx_scene_t *p_scene, const char *p_path);
+
+/**
+ * Replaces the scene with the bulbs of a file written by `lifx_scene_save`
+ * @returns -1 if the file is missing or invalid, the scene is left unchanged then
+ */
+int lifx_scene_load(lifx_scene_t *p_scene, const char *p_path);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "shard.h"
+#include "protocol.h"
+
+
+/** offset of the 4 bytes of the target the shard is derived from, bytes 2 - 5 of the MAC addr, which mostly follow the OUI */
+#define STEERING_OFFSET (offsetof(lx_protocol_header_t, target) + 2)
+#define TYPE_OFFSET (offsetof(lx_protocol_header_t, type))
+/** multiplier spreading the steering bytes over the high bits (Fibonacci hashing) */
+#define STEERING_MULTIPLIER (0x9E3779B1u)
+
+typedef struct {
+    lifx_shards_t *p_shards;
+    size_t shard;
+    int (*p_worker)(lifx_ctx_t *p_ctx, size_t shard, void *p_user);
+    void *p_user;
+    int cpu;
+    int res;
+} lx_shard_thread_t;
+
+
+/** hash of a target, computed exactly like the BPF program does it on the received header */
+static uint32_t steeringHash(uint64_t target) {
+    // the BPF program loads the bytes in network order
+    uint32_t key = ((uint32_t)((target >> 16) & 0xFF) << 24) |
+                   ((uint32_t)((target >> 24) & 0xFF) << 16) |
+                   ((uint32_t)((target >> 32) & 0xFF) << 8) |
+                   ((uint32_t)((target >> 40) & 0xFF) << 0);
+    return (uint32_t)(key * STEERING_MULTIPLIER) >> 16;
+}
+
+size_t lifx_shard_of(const lifx_shards_t *p_shards, uint64_t target) {
+    return steeringHash(target) % p_shards->count;
+}
+
+/**
+ * attaches the program picking the socket of a received packet to the port group:
+ * StateService goes to shard 0, every other packet to the shard of its target
+ */
+static int attachSteering(int udp_socket, size_t count) {
+    struct sock_filter code[] = {
+        // the type is little endian, the load is big endian
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, TYPE_OFFSET),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)MSG_TYPE_STATE_SERVICE << 8, 5, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, STEERING_OFFSET),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, STEERING_MULTIPLIER),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)count),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog program = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code,
+    };
+    if (setsockopt(udp_socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program))) {
+        printf("attaching steering program failed (err %d (%s))\n", errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * opens a socket of the port group, the kernel numbers them in the order they are bound
+ * @param p_port port to bind, set to the picked one if it is 0
+ */
+static int openShardSocket(uint16_t *p_port) {
+    int udp_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (udp_socket < 0) {
+        printf("opening socket failed (err %d (%s))\n", errno, strerror(errno));
+        return -1;
+    }
+    const int enable = 1;
+    if (setsockopt(udp_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable))) {
+        printf("enabling port sharing failed (err %d (%s))\n", errno, strerror(errno));
+        close(udp_socket);
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(*p_port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    socklen_t addr_size = sizeof(addr);
+    if (bind(udp_socket, (struct sockaddr *)&addr, sizeof(addr)) ||
+        getsockname(udp_socket, (struct sockaddr *)&addr, &addr_size)) {
+        printf("binding port %u failed (err %d (%s))\n", *p_port, errno, strerror(errno));
+        close(udp_socket);
+        return -1;
+    }
+    *p_port = ntohs(addr.sin_port);
+    return udp_socket;
+}
+
+int lifx_shards_init(lifx_shards_t *p_shards, size_t count, uint16_t port) {
+    memset(p_shards, 0, sizeof(*p_shards));
+    if (count == 0 || count > LIFX_MAX_SHARDS) {
+        printf("invalid number of shards: %zu\n", count);
+        return -1;
+    }
+    int p_sockets[LIFX_MAX_SHARDS];
+    for (size_t i = 0; i < count; i++) {
+        p_sockets[i] = openShardSocket(&port);
+        if (p_sockets[i] < 0) {
+            while (i > 0) {
+                close(p_sockets[--i]);
+            }
+            return -1;
+        }
+    }
+    // the program applies to the whole group, it is attached before any context can send
+    if (attachSteering(p_sockets[0], count)) {
+        for (size_t i = 0; i < count; i++) {
+            close(p_sockets[i]);
+        }
+        return -1;
+    }
+    p_shards->port = port;
+    for (size_t i = 0; i < count; i++) {
+        // the context takes over the socket, also if it fails
+        if (lifx_init_with_socket(&p_shards->pp_ctxs[i], p_sockets[i])) {
+            p_shards->pp_ctxs[i] = NULL;
+            for (size_t j = i + 1; j < count; j++) {
+                close(p_sockets[j]);
+            }
+            lifx_shards_free(p_shards);
+            return -1;
+        }
+        p_shards->count++;
+    }
+    return 0;
+}
+
+int lifx_shards_free(lifx_shards_t *p_shards) {
+    for (size_t i = 0; i < p_shards->count; i++) {
+        close_lifx_lib(p_shards->pp_ctxs[i]);
+        p_shards->pp_ctxs[i] = NULL;
+    }
+    p_shards->count = 0;
+    return 0;
+}
+
+static void *runShard(void *p_arg) {
+    lx_shard_thread_t *p_thread = p_arg;
+    if (p_thread->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(p_thread->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+            printf("pinning shard %zu to cpu %d failed\n", p_thread->shard, p_thread->cpu);
+        }
+    }
+    p_thread->res = p_thread->p_worker(p_thread->p_shards->pp_ctxs[p_thread->shard], p_thread->shard, p_thread->p_user);
+    return NULL;
+}
+
+int lifx_shards_run(lifx_shards_t *p_shards, int (*p_worker)(lifx_ctx_t *p_ctx, size_t shard, void *p_user), void *p_user) {
+    // shards are spread round robin over the CPUs the process may run on
+    int p_cpus[CPU_SETSIZE];
+    int cpu_count = 0;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                p_cpus[cpu_count++] = cpu;
+            }
+        }
+    }
+
+    lx_shard_thread_t p_threads[LIFX_MAX_SHARDS];
+    pthread_t p_ids[LIFX_MAX_SHARDS];
+    size_t started = 0;
+    int res = 0;
+    for (size_t i = 0; i < p_shards->count; i++) {
+        p_threads[i] = (lx_shard_thread_t) {
+            .p_shards = p_shards,
+            .shard = i,
+            .p_worker = p_worker,
+            .p_user = p_user,
+            .cpu = cpu_count > 0 ? p_cpus[i % (size_t)cpu_count] : -1,
+            .res = 0,
+        };
+        if (pthread_create(&p_ids[i], NULL, runShard, &p_threads[i])) {
+            printf("starting thread of shard %zu failed\n", i);
+            res = -1;
+            break;
+        }
+        started++;
+    }
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(p_ids[i], NULL);
+        if (p_threads[i].res) {
+            res = -1;
+        }
+    }
+    return res;
+}
@@ -0,0 +1,50 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lifx.h"
+
+
+/** maximal number of shards of a group */
+#define LIFX_MAX_SHARDS (64)
+
+/**
+ * Contexts sharing one UDP port with SO_REUSEPORT, one per worker thread. Every bulb belongs to exactly one shard,
+ * picked by a hash of its target (`lifx_shard_of`). A classic BPF program attached to the port steers every received
+ * packet to the socket of the shard its sender belongs to, so each shard owns the in-flight table, peers & state
+ * cache of its bulbs and no state is shared between the threads.
+ * StateService responses are steered to shard 0, which has to do the discovery. Broadcast set requests are not
+ * supported, their acknowledgements are spread over all shards.
+ */
+typedef struct {
+    lifx_ctx_t *pp_ctxs[LIFX_MAX_SHARDS];
+    size_t count;
+    /** local port all shards send from & receive on */
+    uint16_t port;
+} lifx_shards_t;
+
+/**
+ * Opens `count` sockets on the same port & a context on each of them
+ * @param port local port, 0 picks an ephemeral one
+ */
+int lifx_shards_init(lifx_shards_t *p_shards, size_t count, uint16_t port);
+
+int lifx_shards_free(lifx_shards_t *p_shards);
+
+/** @returns the index of the shard whose context has to be used for requests to the bulb */
+size_t lifx_shard_of(const lifx_shards_t *p_shards, uint64_t target);
+
+/**
+ * Calls `p_worker` for every shard on its own thread, which is pinned to one of the CPUs the process may run on,
+ * and waits until all workers returned
+ * @returns -1 if a thread could not be started or a worker returned an error
+ */
+int lifx_shards_run(lifx_shards_t *p_shards, int (*p_worker)(lifx_ctx_t *p_ctx, size_t shard, void *p_user), void *p_user);
+
+#endif
@@ -0,0 +1,643 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Simulates a fleet of LIFX bulbs on the loopback interface. Every virtual bulb listens on its own
+ * UDP port, or on its own loopback addr, a shared discovery port answers GetService broadcasts on behalf of 
+ * all bulbs and hands other tagged requests to every bulb.
+ * Replies can be delayed (latency & jitter) and requests dropped to emulate a lossy network.
+ */
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <errno.h>
+
+#include "clock.h"
+#include "color.h"
+#include "protocol.h"
+
+
+#define DEFAULT_BASE_PORT (BROADCAST_PORT + 1)
+#define SIM_PACKET_SIZE (1024)
+/** largest reply the simulator sends: header + StateExtendedColorZones */
+#define SIM_REPLY_SIZE (sizeof(lx_protocol_header_t) + STATE_EXTENDED_COLOR_ZONES_SIZE)
+#define SIM_LABEL_LENGTH (32)
+/** initial capacity of the queue of delayed replies */
+#define REPLY_CAPACITY (1024)
+#define MAX_EVENTS (64)
+/** first three bytes of every simulated MAC addr (the LIFX OUI) */
+#define SIM_TARGET_PREFIX (0xD573D0)
+
+
+typedef struct {
+    int socket;
+    uint64_t target;
+    unsigned long in_addr;
+    uint32_t port;
+    uint16_t power;
+    color_t color;
+    char label[SIM_LABEL_LENGTH];
+    /** every simulated bulb is a strip with EXTENDED_ZONES zones & a single tile as well */
+    color_t zones[EXTENDED_ZONES];
+    color_t tile[TILE_COLORS];
+} sim_bulb_t;
+
+/** reply waiting for its simulated latency to pass */
+typedef struct {
+    int64_t due_us;
+    int socket;
+    struct sockaddr_in addr;
+    uint16_t size;
+    uint8_t p_packet[SIM_REPLY_SIZE];
+} sim_reply_t;
+
+typedef struct {
+    size_t bulb_count;
+    uint32_t base_port;
+    /** first loopback addr if every bulb gets its own addr (all listening on `base_port`), 0 if they share 127.0.0.1 */
+    unsigned long base_addr;
+    uint32_t discovery_port;
+    int64_t latency_us;
+    int64_t jitter_us;
+    /** probability of dropping an incoming request, 0 - 1 */
+    double loss;
+    unsigned int seed;
+} sim_config_t;
+
+
+static sim_bulb_t *p_bulbs = NULL;
+static int discovery_socket = -1;
+static int timer_fd = -1;
+static int epoll_fd = -1;
+
+/** binary min-heap of delayed replies ordered by due time */
+static sim_reply_t *p_replies = NULL;
+static size_t reply_count = 0;
+static size_t reply_capacity = 0;
+
+static sim_config_t config = {
+    .bulb_count = 1,
+    .base_port = DEFAULT_BASE_PORT,
+    .base_addr = 0,
+    .discovery_port = BROADCAST_PORT,
+    .latency_us = 0,
+    .jitter_us = 0,
+    .loss = 0,
+    .seed = 1,
+};
+
+static volatile sig_atomic_t running = 1;
+
+
+static void stopSimulation(int signal) {
+    (void)signal;
+    running = 0;
+}
+
+/** uniformly distributed random number in [0, 1) */
+static double randomUnit(void) {
+    return (double)rand_r(&config.seed) / ((double)RAND_MAX + 1);
+}
+
+static void replySwap(size_t a, size_t b) {
+    sim_reply_t tmp = p_replies[a];
+    p_replies[a] = p_replies[b];
+    p_replies[b] = tmp;
+}
+
+static int pushReply(const sim_reply_t *p_reply) {
+    if (reply_count >= reply_capacity) {
+        size_t capacity = reply_capacity == 0 ? REPLY_CAPACITY : reply_capacity * 2;
+        sim_reply_t *p_new_replies = realloc(p_replies, capacity * sizeof(sim_reply_t));
+        if (p_new_replies == NULL) {
+            printf("growing reply queue failed\n");
+            return -1;
+        }
+        p_replies = p_new_replies;
+        reply_capacity = capacity;
+    }
+    size_t index = reply_count;
+    p_replies[index] = *p_reply;
+    reply_count++;
+    while (index > 0 && p_replies[(index - 1) / 2].due_us > p_replies[index].due_us) {
+        replySwap((index - 1) / 2, index);
+        index = (index - 1) / 2;
+    }
+    return 0;
+}
+
+static void popReply(void) {
+    reply_count--;
+    p_replies[0] = p_replies[reply_count];
+    size_t index = 0;
+    while (true) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        size_t right = left + 1;
+        if (left < reply_count && p_replies[left].due_us < p_replies[smallest].due_us) {
+            smallest = left;
+        }
+        if (right < reply_count && p_replies[right].due_us < p_replies[smallest].due_us) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        replySwap(smallest, index);
+        index = smallest;
+    }
+}
+
+static void sendReply(const sim_reply_t *p_reply) {
+    if (sendto(p_reply->socket, p_reply->p_packet, p_reply->size, 0, (const struct sockaddr *)&p_reply->addr, sizeof(p_reply->addr)) < 0) {
+        printf("sending reply failed (err %d (%s))\n", errno, strerror(errno));
+    }
+}
+
+/** arms the timer for the earliest delayed reply */
+static int armTimer(void) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (reply_count > 0) {
+        int64_t due_us = p_replies[0].due_us;
+        spec.it_value.tv_sec = due_us / 1000000;
+        spec.it_value.tv_nsec = (due_us % 1000000) * 1000;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL)) {
+        printf("arming reply timer failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+/** sends all delayed replies that are due */
+static void sendDueReplies(void) {
+    int64_t now = lx_clock_now_us();
+    while (reply_count > 0 && p_replies[0].due_us <= now) {
+        sendReply(&p_replies[0]);
+        popReply();
+    }
+}
+
+/** builds a reply to `p_request` and sends it right away or after the simulated latency */
+static int queueReply(int socket, const struct sockaddr_in *p_addr, const lx_protocol_header_t *p_request, uint64_t target, uint16_t type, const uint8_t *p_payload, uint16_t payload_size) {
+    sim_reply_t reply;
+    lx_protocol_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.size = sizeof(header) + payload_size;
+    header.protocol = PROTOCOL_NUMBER;
+    header.addressable = ADDRESSABLE;
+    header.origin = ORIGIN;
+    header.source = p_request->source;
+    for (int i = 0; i < 8; i++) {
+        header.target[i] = (uint8_t)((target >> (8 * i)) & 0xFF);
+    }
+    header.sequence = p_request->sequence;
+    header.type = type;
+
+    memcpy(reply.p_packet, &header, sizeof(header));
+    if (payload_size > 0) {
+        memcpy(reply.p_packet + sizeof(header), p_payload, payload_size);
+    }
+    reply.size = header.size;
+    reply.socket = socket;
+    reply.addr = *p_addr;
+
+    if (config.latency_us == 0 && config.jitter_us == 0) {
+        sendReply(&reply);
+        return 0;
+    }
+    int64_t delay_us = config.latency_us + (int64_t)((2 * randomUnit() - 1) * config.jitter_us);
+    reply.due_us = lx_clock_now_us() + (delay_us > 0 ? delay_us : 0);
+    return pushReply(&reply);
+}
+
+static int replyStateService(int socket, const struct sockaddr_in *p_addr, const lx_protocol_header_t *p_request, const sim_bulb_t *p_bulb) {
+    uint8_t p_payload[5];
+    p_payload[0] = LIFX_UDP_SERVICE;
+    p_payload[1] = (p_bulb->port >> 0) & 0xFF;
+    p_payload[2] = (p_bulb->port >> 8) & 0xFF;
+    p_payload[3] = (p_bulb->port >> 16) & 0xFF;
+    p_payload[4] = (p_bulb->port >> 24) & 0xFF;
+    return queueReply(socket, p_addr, p_request, p_bulb->target, MSG_TYPE_STATE_SERVICE, p_payload, sizeof(p_payload));
+}
+
+static int replyStatePower(const struct sockaddr_in *p_addr, const lx_protocol_header_t *p_request, const sim_bulb_t *p_bulb) {
+    uint8_t p_payload[2];
+    p_payload[0] = (p_bulb->power >> 0) & 0xFF;
+    p_payload[1] = (p_bulb->power >> 8) & 0xFF;
+    return queueReply(p_bulb->socket, p_addr, p_request, p_bulb->target, MSG_TYPE_STATE_POWER, p_payload, sizeof(p_payload));
+}
+
+static int replyLightState(const struct sockaddr_in *p_addr, const lx_protocol_header_t *p_request, const sim_bulb_t *p_bulb) {
+    uint8_t p_payload[52];
+    memset(p_payload, 0, sizeof(p_payload));
+    p_payload[0] = (p_bulb->color.hue >> 0) & 0xFF;
+    p_payload[1] = (p_bulb->color.hue >> 8) & 0xFF;
+    p_payload[2] = (p_bulb->color.saturation >> 0) & 0xFF;
+    p_payload[3] = (p_bulb->color.saturation >> 8) & 0xFF;
+    p_payload[4] = (p_bulb->color.brightness >> 0) & 0xFF;
+    p_payload[5] = (p_bulb->color.brightness >> 8) & 0xFF;
+    p_payload[6] = (p_bulb->color.kelvin >> 0) & 0xFF;
+    p_payload[7] = (p_bulb->color.kelvin >> 8) & 0xFF;
+    // bytes 8 & 9 are reserved
+    p_payload[10] = (p_bulb->power >> 0) & 0xFF;
+    p_payload[11] = (p_bulb->power >> 8) & 0xFF;
+    memcpy(p_payload + 12, p_bulb->label, SIM_LABEL_LENGTH);
+    // bytes 44 - 51 are reserved
+    return queueReply(p_bulb->socket, p_addr, p_request, p_bulb->target, MSG_TYPE_LIGHT_STATE, p_payload, sizeof(p_payload));
+}
+
+static void readColors(color_t *p_colors, const uint8_t *p_src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *p_hsbk = p_src + i * HSBK_SIZE;
+        p_colors[i].hue = ((uint16_t)p_hsbk[0] << 0) + ((uint16_t)p_hsbk[1] << 8);
+        p_colors[i].saturation = ((uint16_t)p_hsbk[2] << 0) + ((uint16_t)p_hsbk[3] << 8);
+        p_colors[i].brightness = ((uint16_t)p_hsbk[4] << 0) + ((uint16_t)p_hsbk[5] << 8);
+        p_colors[i].kelvin = ((uint16_t)p_hsbk[6] << 0) + ((uint16_t)p_hsbk[7] << 8);
+    }
+}
+
+static void writeColors(uint8_t *p_dst, const color_t *p_colors, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *p_hsbk = p_dst + i * HSBK_SIZE;
+        p_hsbk[0] = (p_colors[i].hue >> 0) & 0xFF;
+        p_hsbk[1] = (p_colors[i].hue >> 8) & 0xFF;
+        p_hsbk[2] = (p_colors[i].saturation >> 0) & 0xFF;
+        p_hsbk[3] = (p_colors[i].saturation >> 8) & 0xFF;
+        p_hsbk[4] = (p_colors[i].brightness >> 0) & 0xFF;
+        p_hsbk[5] = (p_colors[i].brightness >> 8) & 0xFF;
+        p_hsbk[6] = (p_colors[i].kelvin >> 0) & 0xFF;
+        p_hsbk[7] = (p_colors[i].kelvin >> 8) & 0xFF;
+    }
+}
+
+static int replyStateExtendedColorZones(const struct sockaddr_in *p_addr, const lx_protocol_header_t *p_request, const sim_bulb_t *p_bulb) {
+    uint8_t p_payload[STATE_EXTENDED_COLOR_ZONES_SIZE];
+    p_payload[0] = (EXTENDED_ZONES >> 0) & 0xFF;
+    p_payload[1] = (EXTENDED_ZONES >> 8) & 0xFF;
+    p_payload[2] = 0; // zone index
+    p_payload[3] = 0;
+    p_payload[4] = EXTENDED_ZONES;
+    writeColors(p_payload + 5, p_bulb->zones, EXTENDED_ZONES);
+    return queueReply(p_bulb->socket, p_addr, p_request, p_bulb->target, MSG_TYPE_STATE_EXTENDED_COLOR_ZONES, p_payload, sizeof(p_payload));
+}
+
+static int replyState64(const struct sockaddr_in *p_addr, const lx_protocol_header_t *p_request, const sim_bulb_t *p_bulb) {
+    uint8_t p_payload[STATE_64_SIZE];
+    p_payload[0] = 0; // tile index
+    p_payload[1] = 0; // reserved
+    p_payload[2] = 0; // x
+    p_payload[3] = 0; // y
+    p_payload[4] = 8; // width
+    writeColors(p_payload + 5, p_bulb->tile, TILE_COLORS);
+    return queueReply(p_bulb->socket, p_addr, p_request, p_bulb->target, MSG_TYPE_STATE_64, p_payload, sizeof(p_payload));
+}
+
+/** answers a request addressed to a single bulb */
+static int handleBulbRequest(sim_bulb_t *p_bulb, const struct sockaddr_in *p_addr, const lx_protocol_header_t *p_request, const uint8_t *p_payload, uint16_t payload_size) {
+    if (p_request->ack_required && queueReply(p_bulb->socket, p_addr, p_request, p_bulb->target, MSG_TYPE_ACKNOWLEDGEMENT, NULL, 0)) {
+        return -1;
+    }
+
+    switch (p_request->type) {
+        case MSG_TYPE_GET_SERVICE:
+            return replyStateService(p_bulb->socket, p_addr, p_request, p_bulb);
+        case MSG_TYPE_GET_POWER:
+            return replyStatePower(p_addr, p_request, p_bulb);
+        case MSG_TYPE_SET_POWER:
+            if (payload_size < 6) {
+                return 0;
+            }
+            // like real bulbs, set requests are answered with the state before the change
+            if (p_request->res_required && replyStatePower(p_addr, p_request, p_bulb)) {
+                return -1;
+            }
+            p_bulb->power = ((uint16_t)p_payload[0] << 0) + ((uint16_t)p_payload[1] << 8);
+            return 0;
+        case MSG_TYPE_GET_LIGHT:
+            return replyLightState(p_addr, p_request, p_bulb);
+        case MSG_TYPE_SET_COLOR:
+            if (payload_size < 13) {
+                return 0;
+            }
+            if (p_request->res_required && replyLightState(p_addr, p_request, p_bulb)) {
+                return -1;
+            }
+            p_bulb->color.hue = ((uint16_t)p_payload[1] << 0) + ((uint16_t)p_payload[2] << 8);
+            p_bulb->color.saturation = ((uint16_t)p_payload[3] << 0) + ((uint16_t)p_payload[4] << 8);
+            p_bulb->color.brightness = ((uint16_t)p_payload[5] << 0) + ((uint16_t)p_payload[6] << 8);
+            p_bulb->color.kelvin = ((uint16_t)p_payload[7] << 0) + ((uint16_t)p_payload[8] << 8);
+            return 0;
+        case MSG_TYPE_GET_EXTENDED_COLOR_ZONES:
+            return replyStateExtendedColorZones(p_addr, p_request, p_bulb);
+        case MSG_TYPE_SET_EXTENDED_COLOR_ZONES: {
+            if (payload_size < SET_EXTENDED_COLOR_ZONES_SIZE) {
+                return 0;
+            }
+            if (p_request->res_required && replyStateExtendedColorZones(p_addr, p_request, p_bulb)) {
+                return -1;
+            }
+            // only the colors are simulated, the apply field is ignored
+            uint16_t zone_index = ((uint16_t)p_payload[5] << 0) + ((uint16_t)p_payload[6] << 8);
+            size_t count = p_payload[7];
+            if (zone_index < EXTENDED_ZONES) {
+                if (count > (size_t)(EXTENDED_ZONES - zone_index)) {
+                    count = EXTENDED_ZONES - zone_index;
+                }
+                readColors(p_bulb->zones + zone_index, p_payload + 8, count);
+            }
+            return 0;
+        }
+        case MSG_TYPE_GET_64:
+            return replyState64(p_addr, p_request, p_bulb);
+        case MSG_TYPE_SET_64:
+            if (payload_size < SET_64_SIZE) {
+                return 0;
+            }
+            // the simulated tile is a single 8x8 tile that is always written as a whole
+            readColors(p_bulb->tile, p_payload + 10, TILE_COLORS);
+            return 0;
+        default:
+            // unknown messages are ignored like real bulbs do
+            return 0;
+    }
+}
+
+/** simulated packet loss */
+static bool isLost(void) {
+    return config.loss > 0 && randomUnit() < config.loss;
+}
+
+/**
+ * receives all pending requests on a socket
+ * @param p_bulb NULL for the discovery socket
+ */
+static int drainSocket(int socket, sim_bulb_t *p_bulb) {
+    uint8_t p_packet[SIM_PACKET_SIZE];
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t addr_size = sizeof(addr);
+        ssize_t res = recvfrom(socket, p_packet, sizeof(p_packet), 0, (struct sockaddr *)&addr, &addr_size);
+        if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return 0;
+        }
+        if (res < 0) {
+            printf("receiving request failed (err %d (%s))\n", errno, strerror(errno));
+            return -1;
+        }
+        if (res < (ssize_t)sizeof(lx_protocol_header_t)) {
+            continue;
+        }
+        lx_protocol_header_t request;
+        memcpy(&request, p_packet, sizeof(request));
+        const uint8_t *p_payload = p_packet + sizeof(request);
+        uint16_t payload_size = (uint16_t)(res - sizeof(request));
+
+        if (p_bulb != NULL) {
+            if (!isLost() && handleBulbRequest(p_bulb, &addr, &request, p_payload, payload_size)) {
+                return -1;
+            }
+        } else if (request.tagged) {
+            // every bulb receives the broadcast, each one might lose it
+            for (size_t i = 0; i < config.bulb_count; i++) {
+                if (isLost()) {
+                    continue;
+                }
+                int res = request.type == MSG_TYPE_GET_SERVICE ? 
+                    replyStateService(discovery_socket, &addr, &request, &p_bulbs[i]) :
+                    handleBulbRequest(&p_bulbs[i], &addr, &request, p_payload, payload_size);
+                if (res) {
+                    return -1;
+                }
+            }
+        }
+    }
+}
+
+static int openSocket(unsigned long in_addr, uint32_t port) {
+    int udp_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (udp_socket < 0) {
+        printf("opening socket failed (err %d (%s))\n", errno, strerror(errno));
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(in_addr);
+    if (bind(udp_socket, (struct sockaddr *)&addr, sizeof(addr))) {
+        printf("binding port %u failed (err %d (%s))\n", port, errno, strerror(errno));
+        close(udp_socket);
+        return -1;
+    }
+    return udp_socket;
+}
+
+static int watch(int fd, uint32_t id) {
+    struct epoll_event event = { .events = EPOLLIN };
+    event.data.u32 = id;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+        printf("watching fd failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int setupSimulation(void) {
+    // every bulb needs its own socket
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd < 0 || timer_fd < 0) {
+        printf("creating epoll instance or timer failed\n");
+        return -1;
+    }
+    // ids 0 - bulb_count-1 are bulbs, followed by the discovery socket and the timer
+    if (watch(timer_fd, (uint32_t)config.bulb_count + 1)) {
+        return -1;
+    }
+    discovery_socket = openSocket(INADDR_LOOPBACK, config.discovery_port);
+    if (discovery_socket < 0 || watch(discovery_socket, (uint32_t)config.bulb_count)) {
+        return -1;
+    }
+
+    p_bulbs = calloc(config.bulb_count, sizeof(sim_bulb_t));
+    if (p_bulbs == NULL) {
+        printf("allocating bulbs failed\n");
+        return -1;
+    }
+    for (size_t i = 0; i < config.bulb_count; i++) {
+        sim_bulb_t *p_bulb = &p_bulbs[i];
+        p_bulb->in_addr = config.base_addr != 0 ? config.base_addr + i : INADDR_LOOPBACK;
+        p_bulb->port = config.base_addr != 0 ? config.base_port : config.base_port + (uint32_t)i;
+        p_bulb->target = SIM_TARGET_PREFIX | ((uint64_t)i << 24);
+        p_bulb->power = 65535;
+        p_bulb->color = (color_t) {
+            .hue = 0,
+            .saturation = 0,
+            .brightness = 65535,
+            .kelvin = 3500,
+        };
+        snprintf(p_bulb->label, SIM_LABEL_LENGTH, "Sim Bulb %zu", i);
+        p_bulb->socket = openSocket(p_bulb->in_addr, p_bulb->port);
+        if (p_bulb->socket < 0 || watch(p_bulb->socket, (uint32_t)i)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int runSimulation(void) {
+    struct epoll_event events[MAX_EVENTS];
+    while (running) {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            printf("waiting for requests failed (err %d (%s))\n", errno, strerror(errno));
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            uint32_t id = events[i].data.u32;
+            if (id < config.bulb_count) {
+                if (drainSocket(p_bulbs[id].socket, &p_bulbs[id])) {
+                    return -1;
+                }
+            } else if (id == config.bulb_count) {
+                if (drainSocket(discovery_socket, NULL)) {
+                    return -1;
+                }
+            } else {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                    printf("reading reply timer failed\n");
+                }
+            }
+        }
+        sendDueReplies();
+        if (armTimer()) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void teardownSimulation(void) {
+    for (size_t i = 0; p_bulbs != NULL && i < config.bulb_count; i++) {
+        if (p_bulbs[i].socket > 0) {
+            close(p_bulbs[i].socket);
+        }
+    }
+    free(p_bulbs);
+    free(p_replies);
+    if (discovery_socket >= 0) {
+        close(discovery_socket);
+    }
+    if (timer_fd >= 0) {
+        close(timer_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+static void printUsage(const char *p_name) {
+    printf("usage: %s [-n bulbs] [-p base_port] [-a base_addr] [-d discovery_port] [-l latency_ms] [-j jitter_ms] [-x loss_percent] [-s seed]\n", p_name);
+}
+
+int main(int argc, char **argv) {
+    int option;
+    while ((option = getopt(argc, argv, "n:p:a:d:l:j:x:s:h")) != -1) {
+        switch (option) {
+            case 'n':
+                config.bulb_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                config.base_port = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'a': {
+                struct in_addr addr;
+                if (inet_pton(AF_INET, optarg, &addr) != 1) {
+                    printf("invalid addr %s\n", optarg);
+                    return -1;
+                }
+                config.base_addr = ntohl(addr.s_addr);
+                break;
+            }
+            case 'd':
+                config.discovery_port = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                config.latency_us = (int64_t)(strtod(optarg, NULL) * 1000);
+                break;
+            case 'j':
+                config.jitter_us = (int64_t)(strtod(optarg, NULL) * 1000);
+                break;
+            case 'x':
+                config.loss = strtod(optarg, NULL) / 100;
+                break;
+            case 's':
+                config.seed = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            default:
+                printUsage(argv[0]);
+                return option == 'h' ? 0 : -1;
+        }
+    }
+    if (config.bulb_count == 0 || (config.base_addr == 0 && config.base_port + config.bulb_count > 65536)) {
+        printf("invalid number of bulbs or base port\n");
+        return -1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopSimulation;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if (setupSimulation()) {
+        teardownSimulation();
+        return -1;
+    }
+    if (config.base_addr != 0) {
+        struct in_addr first = { .s_addr = htonl(config.base_addr) };
+        struct in_addr last = { .s_addr = htonl(config.base_addr + config.bulb_count - 1) };
+        char p_first[INET_ADDRSTRLEN];
+        char p_last[INET_ADDRSTRLEN];
+        printf("simulating %zu bulbs on %s-%s:%u, discovery on port %u\n", config.bulb_count, 
+            inet_ntop(AF_INET, &first, p_first, sizeof(p_first)), inet_ntop(AF_INET, &last, p_last, sizeof(p_last)),
+            config.base_port, config.discovery_port);
+    } else {
+        printf("simulating %zu bulbs on 127.0.0.1:%u-%u, discovery on port %u\n", config.bulb_count,
+            config.base_port, config.base_port + (uint32_t)config.bulb_count - 1, config.discovery_port);
+    }
+    fflush(stdout);
+
+    int res = runSimulation();
+    teardownSimulation();
+    return res;
+}
@@ -0,0 +1,59 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/** number of RTT histogram buckets, the last one collects everything above 2^22 us (~4s) */
+#define LIFX_RTT_BUCKETS (24)
+
+
+/**
+ * Counters of a context or of a single bulb.
+ * Only the thread driving the context writes them, any thread can read a consistent snapshot of each counter.
+ */
+typedef struct {
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    /** packets that could not be handed to the kernel */
+    uint64_t send_failures;
+    /** requests that got no response before their deadline */
+    uint64_t timeouts;
+    /** packets that were sent again because no response arrived in time */
+    uint64_t retries;
+    /** received packets carrying the source id of another client */
+    uint64_t source_mismatches;
+    /** responses whose message type does not answer the request */
+    uint64_t wrong_types;
+    /** received packets that are too short to be decoded */
+    uint64_t malformed;
+    /** responses to requests that were already completed or given up */
+    uint64_t unmatched;
+    /** requests that had to wait for a slot of the rate limit */
+    uint64_t throttled;
+    /** throttled set requests replaced by a newer one */
+    uint64_t coalesced;
+    /** get requests answered from the state cache without a packet */
+    uint64_t cache_hits;
+    /** set requests not sent because the bulb is known to be in the requested state already */
+    uint64_t suppressed;
+    /** number of RTT samples & their sum in microseconds */
+    uint64_t rtt_count;
+    uint64_t rtt_sum_us;
+    /** bucket i counts RTTs in [2^i, 2^(i+1)) us, bucket 0 also counts RTTs below 1 us */
+    uint64_t rtt_histogram[LIFX_RTT_BUCKETS];
+} lifx_stats_t;
+
+/**
+ * @returns upper bound of the histogram bucket that contains the p-th (0 - 1) RTT sample in microseconds,
+ * 0 if there are no samples
+ */
+uint64_t lifx_stats_rtt_percentile_us(const lifx_stats_t *p_stats, double p);
+
+#endif
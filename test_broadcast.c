@@ -0,0 +1,151 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Checks broadcast set requests against simulated bulbs: every expected bulb is confirmed on its own, and the 
+ * acknowledgements of a bulb are told apart when one of its own requests has the sequence of the broadcast.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lifx.h"
+#include "registry.h"
+#include "test_util.h"
+
+
+#define BASE_PORT (46841)
+#define DISCOVERY_PORT (46840)
+#define SIMULATED_BULBS (4)
+/** bulb without a simulator behind it, its port follows the ones of the simulated bulbs */
+#define SILENT_TARGET (UINT64_C(0xFFFF00000000))
+/** every sequence number is in use once this many requests to a bulb are in flight */
+#define SEQUENCES (256)
+#define TIMEOUT_MS (500)
+
+
+static void testConfirmations(lifx_ctx_t *p_ctx, const lifx_registry_t *p_registry) {
+    // the last simulated bulb is not expected, a silent one is expected instead
+    lifx_registry_t expected;
+    lifx_registry_init(&expected);
+    for (size_t i = 0; i + 1 < p_registry->count; i++) {
+        lifx_registry_upsert(&expected, &p_registry->p_bulbs[i]);
+    }
+    bulb_service_t silent = {
+        .in_addr = INADDR_LOOPBACK,
+        .target = SILENT_TARGET,
+        .service = 1,
+        .port = BASE_PORT + SIMULATED_BULBS,
+    };
+    lifx_registry_upsert(&expected, &silent);
+
+    bool p_confirmed[SIMULATED_BULBS];
+    lifx_broadcast_t broadcast = {
+        .p_expected = &expected,
+        .p_confirmed = p_confirmed,
+    };
+    lifx_op_t op;
+    memset(&op, 0, sizeof(op));
+    op.timeout_ms = TIMEOUT_MS;
+    color_t color = {
+        .hue = 1234,
+        .saturation = 0xFFFF,
+        .brightness = 0xFFFF,
+        .kelvin = 3000,
+    };
+    CHECK(lifx_submit_broadcast_set_color(p_ctx, &op, &broadcast, color, 0) == 0);
+    CHECK(lifx_wait(p_ctx, &op) == -1);
+    CHECK(op.status == LIFX_OP_TIMEOUT);
+    for (size_t i = 0; i < expected.count; i++) {
+        CHECK(p_confirmed[i] == (expected.p_bulbs[i].target != SILENT_TARGET));
+    }
+    CHECK(broadcast.confirmed_count == expected.count - 1);
+    // the unexpected bulb acknowledges every repetition of the broadcast
+    CHECK(broadcast.unexpected_count >= 1);
+
+    // all simulated bulbs got the color, also the unexpected one
+    for (size_t i = 0; i < p_registry->count; i++) {
+        bool on;
+        color_t bulb_color;
+        char p_label[LIFX_LABEL_LENGTH + 1];
+        CHECK(getColor(p_ctx, &p_registry->p_bulbs[i], &on, &bulb_color, p_label) == 0);
+        CHECK(memcmp(&bulb_color, &color, sizeof(color_t)) == 0);
+    }
+    lifx_registry_free(&expected);
+}
+
+static void testSameSequence(lifx_ctx_t *p_ctx, lifx_registry_t *p_registry) {
+    // requests to the first bulb take every sequence, so the broadcast shares its sequence with one of them
+    lifx_op_t *p_ops = calloc(SEQUENCES, sizeof(lifx_op_t));
+    if (p_ops == NULL) {
+        printf("allocating requests failed\n");
+        lx_test_failures++;
+        return;
+    }
+    lifx_stats_t before = lx_test_bulb_stats(p_ctx, p_registry->p_bulbs[0].target);
+    for (size_t i = 0; i < SEQUENCES; i++) {
+        p_ops[i].reliability = LIFX_RELIABILITY_ACK;
+        CHECK(lifx_submit_set_power(p_ctx, &p_ops[i], &p_registry->p_bulbs[0], i % 2 == 0, 0) == 0);
+    }
+    bool p_confirmed[SIMULATED_BULBS];
+    lifx_broadcast_t broadcast = {
+        .p_expected = p_registry,
+        .p_confirmed = p_confirmed,
+    };
+    lifx_op_t op;
+    memset(&op, 0, sizeof(op));
+    op.timeout_ms = TIMEOUT_MS;
+    CHECK(lifx_submit_broadcast_set_power(p_ctx, &op, &broadcast, true, 0) == 0);
+    size_t shared = 0;
+    for (size_t i = 0; i < SEQUENCES; i++) {
+        shared += p_ops[i].status == LIFX_OP_PENDING && p_ops[i].sequence == op.sequence;
+    }
+    CHECK(shared == 1);
+
+    CHECK(lifx_wait_all(p_ctx) == 0);
+    CHECK(op.status == LIFX_OP_DONE);
+    CHECK(broadcast.confirmed_count == p_registry->count);
+    CHECK(broadcast.unexpected_count == 0);
+    for (size_t i = 0; i < SEQUENCES; i++) {
+        CHECK(p_ops[i].status == LIFX_OP_DONE);
+    }
+    // an acknowledgement taken by the wrong op would only be made up for by a retransmission
+    lifx_stats_t after = lx_test_bulb_stats(p_ctx, p_registry->p_bulbs[0].target);
+    CHECK(after.retries == before.retries);
+    CHECK(after.unmatched == before.unmatched);
+    free(p_ops);
+}
+
+int main(void) {
+    pid_t pid = lx_test_spawn_simulator(SIMULATED_BULBS, BASE_PORT, DISCOVERY_PORT, 0);
+    if (pid < 0) {
+        return 1;
+    }
+    lifx_ctx_t *p_ctx;
+    if (init_lifx_lib(&p_ctx)) {
+        lx_test_stop_simulator(pid);
+        return 1;
+    }
+    lifx_set_broadcast_addr(p_ctx, INADDR_LOOPBACK, DISCOVERY_PORT);
+    lifx_registry_t registry;
+    lifx_registry_init(&registry);
+
+    if (discoverBulbs(p_ctx, &registry) == 0 && registry.count == SIMULATED_BULBS) {
+        testConfirmations(p_ctx, &registry);
+        testSameSequence(p_ctx, &registry);
+    } else {
+        printf("discovering the simulated bulbs failed, %zu of %d found\n", registry.count, SIMULATED_BULBS);
+        lx_test_failures++;
+    }
+
+    lifx_registry_free(&registry);
+    close_lifx_lib(p_ctx);
+    lx_test_stop_simulator(pid);
+    return lx_test_report("broadcast");
+}
@@ -0,0 +1,143 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Checks the state cache against a simulated bulb: reads are answered without a packet while the cached state is
+ * younger than their max age, and a set request invalidates the value it changes until it is confirmed.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lifx.h"
+#include "registry.h"
+#include "test_util.h"
+
+
+#define BASE_PORT (46821)
+#define DISCOVERY_PORT (46820)
+/** max age no test runs long enough to exceed */
+#define LONG_AGE_MS (60000)
+#define SHORT_AGE_MS (20)
+
+
+static bool sameColor(color_t a, color_t b) {
+    return memcmp(&a, &b, sizeof(color_t)) == 0;
+}
+
+static void testMaxAge(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb) {
+    bool on, cached_on;
+    color_t color, cached_color;
+    char p_label[LIFX_LABEL_LENGTH + 1];
+
+    // nothing is cached yet
+    CHECK(lifx_get_color(p_ctx, p_bulb, LONG_AGE_MS, &on, &color, p_label) == 0);
+    lifx_stats_t stats = lx_test_bulb_stats(p_ctx, p_bulb->target);
+    CHECK(stats.packets_sent == 1);
+    CHECK(stats.cache_hits == 0);
+
+    // the LightState confirmed power, color & label
+    CHECK(lifx_get_color(p_ctx, p_bulb, LONG_AGE_MS, &cached_on, &cached_color, p_label) == 0);
+    CHECK(cached_on == on);
+    CHECK(sameColor(cached_color, color));
+    CHECK(lifx_get_power(p_ctx, p_bulb, LONG_AGE_MS, &cached_on) == 0);
+    CHECK(cached_on == on);
+    stats = lx_test_bulb_stats(p_ctx, p_bulb->target);
+    CHECK(stats.packets_sent == 1);
+    CHECK(stats.cache_hits == 2);
+
+    // older than the max age
+    usleep(2 * SHORT_AGE_MS * 1000);
+    CHECK(lifx_get_color(p_ctx, p_bulb, SHORT_AGE_MS, &on, &color, p_label) == 0);
+    stats = lx_test_bulb_stats(p_ctx, p_bulb->target);
+    CHECK(stats.packets_sent == 2);
+    CHECK(stats.cache_hits == 2);
+
+    // a max age of 0 always asks the bulb
+    CHECK(lifx_get_power(p_ctx, p_bulb, 0, &on) == 0);
+    stats = lx_test_bulb_stats(p_ctx, p_bulb->target);
+    CHECK(stats.packets_sent == 3);
+    CHECK(stats.cache_hits == 2);
+}
+
+static void testInvalidation(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb) {
+    color_t color = {
+        .hue = 4242,
+        .saturation = 0xFFFF,
+        .brightness = 0x4000,
+        .kelvin = 4000,
+    };
+    lifx_op_t set_op;
+    memset(&set_op, 0, sizeof(set_op));
+    CHECK(lifx_submit_set_color(p_ctx, &set_op, p_bulb, color, 0) == 0);
+    lifx_bulb_state_t state;
+    CHECK(lifx_get_bulb_state(p_ctx, p_bulb->target, &state) == 0);
+    CHECK(state.color_us == 0);
+    CHECK(state.power_us != 0);
+
+    // the color is unknown until the set is confirmed, the power is not changed by it
+    lifx_op_t color_op;
+    memset(&color_op, 0, sizeof(color_op));
+    color_op.max_age_ms = LONG_AGE_MS;
+    CHECK(lifx_submit_get_color(p_ctx, &color_op, p_bulb) == 0);
+    CHECK(color_op.status == LIFX_OP_PENDING);
+    lifx_op_t power_op;
+    memset(&power_op, 0, sizeof(power_op));
+    power_op.max_age_ms = LONG_AGE_MS;
+    CHECK(lifx_submit_get_power(p_ctx, &power_op, p_bulb) == 0);
+    CHECK(power_op.status == LIFX_OP_DONE);
+    CHECK(lifx_wait_all(p_ctx) == 0);
+    CHECK(set_op.status == LIFX_OP_DONE);
+    CHECK(color_op.status == LIFX_OP_DONE);
+    CHECK(sameColor(color_op.color, color));
+
+    // the bulb answers the set with the color before the change, the requested one is cached
+    color.hue = 2424;
+    CHECK(setColor(p_ctx, p_bulb, color, 0) == 0);
+    CHECK(lifx_get_bulb_state(p_ctx, p_bulb->target, &state) == 0);
+    CHECK(state.color_us != 0);
+    CHECK(sameColor(state.color, color));
+    lifx_stats_t before = lx_test_bulb_stats(p_ctx, p_bulb->target);
+    bool on;
+    color_t cached_color;
+    char p_label[LIFX_LABEL_LENGTH + 1];
+    CHECK(lifx_get_color(p_ctx, p_bulb, LONG_AGE_MS, &on, &cached_color, p_label) == 0);
+    CHECK(sameColor(cached_color, color));
+    lifx_stats_t after = lx_test_bulb_stats(p_ctx, p_bulb->target);
+    CHECK(after.packets_sent == before.packets_sent);
+    CHECK(after.cache_hits == before.cache_hits + 1);
+}
+
+int main(void) {
+    pid_t pid = lx_test_spawn_simulator(1, BASE_PORT, DISCOVERY_PORT, 0);
+    if (pid < 0) {
+        return 1;
+    }
+    lifx_ctx_t *p_ctx;
+    if (init_lifx_lib(&p_ctx)) {
+        lx_test_stop_simulator(pid);
+        return 1;
+    }
+    lifx_set_broadcast_addr(p_ctx, INADDR_LOOPBACK, DISCOVERY_PORT);
+    lifx_registry_t registry;
+    lifx_registry_init(&registry);
+
+    if (discoverBulbs(p_ctx, &registry) == 0 && registry.count == 1) {
+        testMaxAge(p_ctx, &registry.p_bulbs[0]);
+        testInvalidation(p_ctx, &registry.p_bulbs[0]);
+    } else {
+        printf("discovering the simulated bulb failed\n");
+        lx_test_failures++;
+    }
+
+    lifx_registry_free(&registry);
+    close_lifx_lib(p_ctx);
+    lx_test_stop_simulator(pid);
+    return lx_test_report("cache");
+}
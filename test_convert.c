@@ -0,0 +1,208 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Checks that every kernel the CPU supports produces exactly the bytes of the scalar kernel: for all RGB8 pixels,
+ * for NaN, infinite & out of range RGBf channels and for counts that leave a tail for the scalar loop.
+ * Sources of the tail counts end right before an inaccessible page, so a kernel that reads past `count` crashes,
+ * and the destinations are followed by guard values no kernel may overwrite.
+ */
+
+#include <sys/mman.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "test_util.h"
+
+
+/** pixels converted with a single call when all RGB8 pixels are compared */
+#define CHUNK (4096)
+/** all counts up to this one are compared, which covers every tail of the 4 & 8 pixel loops */
+#define MAX_TAIL (40)
+/** elements after the destination that have to keep their value */
+#define GUARD (4)
+#define GUARD_BYTE (0xA5)
+#define MAX_ELEMENT_SIZE (sizeof(lifx_rgbf_t))
+
+
+typedef enum {
+    RGB8_TO_HSBK = 0,
+    RGBF_TO_HSBK,
+    HSBK_TO_RGB8,
+    HSBK_TO_RGBF,
+} direction_t;
+
+static const char *const pp_directions[] = { "rgb8 to hsbk", "rgbf to hsbk", "hsbk to rgb8", "hsbk to rgbf" };
+static const size_t p_src_sizes[] = { sizeof(lifx_rgb8_t), sizeof(lifx_rgbf_t), sizeof(color_t), sizeof(color_t) };
+static const size_t p_dst_sizes[] = { sizeof(color_t), sizeof(color_t), sizeof(lifx_rgb8_t), sizeof(lifx_rgbf_t) };
+
+/** kernels compared against the scalar one, if the CPU supports them */
+static const char *const pp_kernels[] = { "avx2", "sse4.1" };
+
+static uint8_t p_expected[(CHUNK + GUARD) * MAX_ELEMENT_SIZE];
+static uint8_t p_actual[(CHUNK + GUARD) * MAX_ELEMENT_SIZE];
+/** readable page followed by an inaccessible one */
+static uint8_t *p_guarded = NULL;
+static size_t page_size = 0;
+
+
+static void convert(direction_t direction, const lifx_convert_t *p_convert, const void *p_src, void *p_dst, size_t count) {
+    switch (direction) {
+        case RGB8_TO_HSBK:
+            lifx_rgb8_to_hsbk(p_convert, p_src, p_dst, count);
+            break;
+        case RGBF_TO_HSBK:
+            lifx_rgbf_to_hsbk(p_convert, p_src, p_dst, count);
+            break;
+        case HSBK_TO_RGB8:
+            lifx_hsbk_to_rgb8(p_convert, p_src, p_dst, count);
+            break;
+        case HSBK_TO_RGBF:
+            lifx_hsbk_to_rgbf(p_convert, p_src, p_dst, count);
+            break;
+    }
+}
+
+/** converts `count` elements with the scalar kernel & with `p_kernel`, the destinations including their guards have to match */
+static void compareKernel(const char *p_kernel, direction_t direction, const lifx_convert_t *p_convert, const void *p_src, size_t count) {
+    size_t size = (count + GUARD) * p_dst_sizes[direction];
+    memset(p_expected, GUARD_BYTE, size);
+    memset(p_actual, GUARD_BYTE, size);
+    lifx_convert_select("scalar");
+    convert(direction, p_convert, p_src, p_expected, count);
+    lifx_convert_select(p_kernel);
+    convert(direction, p_convert, p_src, p_actual, count);
+    if (memcmp(p_expected, p_actual, size) != 0) {
+        printf("%s differs from scalar converting %zu colors %s\n", p_kernel, count, pp_directions[direction]);
+        lx_test_failures++;
+    }
+}
+
+/** compares all counts up to `MAX_TAIL` with a source that ends right before the inaccessible page */
+static void compareTails(const char *p_kernel, direction_t direction, const lifx_convert_t *p_convert, const void *p_src) {
+    for (size_t count = 0; count <= MAX_TAIL; count++) {
+        size_t size = count * p_src_sizes[direction];
+        uint8_t *p_copy = p_guarded + page_size - size;
+        memcpy(p_copy, p_src, size);
+        compareKernel(p_kernel, direction, p_convert, p_copy, count);
+    }
+}
+
+static void compareAllRgb8(const char *p_kernel, const lifx_convert_t *p_convert) {
+    static lifx_rgb8_t p_pixels[CHUNK];
+    for (uint32_t first = 0; first < (UINT32_C(1) << 24); first += CHUNK) {
+        for (uint32_t i = 0; i < CHUNK; i++) {
+            uint32_t value = first + i;
+            p_pixels[i] = (lifx_rgb8_t) {
+                .r = (uint8_t)(value >> 16),
+                .g = (uint8_t)(value >> 8),
+                .b = (uint8_t)value,
+            };
+        }
+        compareKernel(p_kernel, RGB8_TO_HSBK, p_convert, p_pixels, CHUNK);
+    }
+}
+
+/** pixels whose channels take values next to 0, the middle & the maximum, including all corners of the RGB cube */
+static size_t rgb8Corners(lifx_rgb8_t *p_pixels) {
+    static const uint8_t p_values[] = { 0, 1, 2, 127, 128, 129, 253, 254, 255 };
+    const size_t n = sizeof(p_values);
+    for (size_t i = 0; i < n * n * n; i++) {
+        p_pixels[i] = (lifx_rgb8_t) {
+            .r = p_values[i % n],
+            .g = p_values[i / n % n],
+            .b = p_values[i / n / n],
+        };
+    }
+    return n * n * n;
+}
+
+/** pixels whose channels are NaN, infinite, negative, larger than 1 or on the edges of 0 - 1 */
+static size_t rgbfSpecials(lifx_rgbf_t *p_pixels) {
+    const float p_values[] = {
+        NAN, -NAN, INFINITY, -INFINITY, -1, -0.0f, 0, FLT_MIN / 2, 0.5f, 1 - FLT_EPSILON / 2, 1, 1 + FLT_EPSILON, 2, FLT_MAX,
+    };
+    const size_t n = sizeof(p_values) / sizeof(p_values[0]);
+    for (size_t i = 0; i < n * n * n; i++) {
+        p_pixels[i] = (lifx_rgbf_t) {
+            .r = p_values[i % n],
+            .g = p_values[i / n % n],
+            .b = p_values[i / n / n],
+        };
+    }
+    return n * n * n;
+}
+
+/** colors on the boundaries of the sixths of the color wheel with extreme saturation & brightness */
+static size_t hsbkCorners(color_t *p_colors) {
+    static const uint16_t p_hues[] = { 0, 1, 10922, 10923, 21845, 32768, 43690, 54613, 65535 };
+    static const uint16_t p_levels[] = { 0, 1, 32768, 65535 };
+    const size_t hues = sizeof(p_hues) / sizeof(p_hues[0]);
+    const size_t levels = sizeof(p_levels) / sizeof(p_levels[0]);
+    for (size_t i = 0; i < hues * levels * levels; i++) {
+        p_colors[i] = (color_t) {
+            .hue = p_hues[i % hues],
+            .saturation = p_levels[i / hues % levels],
+            .brightness = p_levels[i / hues / levels],
+            .kelvin = (uint16_t)(2500 + i),
+        };
+    }
+    return hues * levels * levels;
+}
+
+static void compareKernels(const char *p_kernel, const lifx_convert_t *p_convert) {
+    static lifx_rgb8_t p_rgb8[CHUNK];
+    static lifx_rgbf_t p_rgbf[CHUNK];
+    static color_t p_hsbk[CHUNK];
+    size_t rgb8_count = rgb8Corners(p_rgb8);
+    size_t rgbf_count = rgbfSpecials(p_rgbf);
+    size_t hsbk_count = hsbkCorners(p_hsbk);
+
+    compareAllRgb8(p_kernel, p_convert);
+    compareKernel(p_kernel, RGB8_TO_HSBK, p_convert, p_rgb8, rgb8_count);
+    compareKernel(p_kernel, RGBF_TO_HSBK, p_convert, p_rgbf, rgbf_count);
+    compareKernel(p_kernel, HSBK_TO_RGB8, p_convert, p_hsbk, hsbk_count);
+    compareKernel(p_kernel, HSBK_TO_RGBF, p_convert, p_hsbk, hsbk_count);
+    // the specials start with NaN & the corners with black, so the tails contain them
+    compareTails(p_kernel, RGB8_TO_HSBK, p_convert, p_rgb8);
+    compareTails(p_kernel, RGBF_TO_HSBK, p_convert, p_rgbf);
+    compareTails(p_kernel, HSBK_TO_RGB8, p_convert, p_hsbk);
+    compareTails(p_kernel, HSBK_TO_RGBF, p_convert, p_hsbk);
+}
+
+int main(void) {
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    p_guarded = mmap(NULL, 2 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p_guarded == MAP_FAILED || mprotect(p_guarded + page_size, page_size, PROT_NONE)) {
+        printf("mapping the guard page failed\n");
+        return 1;
+    }
+
+    // a neutral white point & one that scales the channels differently
+    lifx_convert_t p_converts[2];
+    lifx_convert_init(&p_converts[0], 6500);
+    lifx_convert_init(&p_converts[1], 2700);
+    p_converts[1].white = lifx_white_point(2700);
+
+    for (size_t i = 0; i < sizeof(pp_kernels) / sizeof(pp_kernels[0]); i++) {
+        if (lifx_convert_select(pp_kernels[i])) {
+            printf("kernel %s is not supported by the CPU, skipped\n", pp_kernels[i]);
+            continue;
+        }
+        for (size_t j = 0; j < sizeof(p_converts) / sizeof(p_converts[0]); j++) {
+            compareKernels(pp_kernels[i], &p_converts[j]);
+        }
+    }
+    CHECK(lifx_convert_select("scalar") == 0);
+    CHECK(lifx_convert_select("unknown") == -1);
+
+    munmap(p_guarded, 2 * page_size);
+    return lx_test_report("convert");
+}
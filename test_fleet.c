@@ -0,0 +1,148 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Checks the arrays of a fleet after batches that only part of the bulbs confirm: the simulated bulbs answer,
+ * the bulbs on unbound ports of the loopback interface never do. The confirmed bulbs get the read or requested
+ * values, the others keep their last confirmed ones.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fleet.h"
+#include "lifx.h"
+#include "registry.h"
+#include "test_util.h"
+
+
+#define BASE_PORT (46801)
+#define DISCOVERY_PORT (46800)
+#define SIMULATED_BULBS (16)
+/** bulbs without a simulator behind them, their ports follow the ones of the simulated bulbs */
+#define SILENT_BULBS (4)
+#define SILENT_TARGET (UINT64_C(0xFFFF00000000))
+
+
+static bool isSilent(const lifx_fleet_t *p_fleet, size_t index) {
+    return p_fleet->p_targets[index] >= SILENT_TARGET;
+}
+
+static bool sameColor(color_t a, color_t b) {
+    return memcmp(&a, &b, sizeof(color_t)) == 0;
+}
+
+/** gives the silent bulbs a known last confirmed state, which no batch may overwrite */
+static int addSilentBulbs(lifx_fleet_t *p_fleet, color_t color, bool on) {
+    for (size_t i = 0; i < SILENT_BULBS; i++) {
+        bulb_service_t bulb = {
+            .in_addr = INADDR_LOOPBACK,
+            .target = SILENT_TARGET + i,
+            .service = 1,
+            .port = BASE_PORT + SIMULATED_BULBS + i,
+        };
+        long index = lifx_fleet_add(p_fleet, &bulb);
+        if (index < 0) {
+            return -1;
+        }
+        p_fleet->p_colors[index] = color;
+        p_fleet->p_on[index] = on;
+    }
+    return 0;
+}
+
+static void testRefresh(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, color_t silent_color, bool silent_on) {
+    int failed = lifx_fleet_refresh(p_ctx, p_fleet, 0, p_fleet->count, 0);
+    CHECK(failed == SILENT_BULBS);
+    for (size_t i = 0; i < p_fleet->count; i++) {
+        if (isSilent(p_fleet, i)) {
+            CHECK(p_fleet->p_status[i] == LIFX_OP_TIMEOUT);
+            CHECK(sameColor(p_fleet->p_colors[i], silent_color));
+            CHECK(p_fleet->p_on[i] == silent_on);
+        } else {
+            CHECK(p_fleet->p_status[i] == LIFX_OP_DONE);
+        }
+    }
+}
+
+static void testSetColors(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, color_t silent_color) {
+    color_t p_colors[SIMULATED_BULBS + SILENT_BULBS];
+    for (size_t i = 0; i < p_fleet->count; i++) {
+        p_colors[i] = (color_t) {
+            .hue = (uint16_t)(1000 + i),
+            .saturation = 0xFFFF,
+            .brightness = 0x8000,
+            .kelvin = 3500,
+        };
+    }
+    int failed = lifx_fleet_set_colors(p_ctx, p_fleet, 0, p_fleet->count, p_colors, 0);
+    CHECK(failed == SILENT_BULBS);
+    for (size_t i = 0; i < p_fleet->count; i++) {
+        if (isSilent(p_fleet, i)) {
+            CHECK(p_fleet->p_status[i] == LIFX_OP_TIMEOUT);
+            CHECK(sameColor(p_fleet->p_colors[i], silent_color));
+        } else {
+            CHECK(p_fleet->p_status[i] == LIFX_OP_DONE);
+            CHECK(sameColor(p_fleet->p_colors[i], p_colors[i]));
+        }
+    }
+}
+
+static void testSetPower(lifx_ctx_t *p_ctx, lifx_fleet_t *p_fleet, bool silent_on) {
+    int failed = lifx_fleet_set_power(p_ctx, p_fleet, 0, p_fleet->count, !silent_on, 0);
+    CHECK(failed == SILENT_BULBS);
+    for (size_t i = 0; i < p_fleet->count; i++) {
+        if (isSilent(p_fleet, i)) {
+            CHECK(p_fleet->p_status[i] == LIFX_OP_TIMEOUT);
+            CHECK(p_fleet->p_on[i] == silent_on);
+        } else {
+            CHECK(p_fleet->p_status[i] == LIFX_OP_DONE);
+            CHECK(p_fleet->p_on[i] == !silent_on);
+        }
+    }
+}
+
+int main(void) {
+    pid_t pid = lx_test_spawn_simulator(SIMULATED_BULBS, BASE_PORT, DISCOVERY_PORT, 0);
+    if (pid < 0) {
+        return 1;
+    }
+    lifx_ctx_t *p_ctx;
+    if (init_lifx_lib(&p_ctx)) {
+        lx_test_stop_simulator(pid);
+        return 1;
+    }
+    lifx_set_broadcast_addr(p_ctx, INADDR_LOOPBACK, DISCOVERY_PORT);
+    lifx_registry_t registry;
+    lifx_fleet_t fleet;
+    lifx_registry_init(&registry);
+    lifx_fleet_init(&fleet);
+
+    color_t silent_color = {
+        .hue = 12345,
+        .saturation = 1,
+        .brightness = 2,
+        .kelvin = 2700,
+    };
+    bool silent_on = true;
+    if (discoverBulbs(p_ctx, &registry) == 0 && registry.count == SIMULATED_BULBS &&
+            lifx_fleet_add_registry(&fleet, &registry) == 0 && addSilentBulbs(&fleet, silent_color, silent_on) == 0) {
+        testRefresh(p_ctx, &fleet, silent_color, silent_on);
+        testSetColors(p_ctx, &fleet, silent_color);
+        testSetPower(p_ctx, &fleet, silent_on);
+    } else {
+        printf("setting up the fleet failed, %zu of %d simulated bulbs discovered\n", registry.count, SIMULATED_BULBS);
+        lx_test_failures++;
+    }
+
+    lifx_fleet_free(&fleet);
+    lifx_registry_free(&registry);
+    close_lifx_lib(p_ctx);
+    lx_test_stop_simulator(pid);
+    return lx_test_report("fleet");
+}
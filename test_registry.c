@@ -0,0 +1,194 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Checks that the bulbs of a registry survive `lifx_registry_save` & `lifx_registry_load`, and that missing, 
+ * truncated, extended or otherwise corrupt files are rejected without touching the registry.
+ */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "registry.h"
+#include "test_util.h"
+
+
+/** enough bulbs to grow the registry & its indexes several times */
+#define BULBS (1000)
+#define PATH_LENGTH (256)
+/** offsets of magic, version & record count in the header of the file */
+#define MAGIC_OFFSET (0)
+#define VERSION_OFFSET (4)
+#define COUNT_OFFSET (8)
+
+
+static char p_dir[] = "/tmp/lifx_test_registry_XXXXXX";
+static char p_path[PATH_LENGTH];
+static char p_corrupt_path[PATH_LENGTH];
+
+
+static bulb_service_t bulbAt(size_t i) {
+    return (bulb_service_t) {
+        .in_addr = 0x0A000000u + (unsigned long)i,
+        .target = UINT64_C(0xD073D5000000) + i * 0x10001,
+        .service = 1,
+        .port = 56700 + (uint32_t)(i % 7),
+    };
+}
+
+static bool sameBulb(const bulb_service_t *p_a, const bulb_service_t *p_b) {
+    return p_a->target == p_b->target && p_a->in_addr == p_b->in_addr && p_a->port == p_b->port && p_a->service == p_b->service;
+}
+
+/** @returns whether the registry holds exactly the bulbs 0 - count */
+static bool holdsBulbs(const lifx_registry_t *p_registry, size_t count) {
+    if (p_registry->count != count) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        bulb_service_t bulb = bulbAt(i);
+        const bulb_service_t *p_found = lifx_registry_find_target(p_registry, bulb.target);
+        if (p_found == NULL || !sameBulb(p_found, &bulb) || lifx_registry_find_addr(p_registry, bulb.in_addr, bulb.port) != p_found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testRoundTrip(void) {
+    lifx_registry_t saved, loaded;
+    lifx_registry_init(&saved);
+    lifx_registry_init(&loaded);
+    for (size_t i = 0; i < BULBS; i++) {
+        bulb_service_t bulb = bulbAt(i);
+        CHECK(lifx_registry_upsert(&saved, &bulb) == 1);
+    }
+    CHECK(lifx_registry_save(&saved, p_path) == 0);
+    CHECK(lifx_registry_load(&loaded, p_path) == BULBS);
+    CHECK(holdsBulbs(&loaded, BULBS));
+
+    // known bulbs are updated, loading the file again adds nothing
+    bulb_service_t moved = bulbAt(0);
+    moved.in_addr = 0x0B000000u;
+    CHECK(lifx_registry_upsert(&loaded, &moved) == 0);
+    CHECK(lifx_registry_load(&loaded, p_path) == BULBS);
+    CHECK(holdsBulbs(&loaded, BULBS));
+
+    // an empty registry makes a valid file without records
+    lifx_registry_t empty;
+    lifx_registry_init(&empty);
+    CHECK(lifx_registry_save(&empty, p_path) == 0);
+    CHECK(lifx_registry_load(&loaded, p_path) == 0);
+    CHECK(holdsBulbs(&loaded, BULBS));
+
+    lifx_registry_free(&empty);
+    lifx_registry_free(&loaded);
+    lifx_registry_free(&saved);
+}
+
+/** writes `size` bytes of the file at `p_path` to `p_corrupt_path`, `p_patch` replaces `patch_size` bytes at `offset` */
+static int writeCorrupt(size_t size, size_t offset, const uint8_t *p_patch, size_t patch_size) {
+    FILE *p_file = fopen(p_path, "rb");
+    if (p_file == NULL) {
+        return -1;
+    }
+    // a file shorter than `size` is extended with zeros
+    uint8_t *p_bytes = calloc(size + 1, 1);
+    bool valid = p_bytes != NULL && (fread(p_bytes, 1, size, p_file) == size || !ferror(p_file));
+    fclose(p_file);
+    if (!valid) {
+        free(p_bytes);
+        return -1;
+    }
+    memcpy(p_bytes + offset, p_patch, patch_size);
+    p_file = fopen(p_corrupt_path, "wb");
+    bool written = p_file != NULL && fwrite(p_bytes, 1, size, p_file) == size;
+    if (p_file != NULL) {
+        fclose(p_file);
+    }
+    free(p_bytes);
+    return written ? 0 : -1;
+}
+
+/** the file at `p_corrupt_path` has to be rejected without changing the registry */
+static void checkRejected(const char *p_case) {
+    lifx_registry_t registry;
+    lifx_registry_init(&registry);
+    for (size_t i = 0; i < 2; i++) {
+        bulb_service_t bulb = bulbAt(i);
+        lifx_registry_upsert(&registry, &bulb);
+    }
+    if (lifx_registry_load(&registry, p_corrupt_path) != -1 || !holdsBulbs(&registry, 2)) {
+        printf("%s was not rejected\n", p_case);
+        lx_test_failures++;
+    }
+    lifx_registry_free(&registry);
+}
+
+static void testCorruptFiles(void) {
+    lifx_registry_t registry;
+    lifx_registry_init(&registry);
+    for (size_t i = 0; i < 3; i++) {
+        bulb_service_t bulb = bulbAt(i);
+        lifx_registry_upsert(&registry, &bulb);
+    }
+    CHECK(lifx_registry_save(&registry, p_path) == 0);
+    lifx_registry_free(&registry);
+    struct stat file_stat;
+    CHECK(stat(p_path, &file_stat) == 0);
+    size_t size = (size_t)file_stat.st_size;
+
+    unlink(p_corrupt_path);
+    checkRejected("missing file");
+    CHECK(writeCorrupt(0, 0, NULL, 0) == 0);
+    checkRejected("empty file");
+    CHECK(writeCorrupt(COUNT_OFFSET, 0, NULL, 0) == 0);
+    checkRejected("truncated header");
+    CHECK(writeCorrupt(size - 1, 0, NULL, 0) == 0);
+    checkRejected("truncated record");
+    CHECK(writeCorrupt(size + 1, 0, NULL, 0) == 0);
+    checkRejected("appended byte");
+    const uint8_t p_bad_magic[] = { 'X' };
+    CHECK(writeCorrupt(size, MAGIC_OFFSET, p_bad_magic, sizeof(p_bad_magic)) == 0);
+    checkRejected("wrong magic");
+    const uint8_t p_bad_version[] = { 0xFF };
+    CHECK(writeCorrupt(size, VERSION_OFFSET, p_bad_version, sizeof(p_bad_version)) == 0);
+    checkRejected("unknown version");
+    const uint8_t p_huge_count[] = { 0xFF, 0xFF, 0xFF, 0xFF };
+    CHECK(writeCorrupt(size, COUNT_OFFSET, p_huge_count, sizeof(p_huge_count)) == 0);
+    checkRejected("huge record count");
+    const uint8_t p_small_count[] = { 2, 0, 0, 0 };
+    CHECK(writeCorrupt(size, COUNT_OFFSET, p_small_count, sizeof(p_small_count)) == 0);
+    checkRejected("record count below the records");
+
+    // the untouched file still loads
+    CHECK(writeCorrupt(size, 0, NULL, 0) == 0);
+    lifx_registry_init(&registry);
+    CHECK(lifx_registry_load(&registry, p_corrupt_path) == 3);
+    CHECK(holdsBulbs(&registry, 3));
+    lifx_registry_free(&registry);
+}
+
+int main(void) {
+    if (mkdtemp(p_dir) == NULL) {
+        printf("creating a temporary directory failed\n");
+        return 1;
+    }
+    snprintf(p_path, sizeof(p_path), "%s/registry.bin", p_dir);
+    snprintf(p_corrupt_path, sizeof(p_corrupt_path), "%s/corrupt.bin", p_dir);
+
+    testRoundTrip();
+    testCorruptFiles();
+
+    unlink(p_path);
+    unlink(p_corrupt_path);
+    CHECK(rmdir(p_dir) == 0);
+    return lx_test_report("registry");
+}
@@ -0,0 +1,126 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Round trip of a scene against simulated bulbs: the captured state is saved, loaded again and restored after the
+ * bulbs were changed, which has to bring back power & color of every bulb.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lifx.h"
+#include "registry.h"
+#include "scene.h"
+#include "test_util.h"
+
+
+#define BASE_PORT (46861)
+#define DISCOVERY_PORT (46860)
+#define SIMULATED_BULBS (8)
+#define PATH_LENGTH (256)
+
+
+static bool sameColor(color_t a, color_t b) {
+    return memcmp(&a, &b, sizeof(color_t)) == 0;
+}
+
+static bool sameEntry(const lifx_scene_entry_t *p_a, const lifx_scene_entry_t *p_b) {
+    return p_a->target == p_b->target && p_a->on == p_b->on && sameColor(p_a->color, p_b->color) && p_a->valid == p_b->valid;
+}
+
+/** gives every bulb its own color & alternating power */
+static void setBulbs(lifx_ctx_t *p_ctx, lifx_registry_t *p_registry, uint16_t hue, bool on) {
+    for (size_t i = 0; i < p_registry->count; i++) {
+        color_t color = {
+            .hue = (uint16_t)(hue + 5000 * i),
+            .saturation = 0xFFFF,
+            .brightness = (uint16_t)(0x1000 * (i + 1)),
+            .kelvin = (uint16_t)(2500 + 100 * i),
+        };
+        CHECK(setColor(p_ctx, &p_registry->p_bulbs[i], color, 0) == 0);
+        CHECK(setPower(p_ctx, &p_registry->p_bulbs[i], on == (i % 2 == 0), 0) == 0);
+    }
+}
+
+static void testRoundTrip(lifx_ctx_t *p_ctx, lifx_registry_t *p_registry, const char *p_path) {
+    setBulbs(p_ctx, p_registry, 1000, true);
+    lifx_scene_t captured, loaded;
+    lifx_scene_init(&captured);
+    lifx_scene_init(&loaded);
+    CHECK(lifx_scene_capture(p_ctx, &captured, p_registry, 0) == 0);
+    CHECK(captured.count == p_registry->count);
+    for (size_t i = 0; i < captured.count; i++) {
+        CHECK(captured.p_entries[i].valid);
+        CHECK(captured.p_entries[i].target == p_registry->p_bulbs[i].target);
+        CHECK(captured.p_entries[i].on == (i % 2 == 0));
+        CHECK(captured.p_entries[i].color.hue == (uint16_t)(1000 + 5000 * i));
+    }
+
+    CHECK(lifx_scene_save(&captured, p_path) == 0);
+    CHECK(lifx_scene_load(&loaded, p_path) == 0);
+    CHECK(loaded.count == captured.count);
+    for (size_t i = 0; i < loaded.count && i < captured.count; i++) {
+        CHECK(sameEntry(&loaded.p_entries[i], &captured.p_entries[i]));
+    }
+
+    // the bulbs change, e.g. for an alarm, and get their state back from the loaded scene
+    setBulbs(p_ctx, p_registry, 30000, false);
+    CHECK(lifx_scene_restore(p_ctx, &loaded, p_registry, 0) == 0);
+    for (size_t i = 0; i < captured.count; i++) {
+        bool on;
+        color_t color;
+        char p_label[LIFX_LABEL_LENGTH + 1];
+        CHECK(getColor(p_ctx, &p_registry->p_bulbs[i], &on, &color, p_label) == 0);
+        CHECK(on == captured.p_entries[i].on);
+        CHECK(sameColor(color, captured.p_entries[i].color));
+    }
+
+    lifx_scene_free(&loaded);
+    lifx_scene_free(&captured);
+}
+
+int main(void) {
+    char p_dir[] = "/tmp/lifx_test_scene_XXXXXX";
+    if (mkdtemp(p_dir) == NULL) {
+        printf("creating a temporary directory failed\n");
+        return 1;
+    }
+    char p_path[PATH_LENGTH];
+    snprintf(p_path, sizeof(p_path), "%s/scene.bin", p_dir);
+    pid_t pid = lx_test_spawn_simulator(SIMULATED_BULBS, BASE_PORT, DISCOVERY_PORT, 0);
+    if (pid < 0) {
+        rmdir(p_dir);
+        return 1;
+    }
+    lifx_ctx_t *p_ctx;
+    if (init_lifx_lib(&p_ctx)) {
+        lx_test_stop_simulator(pid);
+        rmdir(p_dir);
+        return 1;
+    }
+    lifx_set_broadcast_addr(p_ctx, INADDR_LOOPBACK, DISCOVERY_PORT);
+    lifx_registry_t registry;
+    lifx_registry_init(&registry);
+
+    if (discoverBulbs(p_ctx, &registry) == 0 && registry.count == SIMULATED_BULBS) {
+        testRoundTrip(p_ctx, &registry, p_path);
+    } else {
+        printf("discovering the simulated bulbs failed, %zu of %d found\n", registry.count, SIMULATED_BULBS);
+        lx_test_failures++;
+    }
+
+    lifx_registry_free(&registry);
+    close_lifx_lib(p_ctx);
+    lx_test_stop_simulator(pid);
+    unlink(p_path);
+    CHECK(rmdir(p_dir) == 0);
+    return lx_test_report("scene");
+}
@@ -0,0 +1,117 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Checks the steering of a shard group against simulated bulbs: every shard asks its own bulbs from its own thread,
+ * and every response has to arrive at the context `lifx_shard_of` picked for the bulb. A response steered to another
+ * shard would be unmatched there and the request waiting for it would time out.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lifx.h"
+#include "registry.h"
+#include "shard.h"
+#include "test_util.h"
+
+
+#define BASE_PORT (46851)
+#define DISCOVERY_PORT (46850)
+#define SIMULATED_BULBS (32)
+#define SHARDS (3)
+#define TIMEOUT_MS (1000)
+
+
+typedef struct {
+    const lifx_shards_t *p_shards;
+    lifx_registry_t *p_registry;
+    /** written by the thread of each shard */
+    size_t p_requests[SHARDS];
+    size_t p_done[SHARDS];
+} shard_test_t;
+
+
+/** asks all bulbs of the shard at once */
+static int queryShard(lifx_ctx_t *p_ctx, size_t shard, void *p_user) {
+    shard_test_t *p_test = p_user;
+    lifx_registry_t *p_registry = p_test->p_registry;
+    lifx_op_t *p_ops = calloc(p_registry->count, sizeof(lifx_op_t));
+    if (p_ops == NULL) {
+        printf("allocating requests failed\n");
+        return -1;
+    }
+    for (size_t i = 0; i < p_registry->count; i++) {
+        if (lifx_shard_of(p_test->p_shards, p_registry->p_bulbs[i].target) != shard) {
+            continue;
+        }
+        p_ops[i].timeout_ms = TIMEOUT_MS;
+        lifx_submit_get_color(p_ctx, &p_ops[i], &p_registry->p_bulbs[i]);
+        p_test->p_requests[shard]++;
+    }
+    int res = lifx_wait_all(p_ctx);
+    for (size_t i = 0; i < p_registry->count; i++) {
+        p_test->p_done[shard] += p_ops[i].status == LIFX_OP_DONE;
+    }
+    free(p_ops);
+    return res;
+}
+
+static void testSteering(lifx_shards_t *p_shards, lifx_registry_t *p_registry) {
+    shard_test_t test = {
+        .p_shards = p_shards,
+        .p_registry = p_registry,
+    };
+    for (size_t i = 0; i < p_shards->count; i++) {
+        lifx_reset_stats(p_shards->pp_ctxs[i]);
+    }
+    CHECK(lifx_shards_run(p_shards, queryShard, &test) == 0);
+
+    size_t requests = 0;
+    for (size_t i = 0; i < p_shards->count; i++) {
+        // every shard has bulbs, otherwise a response could not land on the wrong one
+        CHECK(test.p_requests[i] > 0);
+        CHECK(test.p_done[i] == test.p_requests[i]);
+        lifx_stats_t stats;
+        CHECK(lifx_get_stats(p_shards->pp_ctxs[i], &stats) == 0);
+        CHECK(stats.packets_received == test.p_requests[i]);
+        CHECK(stats.unmatched == 0);
+        CHECK(stats.timeouts == 0);
+        requests += test.p_requests[i];
+    }
+    CHECK(requests == p_registry->count);
+}
+
+int main(void) {
+    pid_t pid = lx_test_spawn_simulator(SIMULATED_BULBS, BASE_PORT, DISCOVERY_PORT, 0);
+    if (pid < 0) {
+        return 1;
+    }
+    lifx_shards_t shards;
+    if (lifx_shards_init(&shards, SHARDS, 0)) {
+        lx_test_stop_simulator(pid);
+        return 1;
+    }
+    lifx_registry_t registry;
+    lifx_registry_init(&registry);
+
+    // StateService responses are steered to shard 0
+    lifx_set_broadcast_addr(shards.pp_ctxs[0], INADDR_LOOPBACK, DISCOVERY_PORT);
+    if (discoverBulbs(shards.pp_ctxs[0], &registry) == 0 && registry.count == SIMULATED_BULBS) {
+        testSteering(&shards, &registry);
+    } else {
+        printf("discovering the simulated bulbs failed, %zu of %d found\n", registry.count, SIMULATED_BULBS);
+        lx_test_failures++;
+    }
+
+    lifx_registry_free(&registry);
+    lifx_shards_free(&shards);
+    lx_test_stop_simulator(pid);
+    return lx_test_report("shard");
+}
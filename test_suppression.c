@@ -0,0 +1,132 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Checks the write suppression against a simulated bulb: a set request for the state the bulb confirmed recently
+ * is not sent, but one whose cached value was invalidated by another request or is too old is.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lifx.h"
+#include "registry.h"
+#include "test_util.h"
+
+
+#define BASE_PORT (46831)
+#define DISCOVERY_PORT (46830)
+/** suppression age no test runs long enough to exceed */
+#define LONG_AGE_MS (60000)
+#define SHORT_AGE_MS (20)
+
+
+/** submits a SetColor & waits for it, @returns its final status */
+static lifx_op_status_t setColorStatus(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, color_t color) {
+    lifx_op_t op;
+    memset(&op, 0, sizeof(op));
+    CHECK(lifx_submit_set_color(p_ctx, &op, p_bulb, color, 0) == 0);
+    CHECK(lifx_wait(p_ctx, &op) == 0);
+    return op.status;
+}
+
+static lifx_op_status_t setPowerStatus(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, bool on) {
+    lifx_op_t op;
+    memset(&op, 0, sizeof(op));
+    CHECK(lifx_submit_set_power(p_ctx, &op, p_bulb, on, 0) == 0);
+    CHECK(lifx_wait(p_ctx, &op) == 0);
+    return op.status;
+}
+
+static void testRedundantSets(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, color_t color) {
+    lifx_set_write_suppression(p_ctx, LONG_AGE_MS);
+    CHECK(setColorStatus(p_ctx, p_bulb, color) == LIFX_OP_DONE);
+    CHECK(setPowerStatus(p_ctx, p_bulb, true) == LIFX_OP_DONE);
+    lifx_stats_t before = lx_test_bulb_stats(p_ctx, p_bulb->target);
+
+    CHECK(setColorStatus(p_ctx, p_bulb, color) == LIFX_OP_SUPPRESSED);
+    CHECK(setPowerStatus(p_ctx, p_bulb, true) == LIFX_OP_SUPPRESSED);
+    CHECK(setColor(p_ctx, p_bulb, color, 0) == 0);
+    lifx_stats_t after = lx_test_bulb_stats(p_ctx, p_bulb->target);
+    CHECK(after.suppressed - before.suppressed == 3);
+    CHECK(after.packets_sent == before.packets_sent);
+
+    // a different value is sent
+    CHECK(setPowerStatus(p_ctx, p_bulb, false) == LIFX_OP_DONE);
+    color.hue++;
+    CHECK(setColorStatus(p_ctx, p_bulb, color) == LIFX_OP_DONE);
+    after = lx_test_bulb_stats(p_ctx, p_bulb->target);
+    CHECK(after.suppressed - before.suppressed == 3);
+    CHECK(after.packets_sent - before.packets_sent == 2);
+}
+
+static void testInvalidated(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb, color_t color) {
+    lifx_set_write_suppression(p_ctx, LONG_AGE_MS);
+    CHECK(setColorStatus(p_ctx, p_bulb, color) != LIFX_OP_FAILED);
+    lifx_stats_t before = lx_test_bulb_stats(p_ctx, p_bulb->target);
+
+    // the zones change the color the cache knows
+    color_t p_zones[2] = { color, color };
+    p_zones[1].hue++;
+    CHECK(setExtendedColorZones(p_ctx, p_bulb, 0, p_zones, 2, 0) == 0);
+    CHECK(setColorStatus(p_ctx, p_bulb, color) == LIFX_OP_DONE);
+
+    // the color is unknown while an earlier set of it is not confirmed
+    lifx_op_t p_ops[2];
+    memset(p_ops, 0, sizeof(p_ops));
+    color.hue++;
+    CHECK(lifx_submit_set_color(p_ctx, &p_ops[0], p_bulb, color, 0) == 0);
+    CHECK(lifx_submit_set_color(p_ctx, &p_ops[1], p_bulb, color, 0) == 0);
+    CHECK(lifx_wait_all(p_ctx) == 0);
+    CHECK(p_ops[0].status == LIFX_OP_DONE);
+    CHECK(p_ops[1].status == LIFX_OP_DONE);
+
+    // the confirmed state is too old
+    lifx_set_write_suppression(p_ctx, SHORT_AGE_MS);
+    usleep(2 * SHORT_AGE_MS * 1000);
+    CHECK(setColorStatus(p_ctx, p_bulb, color) == LIFX_OP_DONE);
+
+    lifx_stats_t after = lx_test_bulb_stats(p_ctx, p_bulb->target);
+    CHECK(after.suppressed == before.suppressed);
+    CHECK(after.packets_sent - before.packets_sent == 5);
+}
+
+int main(void) {
+    pid_t pid = lx_test_spawn_simulator(1, BASE_PORT, DISCOVERY_PORT, 0);
+    if (pid < 0) {
+        return 1;
+    }
+    lifx_ctx_t *p_ctx;
+    if (init_lifx_lib(&p_ctx)) {
+        lx_test_stop_simulator(pid);
+        return 1;
+    }
+    lifx_set_broadcast_addr(p_ctx, INADDR_LOOPBACK, DISCOVERY_PORT);
+    lifx_registry_t registry;
+    lifx_registry_init(&registry);
+
+    color_t color = {
+        .hue = 21845,
+        .saturation = 0xFFFF,
+        .brightness = 0xC000,
+        .kelvin = 3500,
+    };
+    if (discoverBulbs(p_ctx, &registry) == 0 && registry.count == 1) {
+        testRedundantSets(p_ctx, &registry.p_bulbs[0], color);
+        testInvalidated(p_ctx, &registry.p_bulbs[0], color);
+    } else {
+        printf("discovering the simulated bulb failed\n");
+        lx_test_failures++;
+    }
+
+    lifx_registry_free(&registry);
+    close_lifx_lib(p_ctx);
+    lx_test_stop_simulator(pid);
+    return lx_test_report("suppression");
+}
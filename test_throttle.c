@@ -0,0 +1,130 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+/*
+ * Checks the rate limit against a simulated bulb: requests leave at most at the configured rate and a throttled
+ * SetColor or SetPower is replaced by a newer one of the same type, so that only the newest value reaches the bulb.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lifx.h"
+#include "registry.h"
+#include "test_util.h"
+
+
+#define BASE_PORT (46811)
+#define DISCOVERY_PORT (46810)
+#define MESSAGES_PER_SECOND (20)
+#define INTERVAL_US (1000000 / MESSAGES_PER_SECOND)
+/** requests sent back to back to the throttled bulb */
+#define REQUESTS (6)
+
+
+static void testRate(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb) {
+    // no packet was sent to the bulb yet, so it has no counters
+    lifx_stats_t before;
+    CHECK(lifx_get_bulb_stats(p_ctx, p_bulb->target, &before) == -1);
+    memset(&before, 0, sizeof(before));
+    lifx_op_t p_ops[REQUESTS];
+    memset(p_ops, 0, sizeof(p_ops));
+    for (size_t i = 0; i < REQUESTS; i++) {
+        CHECK(lifx_submit_get_power(p_ctx, &p_ops[i], p_bulb) == 0);
+    }
+    CHECK(lifx_wait_all(p_ctx) == 0);
+    for (size_t i = 0; i < REQUESTS; i++) {
+        CHECK(p_ops[i].status == LIFX_OP_DONE);
+        // the slots are spaced from the first request on & the timer never fires before a slot
+        CHECK(p_ops[i].sent_us - p_ops[0].submitted_us >= (int64_t)i * INTERVAL_US);
+    }
+
+    lifx_stats_t after;
+    CHECK(lifx_get_bulb_stats(p_ctx, p_bulb->target, &after) == 0);
+    CHECK(after.throttled - before.throttled == REQUESTS - 1);
+    CHECK(after.coalesced == before.coalesced);
+}
+
+static void testCoalesceColor(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb) {
+    lifx_op_t p_ops[3];
+    memset(p_ops, 0, sizeof(p_ops));
+    color_t p_colors[3];
+    for (size_t i = 0; i < 3; i++) {
+        p_colors[i] = (color_t) {
+            .hue = (uint16_t)(10000 * (i + 1)),
+            .saturation = 0xFFFF,
+            .brightness = 0x8000,
+            .kelvin = 3500,
+        };
+    }
+    lifx_stats_t before;
+    CHECK(lifx_get_bulb_stats(p_ctx, p_bulb->target, &before) == 0);
+    // the slot of the rate test is used up, so all requests are throttled & the second one gets replaced
+    for (size_t i = 0; i < 3; i++) {
+        CHECK(lifx_submit_set_color(p_ctx, &p_ops[i], p_bulb, p_colors[i], 0) == 0);
+    }
+    CHECK(lifx_wait_all(p_ctx) == 0);
+    CHECK(p_ops[0].status == LIFX_OP_COALESCED);
+    CHECK(p_ops[1].status == LIFX_OP_COALESCED);
+    CHECK(p_ops[2].status == LIFX_OP_DONE);
+
+    lifx_stats_t after;
+    CHECK(lifx_get_bulb_stats(p_ctx, p_bulb->target, &after) == 0);
+    CHECK(after.coalesced - before.coalesced == 2);
+    CHECK(after.packets_sent - before.packets_sent == 1);
+
+    bool on;
+    color_t color;
+    char p_label[LIFX_LABEL_LENGTH + 1];
+    CHECK(getColor(p_ctx, p_bulb, &on, &color, p_label) == 0);
+    CHECK(memcmp(&color, &p_colors[2], sizeof(color_t)) == 0);
+}
+
+static void testCoalescePower(lifx_ctx_t *p_ctx, bulb_service_t *p_bulb) {
+    lifx_op_t p_ops[2];
+    memset(p_ops, 0, sizeof(p_ops));
+    CHECK(lifx_submit_set_power(p_ctx, &p_ops[0], p_bulb, false, 0) == 0);
+    CHECK(lifx_submit_set_power(p_ctx, &p_ops[1], p_bulb, true, 0) == 0);
+    CHECK(lifx_wait_all(p_ctx) == 0);
+    CHECK(p_ops[0].status == LIFX_OP_COALESCED);
+    CHECK(p_ops[1].status == LIFX_OP_DONE);
+
+    bool on = false;
+    CHECK(getPower(p_ctx, p_bulb, &on) == 0);
+    CHECK(on);
+}
+
+int main(void) {
+    pid_t pid = lx_test_spawn_simulator(1, BASE_PORT, DISCOVERY_PORT, 0);
+    if (pid < 0) {
+        return 1;
+    }
+    lifx_ctx_t *p_ctx;
+    if (init_lifx_lib(&p_ctx)) {
+        lx_test_stop_simulator(pid);
+        return 1;
+    }
+    lifx_set_broadcast_addr(p_ctx, INADDR_LOOPBACK, DISCOVERY_PORT);
+    lifx_registry_t registry;
+    lifx_registry_init(&registry);
+
+    if (discoverBulbs(p_ctx, &registry) == 0 && registry.count == 1) {
+        lifx_set_rate_limit(p_ctx, MESSAGES_PER_SECOND, 1);
+        testRate(p_ctx, &registry.p_bulbs[0]);
+        testCoalesceColor(p_ctx, &registry.p_bulbs[0]);
+        testCoalescePower(p_ctx, &registry.p_bulbs[0]);
+    } else {
+        printf("discovering the simulated bulb failed\n");
+        lx_test_failures++;
+    }
+
+    lifx_registry_free(&registry);
+    close_lifx_lib(p_ctx);
+    lx_test_stop_simulator(pid);
+    return lx_test_report("throttle");
+}
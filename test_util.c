@@ -0,0 +1,88 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "test_util.h"
+
+
+#define SIMULATOR "./simulator"
+#define OUTPUT_LINE_LENGTH (256)
+
+
+int lx_test_failures = 0;
+
+pid_t lx_test_spawn_simulator(size_t bulbs, uint32_t base_port, uint32_t discovery_port, uint32_t latency_ms) {
+    int p_pipe[2];
+    if (pipe(p_pipe)) {
+        printf("creating pipe failed (err %d (%s))\n", errno, strerror(errno));
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("forking simulator failed (err %d (%s))\n", errno, strerror(errno));
+        close(p_pipe[0]);
+        close(p_pipe[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        char p_bulbs[24], p_base_port[12], p_discovery_port[12], p_latency[12];
+        snprintf(p_bulbs, sizeof(p_bulbs), "%zu", bulbs);
+        snprintf(p_base_port, sizeof(p_base_port), "%u", base_port);
+        snprintf(p_discovery_port, sizeof(p_discovery_port), "%u", discovery_port);
+        snprintf(p_latency, sizeof(p_latency), "%u", latency_ms);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        dup2(p_pipe[1], STDOUT_FILENO);
+        close(p_pipe[0]);
+        close(p_pipe[1]);
+        execl(SIMULATOR, SIMULATOR, "-n", p_bulbs, "-p", p_base_port, "-d", p_discovery_port, "-l", p_latency, (char *)NULL);
+        printf("starting %s failed (err %d (%s))\n", SIMULATOR, errno, strerror(errno));
+        _exit(127);
+    }
+
+    close(p_pipe[1]);
+    FILE *p_stream = fdopen(p_pipe[0], "r");
+    char p_line[OUTPUT_LINE_LENGTH];
+    bool ready = p_stream != NULL && fgets(p_line, sizeof(p_line), p_stream) != NULL
+        && strncmp(p_line, "simulating", strlen("simulating")) == 0;
+    if (p_stream != NULL) {
+        fclose(p_stream);
+    } else {
+        close(p_pipe[0]);
+    }
+    if (!ready) {
+        printf("simulator did not start\n");
+        lx_test_stop_simulator(pid);
+        return -1;
+    }
+    return pid;
+}
+
+void lx_test_stop_simulator(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+lifx_stats_t lx_test_bulb_stats(lifx_ctx_t *p_ctx, uint64_t target) {
+    lifx_stats_t stats;
+    if (lifx_get_bulb_stats(p_ctx, target, &stats)) {
+        memset(&stats, 0, sizeof(stats));
+    }
+    return stats;
+}
+
+int lx_test_report(const char *p_name) {
+    printf("%s: %s\n", p_name, lx_test_failures == 0 ? "all checks passed" : "checks failed");
+    return lx_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+/*
+**  LIFX C Library
+**  Copyright 2016 Linard Arquint
+*/
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "lifx.h"
+#include "stats.h"
+
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            lx_test_failures++; \
+        } \
+    } while (0)
+
+/** number of failed checks of the test */
+extern int lx_test_failures;
+
+/**
+ * Starts `./simulator` with `bulbs` bulbs on consecutive ports from `base_port`, its process is terminated together
+ * with the test. Every test uses its own ports, so that the tests can run in parallel
+ * @returns pid of the simulator once it answers requests, -1 on error
+ */
+pid_t lx_test_spawn_simulator(size_t bulbs, uint32_t base_port, uint32_t discovery_port, uint32_t latency_ms);
+
+void lx_test_stop_simulator(pid_t pid);
+
+/** @returns the counters of the bulb, all 0 if no packet was sent to it yet */
+lifx_stats_t lx_test_bulb_stats(lifx_ctx_t *p_ctx, uint64_t target);
+
+/** prints whether all checks passed, @returns exit code of the test */
+int lx_test_report(const char *p_name);
+
+#endif